@@ -8,6 +8,9 @@
 
 extern void __init naive_allocator_init ( const struct e820_map *e820, struct pmem_layout *pml );
 unsigned long alloc_pages ( unsigned long nr_pfns, unsigned long pfn_align );
+extern void free_pages ( unsigned long pfn, unsigned long nr_pfns );
+extern void alloc_get_stats ( unsigned long *nr_calls, unsigned long *nr_allocated );
+extern void alloc_print_stats ( void );
 
 
 
@@ -0,0 +1,34 @@
+#ifndef __APIC_H__
+#define __APIC_H__
+
+
+#include "types.h"
+
+
+/* Local APIC registers (offsets from the APIC base) 
+ * [REF] AMD64 manual Vol. 2, Chapter 16 */
+#define APIC_ID		0x020
+#define APIC_EOI	0x0b0
+#define APIC_SVR	0x0f0  /* Spurious interrupt vector */
+#define APIC_LVT_TIMER	0x320
+#define APIC_TIMER_ICR	0x380  /* Initial count */
+#define APIC_TIMER_CCR	0x390  /* Current count */
+#define APIC_TIMER_DCR	0x3e0  /* Divide configuration */
+
+#define APIC_SVR_ENABLE		( 1 << 8 )
+#define APIC_LVT_MASKED		( 1 << 16 )
+#define APIC_LVT_PERIODIC	( 1 << 17 )
+#define APIC_TIMER_DIV_1	0xb
+
+/* Interrupt vectors used by the VMM */
+#define APIC_TIMER_VECTOR	0xf0
+#define APIC_SPURIOUS_VECTOR	0xff
+
+
+extern void lapic_init ( void );
+extern void lapic_timer_start ( u32 period );
+extern void lapic_timer_stop ( void );
+extern void lapic_eoi ( void );
+
+
+#endif /* __APIC_H__ */
@@ -0,0 +1,44 @@
+#ifndef __BALLOON_H__
+#define __BALLOON_H__
+
+
+#include "types.h"
+
+
+/* Paravirtual balloon with free page reporting (balloon=<Mbytes> on the
+ * command line).  The guest polls HC_BALLOON_TARGET for the pages it still
+ * owes, and reports free guest-physical ranges with HC_BALLOON_REPORT, up
+ * to BALLOON_MAX_REPORTS ranges per exit.  Their nested mappings are
+ * removed, a whole large page at a time where a range covers one, and
+ * their frames queued for the reclaimer, which frees them in batches
+ * between slices.  The guest may reuse a reported page at any time: the
+ * first access faults in a zeroed frame. */
+
+#define BALLOON_MAX_REPORTS	64
+
+/* HC_BALLOON_REPORT entries, in guest memory */
+struct balloon_report {
+	u64 gpa;       /* page aligned */
+	u64 nr_pages;
+};
+
+struct vm_balloon {
+	unsigned long target;       /* pages the VMM asks for, 0 if disabled */
+	unsigned long nr_inflated;  /* pages reported and not touched since */
+
+	/* statistics */
+	unsigned long nr_calls, nr_ranges, nr_rejected, nr_released, nr_deflated;
+	u64 report_cycles;
+};
+
+
+struct vm;
+
+extern void balloon_init ( struct vm *vm, unsigned long target );
+extern unsigned long balloon_owed ( const struct vm *vm );
+extern unsigned long balloon_report ( struct vm *vm, unsigned long gva, unsigned long nr );
+extern int balloon_fault ( struct vm *vm, unsigned long gpa );
+extern void balloon_dump ( const struct vm *vm );
+
+
+#endif /* __BALLOON_H__ */
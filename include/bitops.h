@@ -62,6 +62,20 @@ static __inline__ int variable_test_bit(int nr, volatile const void * addr)
  constant_test_bit((nr),(addr)) : \
  variable_test_bit((nr),(addr)))
 
+/**
+ * __fls - find last set bit in word
+ * @word: The word to search
+ *
+ * Undefined if no bit is set, so code should check against 0 first.
+ */
+static __inline__ unsigned long __fls(unsigned long word)
+{
+	__asm__("bsrq %1,%0"
+		:"=r" (word)
+		:"rm" (word));
+	return word;
+}
+
 #undef ADDR
 
 #endif /* __BITOPS_H__ */
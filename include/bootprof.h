@@ -0,0 +1,50 @@
+#ifndef __BOOTPROF_H__
+#define __BOOTPROF_H__
+
+
+#include "types.h"
+
+
+/* Start-up phases of the VMM, in the order they run.  Each phase ends 
+ * when the next one begins. */
+enum boot_phase {
+	BOOT_PHASE_MEMORY_REGION,    /* setup_memory_region */
+	BOOT_PHASE_COPY_GUEST_IMAGE, /* place_guest_images */
+	BOOT_PHASE_ALLOCATOR_INIT,   /* naive_allocator_init */
+	BOOT_PHASE_TRACE_INIT,       /* trace_init */
+	BOOT_PHASE_IDENTIFY_CPU,     /* identify_cpu */
+	BOOT_PHASE_INTERRUPT_INIT,   /* idt_init, lapic_init */
+	BOOT_PHASE_VM_CONTROL,       /* vm_create: VMCB, CPUID table, permission maps */
+	BOOT_PHASE_VM_PMEM,          /* vm_create: guest memory and nested page table */
+	BOOT_PHASE_VM_LOAD_IMAGE,    /* vm_create: ELF image and guest page table */
+	NR_BOOT_PHASES
+};
+
+struct bootprof_phase {
+	u64 cycles;
+	u64 bytes_copied;
+	u64 pages_allocated;
+	u64 pages_zeroed;
+};
+
+/* Also the format passed to the guest by HC_BOOTPROF_READ */
+struct bootprof {
+	u32 nr_phases;
+	u32 done;          /* set when the profile is complete */
+	u64 start_tsc;     /* TSC at start_vmm */
+	u64 total_cycles;
+	struct bootprof_phase phases [ NR_BOOT_PHASES ];
+};
+
+
+extern struct bootprof bootprof;
+
+extern void bootprof_start ( void );
+extern void bootprof_phase ( enum boot_phase phase );
+extern void bootprof_finish ( void );
+extern void bootprof_copied ( unsigned long bytes );
+extern void bootprof_allocated ( unsigned long nr_pages );
+extern void bootprof_zeroed ( unsigned long nr_pages );
+
+
+#endif /* __BOOTPROF_H__ */
@@ -0,0 +1,19 @@
+#ifndef __BULKMEM_H__
+#define __BULKMEM_H__
+
+
+#include "types.h"
+
+
+/* Bulk initialisation of guest memory with non-temporal stores, which 
+ * bypass the caches so that a large guest does not evict everything 
+ * else on the host.  The range is split into per-CPU chunks of at least
+ * BULK_MIN_CHUNK bytes. */
+
+#define BULK_MIN_CHUNK ( 1UL << 21 ) /* 2 MB */
+
+extern void bulk_clear ( void *dest, size_t len );
+extern void bulk_copy ( void *dest, const void *src, size_t len );
+
+
+#endif /* __BULKMEM_H__ */
@@ -33,6 +33,12 @@ struct cpuinfo_x86 {
 };
 
 
+/* Only the bootstrap processor is used. */
+#define NR_CPUS 1
+#define smp_processor_id() 0
+
+extern struct cpuinfo_x86 boot_cpu_data;
+
 extern void __init identify_cpu ( void );
 
 
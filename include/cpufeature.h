@@ -2,7 +2,7 @@
 #define __CPUFEATURE_H__
 
 
-#define NCAPINTS	7	/* N 32-bit words worth of info */
+#define NCAPINTS	10	/* N 32-bit words worth of info */
 
 /* Intel-defined CPU features, CPUID level 0x00000001, word 0 */
 #define X86_FEATURE_FPU		(0*32+ 0) /* Onboard FPU */
@@ -41,6 +41,8 @@
 #define X86_FEATURE_SYSCALL	(1*32+11) /* SYSCALL/SYSRET */
 #define X86_FEATURE_MMXEXT	(1*32+22) /* AMD MMX extensions */
 #define X86_FEATURE_FXSR_OPT	(1*32+25) /* FXSR optimizations */
+#define X86_FEATURE_GBPAGES	(1*32+26) /* 1-Gbyte pages */
+#define X86_FEATURE_RDTSCP	(1*32+27) /* RDTSCP and MSR TSC_AUX */
 #define X86_FEATURE_LM		(1*32+29) /* Long Mode (x86-64) */
 #define X86_FEATURE_3DNOWEXT	(1*32+30) /* AMD 3DNow! extensions */
 #define X86_FEATURE_3DNOW	(1*32+31) /* 3DNow! */
@@ -88,6 +90,24 @@
 #define X86_FEATURE_CMP_LEGACY	(6*32+ 1) /* If yes HyperThreading not valid */
 #define X86_FEATURE_SVME        (6*32+ 2) /* Secure Virtual Machine */
 
+/* AMD SVM features, CPUID level 0x8000000a, edx, word 7 */
+#define X86_FEATURE_NPT		(7*32+ 0) /* Nested paging */
+#define X86_FEATURE_LBRV	(7*32+ 1) /* LBR virtualization */
+#define X86_FEATURE_SVML	(7*32+ 2) /* SVM lock */
+#define X86_FEATURE_NRIPS	(7*32+ 3) /* Next RIP saved on #VMEXIT */
+#define X86_FEATURE_TSCRATEMSR	(7*32+ 4) /* TSC ratio MSR */
+#define X86_FEATURE_VMCBCLEAN	(7*32+ 5) /* VMCB clean bits */
+#define X86_FEATURE_FLUSHBYASID	(7*32+ 6) /* TLB flush by ASID */
+#define X86_FEATURE_DECODEASSISTS (7*32+ 7) /* Decode assists */
+#define X86_FEATURE_PAUSEFILTER	(7*32+10) /* PAUSE intercept filter */
+#define X86_FEATURE_PFTHRESHOLD	(7*32+12) /* PAUSE filter threshold */
+
+/* Structured extended features, CPUID level 0x00000007:0 (ebx), word 8 */
+#define X86_FEATURE_ERMS	(8*32+ 9) /* Enhanced REP MOVSB/STOSB */
+
+/* Structured extended features, CPUID level 0x00000007:0 (edx), word 9 */
+#define X86_FEATURE_FSRM	(9*32+ 4) /* Fast short REP MOVSB */
+
 
 
 #define cpu_has(c, bit)                test_bit(bit, (c)->x86_capability)
@@ -113,6 +133,13 @@
 #define cpu_has_cyrix_arr      0
 #define cpu_has_centaur_mcr    0
 #define cpu_has_clflush	       boot_cpu_has(X86_FEATURE_CLFLSH)
+#define cpu_has_gbpages        boot_cpu_has(X86_FEATURE_GBPAGES)
+#define cpu_has_rdtscp         boot_cpu_has(X86_FEATURE_RDTSCP)
+#define cpu_has_npt            boot_cpu_has(X86_FEATURE_NPT)
+#define cpu_has_nrips          boot_cpu_has(X86_FEATURE_NRIPS)
+#define cpu_has_decode_assists boot_cpu_has(X86_FEATURE_DECODEASSISTS)
+#define cpu_has_erms           boot_cpu_has(X86_FEATURE_ERMS)
+#define cpu_has_fsrm           boot_cpu_has(X86_FEATURE_FSRM)
 
 
 #endif /* __CPUFEATURE_H__ */
@@ -0,0 +1,43 @@
+#ifndef __CPUID_H__
+#define __CPUID_H__
+
+
+#include "types.h"
+
+
+/* The number of leaves held in each range of a per-VM CPUID table */
+enum {
+	CPUID_NR_BASIC      = 0x20, /* 0x00000000 - */
+	CPUID_NR_HYPERVISOR = 0x02, /* 0x40000000 - */
+	CPUID_NR_EXTENDED   = 0x20, /* 0x80000000 - */
+};
+
+#define CPUID_HYPERVISOR_SIGNATURE "TVMMTVMMTVMM"
+
+struct cpuid_leaf {
+	u32 eax, ebx, ecx, edx;
+};
+
+struct cpuid_range {
+	u32 nr_leaves;
+	u32 subleaf_map; /* bit N is set if the output of leaf N depends on ECX */
+	struct cpuid_leaf *leaves;
+};
+
+/* CPUID policy of a virtual machine.  It is computed once at VM creation
+ * so that the CPUID intercept is answered by a table lookup. */
+struct cpuid_table {
+	struct cpuid_range range [ 4 ]; /* indexed by bits 31:30 of the leaf */
+	struct cpuid_leaf basic [ CPUID_NR_BASIC ];
+	struct cpuid_leaf hypervisor [ CPUID_NR_HYPERVISOR ];
+	struct cpuid_leaf extended [ CPUID_NR_EXTENDED ];
+};
+
+
+struct vm;
+
+extern void cpuid_table_init ( struct cpuid_table *tbl );
+extern int handle_cpuid ( struct vm *vm );
+
+
+#endif /* __CPUID_H__ */
@@ -0,0 +1,25 @@
+#ifndef __DEBUGCON_H__
+#define __DEBUGCON_H__
+
+
+/* Bytes written to this port by the guest are printed by the VMM (Bochs/QEMU convention). */
+#define DEBUGCON_PORT		0xe9
+
+#define DEBUGCON_BUF_SIZE	128
+
+
+#ifndef __ASSEMBLY__
+
+struct debugcon {
+	char buf [ DEBUGCON_BUF_SIZE ];
+	int len;
+};
+
+struct vm;
+
+extern void debugcon_init ( struct vm *vm );
+
+#endif /* ! __ASSEMBLY__ */
+
+
+#endif /* __DEBUGCON_H__ */
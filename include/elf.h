@@ -115,7 +115,8 @@ struct Elf64_Phdr {
 
 #endif 
 
-extern unsigned long load_elf_image ( unsigned long guest_image_start, unsigned long guest_image_size, unsigned long vm_pmem_start );
+struct vm;
+extern unsigned long load_elf_image ( struct vm *vm, unsigned long guest_image_start, unsigned long guest_image_size, unsigned long vm_pmem_start );
 
 
 #endif /* __ELF_H__ */
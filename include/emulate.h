@@ -0,0 +1,34 @@
+#ifndef __EMULATE_H__
+#define __EMULATE_H__
+
+
+#include "types.h"
+#include "vm.h"
+
+
+#define MAX_INSN_LEN 15
+
+/* Why a guest address could not be accessed (returned by gva_to_gpa, 
+ * copy_{from,to}_guest and guest_range_check) */
+#define GUEST_ERR_PF	( -1 ) /* not mapped by the guest page table: #PF */
+#define GUEST_ERR_GPA	( -2 ) /* guest-physical address without memory: #GP */
+
+/* #PF error code (the same bits as the NPF one, see npf.h) */
+#define PFEC_WRITE	( 1 << 1 )
+#define PFEC_USER	( 1 << 2 )
+#define PFEC_FETCH	( 1 << 4 )
+
+
+extern void *gpa_to_hva ( struct vm *vm, unsigned long gpa, int write );
+extern int gva_to_gpa ( struct vm *vm, unsigned long gva, unsigned long *gpa );
+extern int copy_from_guest ( struct vm *vm, void *dest, unsigned long gva, size_t len );
+extern int copy_to_guest ( struct vm *vm, unsigned long gva, const void *src, size_t len );
+extern int guest_range_check ( struct vm *vm, unsigned long gva, size_t len, int write, unsigned long *fault );
+extern void inject_guest_fault ( struct vm *vm, int err, unsigned long gva, u32 pfec );
+
+extern int guest_cpu_mode ( const struct vmcb *vmcb );
+extern int insn_length ( const u8 *buf, size_t len, int mode );
+extern void skip_instruction ( struct vm *vm );
+
+
+#endif /* __EMULATE_H__ */
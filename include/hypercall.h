@@ -0,0 +1,54 @@
+#ifndef __HYPERCALL_H__
+#define __HYPERCALL_H__
+
+
+/* Hypercalls are issued with VMMCALL.  RAX holds the hypercall number
+ * and the result is returned in RAX. */
+
+#define HC_NOP		0x00 /* Return 0; used to measure the VMMCALL round trip */
+#define HC_BENCH_RESULT	0x01 /* RBX: benchmark ID, RCX: iterations, RDX: elapsed cycles */
+#define HC_VMSTAT_DUMP	0x02 /* Print the exit statistics of the caller */
+#define HC_BOOTPROF_READ	0x03 /* RBX: buffer (guest virtual), RCX: size.  Copy struct bootprof; return the bytes copied */
+#define HC_SHUTDOWN	0x04 /* Stop the virtual machine */
+#define HC_NPT_MODE	0x05 /* Return the nested page size mode (enum npt_mode) */
+#define HC_MEMACCT_READ	0x06 /* RBX: buffer (guest virtual), RCX: size.  Copy the caller's struct mem_account; return the bytes copied */
+#define HC_STATPAGE_GPA	0x07 /* Return the guest-physical address of the statistics page, or 0 if not mapped */
+#define HC_SNAPSHOT	0x08 /* Save the caller's state and memory.  Return 0, or 1 when resumed by HC_RESTORE */
+#define HC_RESTORE	0x09 /* Return the caller to its last snapshot; -1 if it has none.  RBX: nonzero to load memory on demand */
+#define HC_BALLOON_TARGET	0x0a /* Return the pages the caller is asked to give back (see balloon.h) */
+#define HC_BALLOON_REPORT	0x0b /* RBX: struct balloon_report array (guest virtual), RCX: entries.  Return the pages given back, or -1 */
+#define HC_MEM_SIZE	0x0c /* Return the bytes of guest memory; the MMIO hole starts there */
+
+
+/* Benchmark IDs */
+#define BENCH_CPUID		0x01
+#define BENCH_VMMCALL		0x02
+#define BENCH_PIO_IN		0x03 /* intercepted, unclaimed port */
+#define BENCH_PIO_OUT_PASS	0x04 /* pass-through port */
+#define BENCH_PIO_INS		0x05 /* REP INSB, one exit per string */
+#define BENCH_MSR_INTERCEPT	0x06
+#define BENCH_MSR_PASS		0x07
+#define BENCH_HLT		0x08
+#define BENCH_NPF		0x09
+#define BENCH_MEM_READ		0x0a /* per 64-byte line */
+#define BENCH_MEM_WRITE		0x0b
+#define BENCH_MEM_COPY		0x0c
+#define BENCH_TLB_SEQ		0x0d /* per 4-Kbyte page: sequential, independent loads */
+#define BENCH_TLB_RAND		0x0e /* random, independent loads */
+#define BENCH_TLB_CHASE		0x0f /* random, dependent loads (latency) */
+#define BENCH_STATPAGE_READ	0x10 /* consistent copy of the statistics page */
+#define BENCH_SNAPSHOT		0x11 /* snapshot, dirty memory, restore */
+#define BENCH_SNAPSHOT_LAZY	0x12 /* the same, restoring memory on demand */
+#define BENCH_BALLOON		0x13 /* report free memory, then touch it again */
+
+
+#ifndef __ASSEMBLY__
+
+struct vm;
+
+extern int handle_vmmcall ( struct vm *vm );
+
+#endif /* ! __ASSEMBLY__ */
+
+
+#endif /* __HYPERCALL_H__ */
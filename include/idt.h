@@ -0,0 +1,38 @@
+#ifndef __IDT_H__
+#define __IDT_H__
+
+
+#define NR_VECTORS	256
+
+
+#ifndef __ASSEMBLY__
+
+#include "types.h"
+
+/* 64-bit interrupt-gate descriptor (AMD64 manual Vol. 2, p. 90) */
+struct idt_entry {
+	u16 offset_low;
+	u16 selector;
+	u8  ist;
+	u8  type_attr;
+	u16 offset_mid;
+	u32 offset_high;
+	u32 reserved;
+} __attribute__ ((packed));
+
+extern volatile int timer_ticks_pending;
+
+extern void idt_init ( void );
+extern void idt_set_gate ( int vector, void ( *handler ) ( void ) );
+
+/* Let the host take the interrupts pending after #VMEXIT(INTR). */
+static inline void
+idt_take_pending_interrupts ( void )
+{
+	asm volatile ( "sti; nop; cli" ::: "memory" );
+}
+
+#endif /* ! __ASSEMBLY__ */
+
+
+#endif /* __IDT_H__ */
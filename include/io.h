@@ -0,0 +1,43 @@
+#ifndef __IO_H__
+#define __IO_H__
+
+
+#include "types.h"
+
+
+static inline u8
+inb ( u16 port )
+{
+	u8 val;
+	asm volatile ( "inb %1, %0" : "=a" ( val ) : "Nd" ( port ) );
+	return val;
+}
+
+static inline u32
+inl ( u16 port )
+{
+	u32 val;
+	asm volatile ( "inl %1, %0" : "=a" ( val ) : "Nd" ( port ) );
+	return val;
+}
+
+static inline void
+outb ( u8 val, u16 port )
+{
+	asm volatile ( "outb %0, %1" :: "a" ( val ), "Nd" ( port ) );
+}
+
+static inline void
+outl ( u32 val, u16 port )
+{
+	asm volatile ( "outl %0, %1" :: "a" ( val ), "Nd" ( port ) );
+}
+
+static inline void
+outsb ( u16 port, const void *addr, unsigned long count )
+{
+	asm volatile ( "rep; outsb" : "+S" ( addr ), "+c" ( count ) : "d" ( port ) );
+}
+
+
+#endif /* __IO_H__ */
@@ -0,0 +1,55 @@
+#ifndef __IOPORT_H__
+#define __IOPORT_H__
+
+
+#include "types.h"
+
+
+/* Size of the I/O permission map (AMD64 manual Vol. 2, p. 454) */
+#define IOPM_SIZE	( 12 << 10 ) /* 12 Kbytes */
+
+#define NR_IO_PORTS	0x10000
+#define MAX_IO_HANDLERS	32
+
+
+struct vm;
+
+/* Transfer COUNT elements of SIZE bytes between BUF and PORT.  For
+ * string instructions all the elements are passed in one call.
+ * Return 0 on success. */
+typedef int ( *ioport_handler_t ) ( struct vm *vm, void *opaque, u16 port, int size, int is_in, 
+				    void *buf, unsigned long count );
+
+struct io_handler {
+	u16 base, count;
+	ioport_handler_t func;
+	void *opaque;
+};
+
+struct io_space {
+	u8 *iopm;     /* I/O permission map (virtual address) */
+	u8 *port_map; /* port --> index + 1 of handlers (0 if no handler) */
+	struct io_handler handlers [ MAX_IO_HANDLERS ];
+	int nr_handlers;
+};
+
+/* Decoded EXITINFO1 of the IOIO intercept (vol. 2, p. 456) */
+struct ioio_info {
+	u16 port;
+	u8  size;      /* 1, 2 or 4 (bytes) */
+	u8  addr_size; /* 16, 32 or 64 (bits) */
+	u8  is_in;
+	u8  is_string;
+	u8  is_rep;
+	u8  seg;       /* effective segment (decode assists) */
+};
+
+
+extern void ioport_init ( struct io_space *io );
+extern unsigned long ioport_iopm_base ( const struct io_space *io );
+extern void ioport_register ( struct io_space *io, u16 base, u16 count, ioport_handler_t func, void *opaque );
+extern void ioport_passthrough ( struct io_space *io, u16 base, u16 count );
+extern int handle_ioio ( struct vm *vm );
+
+
+#endif /* __IOPORT_H__ */
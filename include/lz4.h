@@ -0,0 +1,22 @@
+#ifndef __LZ4_H__
+#define __LZ4_H__
+
+
+#include "types.h"
+
+
+/* [REF] LZ4 Frame Format Description, LZ4 Block Format Description */
+
+#define LZ4_FRAME_MAGIC		0x184D2204
+#define LZ4_WINDOW_SIZE		( 1 << 16 ) /* maximum match offset */
+
+/* Receives the decompressed stream in order: LEN bytes at offset POS */
+typedef void ( *lz4_sink_t ) ( void *arg, unsigned long pos, const u8 *buf, size_t len );
+
+extern int lz4_is_frame ( const void *src, size_t len );
+extern long lz4_decompress_frame ( const void *src, size_t len, lz4_sink_t sink, void *arg );
+extern long lz4_decompress_block ( const void *src, size_t len, void *dest, size_t cap );
+extern long lz4_compress_block ( const void *src, size_t len, void *dest, size_t cap );
+
+
+#endif /* __LZ4_H__ */
@@ -0,0 +1,50 @@
+#ifndef __MEMACCT_H__
+#define __MEMACCT_H__
+
+
+#include "types.h"
+
+
+/* Host memory accounting.  Pages taken from alloc_pages are charged to
+ * the account set by memacct_begin (a VM's), and to the host-wide
+ * totals; pages allocated outside memacct_begin/memacct_end are the
+ * VMM's own.  Memory given back leaves the VM's account at once 
+ * (memacct_release) and the host-wide totals once it is actually free 
+ * (memacct_freed). */
+enum mem_type {
+	MEM_GUEST_RAM,
+	MEM_NPT,      /* nested page table */
+	MEM_VMCB,
+	MEM_IOPM,
+	MEM_MSRPM,
+	MEM_DEVICE,   /* I/O port handler map and emulated devices */
+	MEM_VCPU,     /* struct vm: registers, CPUID table, statistics */
+	MEM_PROFILE,  /* guest profiler samples */
+	MEM_SNAPSHOT, /* saved guest state and memory */
+	MEM_ZPOOL,    /* compressed cold guest pages */
+	MEM_VMM,      /* not on behalf of a VM: trace rings, host save area */
+	NR_MEM_TYPES
+};
+
+/* Also the format passed to the guest by HC_MEMACCT_READ */
+struct mem_account {
+	u64 bytes [ NR_MEM_TYPES ];
+};
+
+
+extern struct mem_account memacct_host;
+
+extern void memacct_begin ( struct mem_account *acct, enum mem_type type );
+extern void memacct_type ( enum mem_type type );
+extern void memacct_end ( void );
+extern void memacct_charge ( struct mem_account *acct, enum mem_type type, unsigned long bytes );
+extern void memacct_allocated ( unsigned long nr_pages );
+extern void memacct_unallocated ( unsigned long nr_pages );
+extern void memacct_release ( struct mem_account *acct, enum mem_type type, unsigned long bytes );
+extern void memacct_freed ( enum mem_type type, unsigned long bytes );
+extern u64 memacct_total ( const struct mem_account *acct );
+extern void memacct_print_vm ( const struct mem_account *acct );
+extern void memacct_print_host ( void );
+
+
+#endif /* __MEMACCT_H__ */
@@ -3,10 +3,35 @@
 
 
 /* MSR name and MSR address (AMD64 manual vol. 2, pp. 506-509) */
+#define MSR_TSC		   0x00000010 /* Time-stamp counter */
+#define MSR_APIC_BASE	   0x0000001b /* APIC base address */
+#define MSR_MTRR_CAP	   0x000000fe
+#define MSR_SYSENTER_CS	   0x00000174
+#define MSR_SYSENTER_ESP   0x00000175
+#define MSR_SYSENTER_EIP   0x00000176
+#define MSR_MCG_CAP	   0x00000179
+#define MSR_MCG_STATUS	   0x0000017a
+#define MSR_MCG_CTL	   0x0000017b
 #define MSR_PAT		   0x00000277 /* Page-attribute table (PAT) */
+#define MSR_MTRR_DEF_TYPE  0x000002ff
+#define MSR_K7_EVNTSEL0	   0xc0010000 /* Performance event select 0-3 */
+#define MSR_K7_PERFCTR0	   0xc0010004 /* Performance counter 0-3 */
 #define MSR_K7_HWCR	   0xc0010015
 #define MSR_K8_VM_HSAVE_PA 0xc0010117
 #define MSR_EFER 	   0xc0000080 /* Extended feature register */
+#define MSR_STAR	   0xc0000081 /* Legacy-mode SYSCALL target */
+#define MSR_LSTAR	   0xc0000082 /* Long-mode SYSCALL target */
+#define MSR_CSTAR	   0xc0000083 /* Compatibility-mode SYSCALL target */
+#define MSR_SFMASK	   0xc0000084 /* SYSCALL flag mask */
+#define MSR_FS_BASE	   0xc0000100
+#define MSR_GS_BASE	   0xc0000101
+#define MSR_KERNEL_GS_BASE 0xc0000102
+#define MSR_TSC_AUX	   0xc0000103 /* Auxiliary TSC (RDTSCP) */
+
+/* APIC base MSR bits */
+#define APIC_BASE_BSP	   ( 1 << 8 )
+#define APIC_BASE_ENABLE   ( 1 << 11 )
+#define APIC_DEFAULT_BASE  0xfee00000
 
 
 /* EFER bits (vol. 2, p. 69) */ 
@@ -44,6 +69,18 @@ cpuid ( int op, unsigned int *eax, unsigned int *ebx,
 		: "0" (op));
 }
 
+static inline void 
+cpuid_count ( int op, int count, unsigned int *eax, unsigned int *ebx,
+	      unsigned int *ecx, unsigned int *edx )
+{
+	__asm__("cpuid"
+		: "=a" (*eax),
+		  "=b" (*ebx),
+		  "=c" (*ecx),
+		  "=d" (*edx)
+		: "0" (op), "c" (count));
+}
+
 static inline unsigned int 
 cpuid_eax(unsigned int op)
 {
@@ -92,6 +129,13 @@ unsigned int cpuid_edx(unsigned int op)
 	return edx;
 }
 
+#define rdtscll(val) \
+	do { \
+		unsigned int __a, __d; \
+		__asm__ __volatile__("rdtsc" : "=a" (__a), "=d" (__d)); \
+		(val) = ((unsigned long)__a) | (((unsigned long)__d) << 32); \
+	} while (0)
+
 #define rdmsr(msr,val1,val2) \
        __asm__ __volatile__("rdmsr" \
 			    : "=a" (val1), "=d" (val2) \
@@ -102,6 +146,13 @@ unsigned int cpuid_edx(unsigned int op)
 			  : /* no outputs */ \
 			  : "c" (msr), "a" (val1), "d" (val2))
 
+#define rdpmcll(counter,val) \
+	do { \
+		unsigned int __a, __d; \
+		__asm__ __volatile__("rdpmc" : "=a" (__a), "=d" (__d) : "c" (counter)); \
+		(val) = ((unsigned long)__a) | (((unsigned long)__d) << 32); \
+	} while (0)
+
 #endif /* __ASSEMBLY__ */
 
 
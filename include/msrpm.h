@@ -0,0 +1,34 @@
+#ifndef __MSRPM_H__
+#define __MSRPM_H__
+
+
+#include "types.h"
+
+
+/* Size of the MSR permission map (AMD64 manual Vol. 2, p. 454) */
+#define MSRPM_SIZE	( 8 << 10 ) /* 8 Kbytes */
+
+enum msr_policy {
+	MSR_INTERCEPT,      /* Both RDMSR and WRMSR exit */
+	MSR_PASSTHROUGH,    /* The guest accesses the MSR directly */
+	MSR_PASSTHROUGH_RO, /* RDMSR is direct, WRMSR exits */
+};
+
+/* Guest copies of the intercepted MSRs which are not held in the VMCB */
+struct guest_msrs {
+	u64 apic_base;
+	u64 mtrr_def_type;
+	u64 mcg_status;
+	u64 tsc_aux;   /* loaded into the MSR for each slice (RDTSCP and RDPID read it) */
+};
+
+
+struct vm;
+
+extern unsigned long msrpm_create ( void );
+extern void guest_msrs_init ( struct guest_msrs *msrs );
+extern void guest_msrs_load ( const struct vm *vm );
+extern int handle_msr ( struct vm *vm );
+
+
+#endif /* __MSRPM_H__ */
@@ -0,0 +1,18 @@
+#ifndef __NPF_H__
+#define __NPF_H__
+
+
+/* EXITINFO1 of #VMEXIT(NPF) (AMD64 manual Vol. 2, p. 490) */
+#define NPF_PRESENT	( 1 << 0 )
+#define NPF_WRITE	( 1 << 1 )
+#define NPF_USER	( 1 << 2 )
+#define NPF_RSVD	( 1 << 3 )
+#define NPF_FETCH	( 1 << 4 )
+
+
+struct vm;
+
+extern int handle_npf ( struct vm *vm );
+
+
+#endif /* __NPF_H__ */
@@ -9,6 +9,9 @@
 #define PAGE_SHIFT_2MB 21
 #define PAGE_SIZE_2MB  ( 1 << PAGE_SHIFT_2MB )
 
+#define PAGE_SHIFT_1GB 30
+#define PAGE_SIZE_1GB  ( 1 << PAGE_SHIFT_1GB )
+
 
 #define PFN_UP(x)	(((x) + PAGE_SIZE - 1) >> PAGE_SHIFT)
 #define PFN_DOWN(x)	((x) >> PAGE_SHIFT)
@@ -61,9 +64,13 @@
 enum pg_table_level {
 	PGT_LEVEL_PML4 = 4,
 	PGT_LEVEL_PDP  = 3,
-	PGT_LEVEL_PD   = 2
+	PGT_LEVEL_PD   = 2,
+	PGT_LEVEL_PT   = 1
 };
 
+/* Physical address bits 12-51 of an entry */
+#define PGT_ENTRY_ADDR_MASK 0x000ffffffffff000UL
+
 /* [REF] AMD64 manual Vol. 2, pp. 166-167 */
 
 /* For 2-Mbyte page translation (long-mode) */
@@ -83,11 +90,24 @@ union pgt_entry {
 		u16 avail: 11; /* Bit 52-62 */
 		u16 nx:    1;  /* Bit 63    */
 	} __attribute__ ((packed)) term;
+
+	/* Any level (4-Kbyte PTE and 1-Gbyte PDPE included) */
+	u64 raw;
 };  
 
 unsigned long pml4_table_create ( void );
+
+/* Called for each page of a page table that is torn down */
+typedef void ( *pgt_release_t ) ( void *arg, unsigned long pfn );
+extern unsigned long pml4_table_destroy ( unsigned long pml4_table_base_vaddr, pgt_release_t release, void *arg );
 extern void mmap ( unsigned long pml4_table_base_vaddr, unsigned long vaddr, unsigned long paddr, int is_user );
+extern void mmap_page ( unsigned long pml4_table_base_vaddr, unsigned long vaddr, unsigned long paddr, enum pg_table_level leaf, unsigned long flags );
+extern unsigned long pgt_level_page_size ( enum pg_table_level level );
+extern void munmap_range ( unsigned long pml4_table_base_vaddr, unsigned long vaddr, unsigned long size );
+extern int pgt_test_and_clear_accessed ( unsigned long pml4_table_base_vaddr, unsigned long vaddr, unsigned long size );
 extern unsigned long vaddr_to_paddr ( unsigned long pml4_table_base_vaddr, unsigned long vaddr );
+extern int pgt_lookup ( unsigned long pml4_table_base_vaddr, unsigned long vaddr, unsigned long *paddr, unsigned long *flags );
+extern unsigned long vaddr_to_paddr_page ( unsigned long pml4_table_base_vaddr, unsigned long vaddr, unsigned long *page_size );
 extern void print_pg_table ( unsigned long pml4_table_base_vaddr );
 
 #endif /* ! __ASSEMBLY__ */
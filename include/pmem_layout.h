@@ -2,12 +2,22 @@
 #define __PMEM_LAYOUT_H__
 
 
+#define MAX_GUEST_IMAGES	8   /* one VM per multiboot module */
+#define GUEST_CMDLINE_SIZE	128
+
+struct guest_image {
+	unsigned long start, size;             /* physical address and bytes */
+	char cmdline [ GUEST_CMDLINE_SIZE ];   /* the module string */
+};
+
 struct pmem_layout {
 	unsigned long max_page;
 	unsigned long total_pages;
 
 	unsigned long vmm_heap_start, vmm_heap_end;
-	unsigned long guest_image_start, guest_image_size;
+
+	int nr_guest_images;
+	struct guest_image guest_images [ MAX_GUEST_IMAGES ];
 };
 
 
@@ -0,0 +1,59 @@
+#ifndef __PMU_H__
+#define __PMU_H__
+
+
+#include "types.h"
+#include "system.h"
+#include "vmstat.h"
+
+
+/* Self-profiling of the VMM with the four AMD core performance counters
+ * (AMD64 manual Vol. 2, Chapter 13).  Counting is restricted to the
+ * host (HostOnly), so guest execution between exits is not charged.
+ * Regions nest; counts of an inner region are also included in the
+ * outer one. */
+
+#define PMU_NR_COUNTERS	4
+
+enum pmu_region {
+	PMU_REGION_DISPATCH,  /* vmexit_fastpath and handle_vmexit, handler included */
+	PMU_REGION_ALLOC,     /* alloc_pages */
+	PMU_REGION_PGTABLE,   /* nested page-table builder */
+	PMU_REGION_HANDLER,   /* exit handlers, one region per exit slot (see vmstat.h) */
+	NR_PMU_REGIONS = PMU_REGION_HANDLER + NR_VMSTAT_SLOTS
+};
+
+struct pmu_region_stats {
+	u64 calls;
+	u64 count [ PMU_NR_COUNTERS ];
+};
+
+struct pmu_snapshot {
+	u64 count [ PMU_NR_COUNTERS ];
+};
+
+
+extern int pmu_enabled;
+
+extern void pmu_init ( int enable );
+extern void pmu_read ( struct pmu_snapshot *s );
+extern void pmu_account ( enum pmu_region region, const struct pmu_snapshot *start );
+extern void pmu_dump ( void );
+
+/* Measure the code between PMU_BEGIN and PMU_END with the same SNAP */
+#define PMU_BEGIN(snap) \
+	do { \
+		if ( unlikely ( pmu_enabled ) ) { \
+			pmu_read ( ( snap ) ); \
+		} \
+	} while ( 0 )
+
+#define PMU_END(region, snap) \
+	do { \
+		if ( unlikely ( pmu_enabled ) ) { \
+			pmu_account ( ( region ), ( snap ) ); \
+		} \
+	} while ( 0 )
+
+
+#endif /* __PMU_H__ */
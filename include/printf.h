@@ -5,8 +5,12 @@
 #include <stdarg.h>
 #include "types.h"
 
+extern void ( *console_hook ) ( const char *s );
+
 extern void putstr ( const char *s );
 extern void printf ( const char *fmt, ... );
+extern int vsnprintf ( char *buf, size_t size, const char *fmt, va_list args );
+extern int snprintf ( char *buf, size_t size, const char *fmt, ... );
 extern void print_binary ( char *p, size_t len );
 
 
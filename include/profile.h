@@ -0,0 +1,47 @@
+#ifndef __PROFILE_H__
+#define __PROFILE_H__
+
+
+#include "types.h"
+
+
+/* Guest RIP sampling.  The local APIC timer interrupts the guest every
+ * 'period' timer ticks; each #VMEXIT(INTR) records where the guest was.
+ * The samples are symbolised offline by tools/profsym. */
+
+#define PROF_NR_SAMPLES		8192
+#define PROF_DEFAULT_PERIOD	0 /* APIC timer ticks (profile=<ticks> on the command line); 0 disables sampling */
+#define PROF_MAGIC		0x464f5250 /* "PROF" */
+
+struct prof_sample {
+	u64 rip;
+	u64 cr3;
+	u8  cpl;
+	u8  pad [ 7 ];
+};
+
+/* Also the layout dumped for tools/profsym */
+struct prof_buffer {
+	u32 magic;
+	u32 nr_samples;   /* capacity */
+	u64 head;         /* samples taken; the buffer keeps the last nr_samples */
+	struct prof_sample samples [ 0 ];
+};
+
+struct vm_profile {
+	u32 period;
+	struct prof_buffer *buf;
+};
+
+
+struct vm;
+
+extern void profile_init ( struct vm *vm, u32 period );
+extern void profile_destroy ( struct vm *vm );
+extern void profile_start ( struct vm *vm );
+extern void profile_stop ( struct vm *vm );
+extern void profile_sample ( struct vm *vm );
+extern void profile_dump ( const struct vm *vm );
+
+
+#endif /* __PROFILE_H__ */
@@ -0,0 +1,24 @@
+#ifndef __RECLAIM_H__
+#define __RECLAIM_H__
+
+
+#include "types.h"
+#include "memacct.h"
+
+
+/* Memory given back by a VM is not freed on the spot: reclaim_pages 
+ * queues it, and the reclaimer scrubs it and returns it to the allocator 
+ * RECLAIM_BATCH_PAGES at a time, between scheduling slices.  
+ * alloc_pages drains the queue before it gives up.  */
+
+#define RECLAIM_QUEUE_SIZE	256
+#define RECLAIM_BATCH_PAGES	512 /* 2 MB */
+
+extern void reclaim_pages ( struct mem_account *acct, enum mem_type type, unsigned long pfn, unsigned long nr_pfns );
+extern unsigned long reclaim_run ( unsigned long budget );
+extern void reclaim_drain ( void );
+extern unsigned long reclaim_pending ( void );
+extern void reclaim_print_stats ( void );
+
+
+#endif /* __RECLAIM_H__ */
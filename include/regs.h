@@ -0,0 +1,48 @@
+#ifndef __REGS_H__
+#define __REGS_H__
+
+
+/* Guest general-purpose registers which are not held in the VMCB 
+ * (RAX and RSP are saved and restored by VMRUN and #VMEXIT).  
+ * [Note] The offsets must match struct vcpu_regs (used by svm_asm.S) */
+#define REGS_RBX	0x00
+#define REGS_RCX	0x08
+#define REGS_RDX	0x10
+#define REGS_RSI	0x18
+#define REGS_RDI	0x20
+#define REGS_RBP	0x28
+#define REGS_R8		0x30
+#define REGS_R9		0x38
+#define REGS_R10	0x40
+#define REGS_R11	0x48
+#define REGS_R12	0x50
+#define REGS_R13	0x58
+#define REGS_R14	0x60
+#define REGS_R15	0x68
+
+
+#ifndef __ASSEMBLY__
+
+#include "types.h"
+
+struct vcpu_regs {
+	u64 rbx;
+	u64 rcx;
+	u64 rdx;
+	u64 rsi;
+	u64 rdi;
+	u64 rbp;
+	u64 r8;
+	u64 r9;
+	u64 r10;
+	u64 r11;
+	u64 r12;
+	u64 r13;
+	u64 r14;
+	u64 r15;
+};
+
+#endif /* ! __ASSEMBLY__ */
+
+
+#endif /* __REGS_H__ */
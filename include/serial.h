@@ -0,0 +1,11 @@
+#ifndef __SERIAL_H__
+#define __SERIAL_H__
+
+
+#define SERIAL_COM1	0x3f8
+
+
+extern void serial_init ( void );
+
+
+#endif /* __SERIAL_H__ */
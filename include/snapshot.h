@@ -0,0 +1,65 @@
+#ifndef __SNAPSHOT_H__
+#define __SNAPSHOT_H__
+
+
+#include "types.h"
+#include "page.h"
+#include "vmcb.h"
+#include "regs.h"
+#include "msrpm.h"
+#include "debugcon.h"
+
+
+/* The part of the VMCB from the segment registers to G_PAT */
+#define VMCB_SAVE_OFFSET	__builtin_offsetof ( struct vmcb, es )
+#define VMCB_SAVE_SIZE		( __builtin_offsetof ( struct vmcb, g_pat ) + sizeof ( u64 ) - VMCB_SAVE_OFFSET )
+
+/* Guest memory comes back from a lazy restore a chunk at a time */
+#define SNAPSHOT_CHUNK_SIZE	PAGE_SIZE_2MB
+#define SNAPSHOT_CHUNK_PAGES	( SNAPSHOT_CHUNK_SIZE >> PAGE_SHIFT )
+
+/* A VM frozen in memory.  Guest memory is kept compact: only the pages 
+ * that are not all zero are stored, in guest-physical order, and PRESENT 
+ * has a bit for each of them.  CHUNK_DATA gives the first stored page of 
+ * each chunk, and WORKING_SET the chunks the guest had touched since the 
+ * previous snapshot (or boot), in address order. */
+struct vm_snapshot {
+	u8 save [ VMCB_SAVE_SIZE ];  /* VMCB state save area */
+	struct vcpu_regs regs;
+	struct guest_msrs msrs;
+	struct debugcon debugcon;
+
+	unsigned long nr_pages;      /* guest pages covered */
+	unsigned long nr_stored;     /* pages held in DATA */
+	unsigned long capacity;      /* pages DATA can hold */
+	unsigned long *present;
+	u8 *data;
+
+	unsigned long nr_chunks;
+	u32 *chunk_data;
+	u32 *working_set;
+	unsigned long nr_working_set;
+
+	/* Lazy restore: chunks not yet loaded, and the next one to prefetch */
+	unsigned long *pending;
+	unsigned long nr_pending;
+	unsigned long prefetch_pos;
+	unsigned long nr_faults, nr_prefetched;
+	u64 lazy_start;
+
+	u64 take_cycles, restore_cycles;
+
+	u64 npt_bytes;               /* MEM_NPT after the last complete restore, or 0 */
+};
+
+struct vm;
+
+extern int snapshot_take ( struct vm *vm );
+extern int snapshot_restore ( struct vm *vm );
+extern int snapshot_restore_lazy ( struct vm *vm );
+extern int snapshot_fault ( struct vm *vm, unsigned long gpa );
+extern void snapshot_prefetch ( struct vm *vm );
+extern void snapshot_destroy ( struct vm *vm );
+
+
+#endif /* __SNAPSHOT_H__ */
@@ -0,0 +1,33 @@
+#ifndef __SOS_H__
+#define __SOS_H__
+
+
+/* Guest-physical layout of the sample operating system (SOS), which is
+ * also the benchmark guest.  The VMM provides DEFAULT_VM_PMEM_SIZE (32 MB)
+ * of guest memory unless mem= asks for another size, from SOS_MIN_PMEM_SIZE
+ * to SOS_MAX_PMEM_SIZE; HC_MEM_SIZE returns it.  0 - 2 MB is the host's 
+ * low memory (VGA). */
+
+#define SOS_MIN_PMEM_SIZE	0x2000000 /* up to the end of the TLB buffer */
+#define SOS_MAX_PMEM_SIZE	( 0x40000000 - SOS_HOLE_SIZE ) /* one page directory maps it all */
+
+#define SOS_LOAD_PADDR		0x200000
+
+#define SOS_BENCH_BUF		0x300000 /* two buffers for the memory kernels */
+#define SOS_BENCH_BUF_SIZE	0x40000  /* 256 Kbytes each */
+
+/* Larger than the reach of the TLBs with 4-Kbyte pages */
+#define SOS_TLB_BUF		0x1000000
+#define SOS_TLB_BUF_SIZE	0x1000000 /* 16 Mbytes */
+
+#define SOS_STACK_TOP		0x3fd000
+#define SOS_PGTABLE_PADDR	0x3fd000 /* 3 pages set up by the VMM: PML4, PDP and PD */
+
+/* Guest-physical memory above the guest RAM is not backed by the nested
+ * page table: touching it causes #VMEXIT(NPF).  The guest page table maps
+ * the guest RAM and SOS_HOLE_SIZE above it, where the statistics page is
+ * as well (STATPAGE_GAP).  */
+#define SOS_HOLE_SIZE		0x200000
+
+
+#endif /* __SOS_H__ */
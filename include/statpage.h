@@ -0,0 +1,109 @@
+#ifndef __STATPAGE_H__
+#define __STATPAGE_H__
+
+
+#include "types.h"
+#include "system.h"
+#include "vmstat.h"
+#include "memacct.h"
+#include "zpool.h"
+
+
+/* A page of counters that the VMM rewrites in place and maps read-only
+ * into a management guest (statpage=1 on the command line), which polls
+ * it without exits.  Updates follow a sequence lock: SEQ is odd while the
+ * VMM writes DATA, and a reader retries unless it saw the same even SEQ
+ * before and after copying.  New fields are only appended to DATA, and
+ * SIZE tells readers how much of it this VMM fills in. */
+
+#define STATPAGE_MAGIC		0x54415453 /* "STAT" */
+#define STATPAGE_VERSION	4          /* 2: MEM_SNAPSHOT added to the memory arrays
+					    * 3: MEM_ZPOOL added, compressed pool appended
+					    * 4: balloon appended */
+#define STATPAGE_GAP		0x100000   /* mapped this far above the guest memory (HC_STATPAGE_GPA) */
+#define STATPAGE_UPDATE_CYCLES	0x100000   /* minimum interval between updates */
+
+struct statpage_data {
+	u64 update_tsc;
+	u64 nr_updates;
+
+	/* VM exits (see struct vm_stats) */
+	u64 exits [ NR_VMSTAT_SLOTS ];
+	u64 exit_cycles [ NR_VMSTAT_SLOTS ];
+	u64 fast_exits;
+
+	/* Page allocator */
+	u64 alloc_calls;
+	u64 alloc_pages;
+
+	/* Host memory of the VM and of the whole host (see struct mem_account) */
+	u64 vm_mem [ NR_MEM_TYPES ];
+	u64 host_mem [ NR_MEM_TYPES ];
+
+	/* Compressed pool (see struct zpool), zero if not enabled */
+	u64 zpool_stored;
+	u64 zpool_bytes;
+	u64 zpool_pool_pages;
+	u64 zpool_faults;
+	u64 zpool_fault_cycles [ ZPOOL_NR_BUCKETS ];
+
+	/* Balloon (see struct vm_balloon) */
+	u64 balloon_target;
+	u64 balloon_inflated;
+	u64 balloon_released;
+	u64 balloon_deflated;
+};
+
+struct statpage {
+	u32 magic;
+	u32 version;
+	u32 size;     /* bytes of DATA maintained */
+	volatile u32 seq;
+	struct statpage_data data;
+};
+
+
+/* Reader side: take a consistent copy of DATA.  x86 does not reorder
+ * loads with other loads, so compiler barriers are enough. */
+static inline void
+statpage_read ( const struct statpage *sp, struct statpage_data *dest )
+{
+	const volatile u64 *src = ( const volatile u64 * ) &sp->data;
+	u64 *dst = ( u64 * ) dest;
+	u32 seq;
+	int i;
+
+	do {
+		while ( ( seq = sp->seq ) & 1 ) {
+			asm volatile ( "pause" );
+		}
+		barrier ( );
+
+		for ( i = 0; i < sizeof ( struct statpage_data ) / sizeof ( u64 ); i++ ) {
+			dst [ i ] = src [ i ];
+		}
+
+		barrier ( );
+	} while ( sp->seq != seq );
+}
+
+
+struct vm;
+
+extern u64 statpage_next_tsc;
+
+extern void statpage_init ( void );
+extern void statpage_map ( struct vm *vm );
+extern void statpage_update ( const struct vm *vm, u64 now );
+
+/* Called on every #VMEXIT */
+static inline void
+statpage_tick ( const struct vm *vm, u64 now )
+{
+	if ( unlikely ( now >= statpage_next_tsc ) ) {
+		statpage_update ( vm, now );
+	}
+}
+
+
+#endif /* __STATPAGE_H__ */
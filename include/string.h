@@ -8,9 +8,18 @@ extern void *__memcpy ( void *to, const void *from, size_t len );
 extern void * memmove ( void * dest, const void *src, size_t count );
 extern void * memset ( void *s, int c, size_t count );
 
+/* PAGE_SIZE bytes at a page-aligned address */
+extern void clear_page ( void *page );
+extern void copy_page ( void *to, const void *from );
+extern int page_is_zero ( const void *page );
+
+struct cpuinfo_x86;
+extern void string_init ( const struct cpuinfo_x86 *c );
+
 extern char * strcpy(char * dest,const char *src);
 extern int strcmp ( const char * cs,const char * ct );
 extern int strncmp ( const char *cs, const char *ct, size_t count );
+extern size_t strlen ( const char *s );
 
 
 #endif /* __STRING_H__ */
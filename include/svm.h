@@ -5,10 +5,14 @@
 #include "types.h"
 #include "cpu.h"
 #include "vmcb.h"
+#include "regs.h"
+#include "vm.h"
 
 
+extern u64 host_vmcb_pa;
+
 extern void __init enable_svm ( struct cpuinfo_x86 *c );
-extern void svm_launch ( u64 vmcb );
+extern void svm_launch ( u64 vmcb, struct vcpu_regs *regs, struct vm *vm );
 
 
 #endif /* __SVM_H__ */
@@ -6,14 +6,20 @@
 #define _X86_CR4_PSE 4 /* Page Size Extensions */
 #define _X86_CR4_PAE 5 /* Physical-Address Extension */
 #define _X86_CR4_PGE 7 /* Page-Global Enable */
+#define _X86_CR4_OSFXSR     9  /* Operating-System FXSAVE/FXRSTOR Support */
+#define _X86_CR4_OSXMMEXCPT 10 /* Operating-System Unmasked Exception Support */
 #ifdef __ASSEMBLY__
 #  define X86_CR4_PSE  ( 4 << _X86_CR4_PSE )  
 #  define X86_CR4_PAE  ( 5 << _X86_CR4_PAE ) 
 #  define X86_CR4_PGE  ( 7 << _X86_CR4_PGE ) 
+#  define X86_CR4_OSFXSR     ( 1 << _X86_CR4_OSFXSR )
+#  define X86_CR4_OSXMMEXCPT ( 1 << _X86_CR4_OSXMMEXCPT )
 #else /* ! __ASSEMBLY__ */
 #  define X86_CR4_PSE  ( 4UL << _X86_CR4_PSE )  
 #  define X86_CR4_PAE  ( 5UL << _X86_CR4_PAE ) 
 #  define X86_CR4_PGE  ( 7UL << _X86_CR4_PGE ) 
+#  define X86_CR4_OSFXSR     ( 1UL << _X86_CR4_OSFXSR )
+#  define X86_CR4_OSXMMEXCPT ( 1UL << _X86_CR4_OSXMMEXCPT )
 #endif /* __ASSEMBLY__ */
 
 /* [REF] AMD64 manual vol. 2, p. 53 */
@@ -92,6 +98,12 @@ write_cr4 ( unsigned long val )
 	asm volatile ( "movq %0, %%cr4" :: "r" ( val ) );
 } 
 
+/* Compiler barrier */
+#define barrier() asm volatile ( "" ::: "memory" )
+
+#define likely(x)   __builtin_expect ( !! ( x ), 1 )
+#define unlikely(x) __builtin_expect ( !! ( x ), 0 )
+
 #endif /* __ASSEMBLY__ */
 
 
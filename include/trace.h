@@ -0,0 +1,76 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+
+#include "types.h"
+#include "system.h"
+
+
+/* Binary trace records are written into a ring per CPU and formatted
+ * offline by tools/tracedump.  Nothing is recorded unless the command 
+ * line selects events, e.g. trace=0x3fe for all of them.  Dump a ring with e.g. QEMU's
+ * "pmemsave <paddr> <size> <file>" using the address printed at boot.
+ *
+ * The layout below is shared with tools/tracedump.c. */
+
+#define TRACE_MAGIC		0x45435254 /* "TRCE" */
+#define TRACE_VERSION		1
+#define TRACE_RING_PAGES	64         /* records: 256 Kbytes = 8192 records, plus a page for the header */
+
+enum trace_event {
+	TRACE_VMEXIT = 1,     /* exitcode, rip, exitinfo1 */
+	TRACE_ALLOC_PAGES,    /* nr_pfns, pfn_align, pfn */
+	TRACE_MMAP,           /* level, vaddr, paddr */
+	TRACE_PGTABLE_ALLOC,  /* 0, paddr, 0 */
+	TRACE_VM_CREATE,      /* 0, vmcb paddr, guest memory size */
+	TRACE_VM_BOOT,        /* 0, rip, 0 */
+	TRACE_VM_STOP,        /* exitcode, rip, 0 */
+	TRACE_FREE_PAGES,     /* nr_pfns, 0, pfn */
+	TRACE_VM_DESTROY,     /* id, vmcb paddr, pages queued for reclaim */
+	NR_TRACE_EVENTS
+};
+
+struct trace_record {
+	u64 tsc;
+	u16 cpu;
+	u16 event;
+	u32 arg0;
+	u64 arg1;
+	u64 arg2;
+};
+
+struct trace_ring {
+	u32 magic;
+	u16 version;
+	u16 record_size;
+	u32 nr_records;  /* power of 2 */
+	u32 cpu;
+	u64 head;        /* records written so far; updated after the record */
+	u64 pad [ 1 ];
+	struct trace_record records [ 0 ];
+};
+
+#define TRACE_ALL_EVENTS ( ( 1U << NR_TRACE_EVENTS ) - 2 )
+
+
+extern u32 trace_mask;
+
+extern void trace_init ( u32 mask );
+extern void trace_enable ( u32 mask );
+extern void trace_write ( enum trace_event event, u32 arg0, u64 arg1, u64 arg2 );
+
+/* A tracepoint.  With CONFIG_TRACE unset it compiles to nothing;
+ * otherwise a disabled tracepoint costs a load and a predicted branch.  */
+#ifdef CONFIG_TRACE
+#define TRACE(event, arg0, arg1, arg2) \
+	do { \
+		if ( unlikely ( trace_mask & ( 1U << ( event ) ) ) ) { \
+			trace_write ( ( event ), ( arg0 ), ( arg1 ), ( arg2 ) ); \
+		} \
+	} while ( 0 )
+#else
+#define TRACE(event, arg0, arg1, arg2) do { } while ( 0 )
+#endif
+
+
+#endif /* __TRACE_H__ */
@@ -4,18 +4,92 @@
 
 #include "multiboot.h"
 #include "vmcb.h"
+#include "regs.h"
+#include "cpuid.h"
+#include "msrpm.h"
+#include "ioport.h"
+#include "debugcon.h"
+#include "vmstat.h"
+#include "profile.h"
+#include "memacct.h"
+#include "balloon.h"
+
+/* Page sizes of the nested page table that backs guest RAM.  Each mode
+ * names the largest page used; smaller pages fill what is not aligned. */
+enum npt_mode {
+	NPT_MODE_4K,
+	NPT_MODE_2M,
+	NPT_MODE_1G,
+	NPT_MODE_MIX  /* 2-Mbyte regions alternate between a 2-Mbyte page and 4-Kbyte pages */
+};
+
+/* What a multiboot module asks for (see the module string options in setup.c) */
+struct vm_config {
+	unsigned long image_start, image_size; /* VMM virtual address of the guest image */
+	unsigned long pmem_size;               /* bytes of guest memory */
+	enum npt_mode npt_mode;
+	unsigned long nr_vcpus;
+};
 
 struct vm {
+	int id;               /* also selects the ASID (id + 1) */
+	int running;          /* cleared when the guest stops */
+	unsigned long nr_vcpus;
+	unsigned long nr_slices; /* times the scheduler picked the VM */
+
 	struct vmcb *vmcb;
+	struct vcpu_regs regs; /* registers not saved in the VMCB */
 
 	unsigned long h_cr3;  /* [Note] When #VMEXIT occurs with
 			       * nested paging enabled, hCR3 is not
 			       * saved back into the VMCB (p. 488) */
 	struct multiboot_info *mbi; /* virtual address */
+	unsigned long pmem_start;   /* guest memory (VMM virtual address) */
+	unsigned long pmem_size;    /* bytes of guest memory */
+	enum npt_mode npt_mode;
+	unsigned long statpage_gpa;    /* where the statistics page is mapped, or 0 */
+	unsigned long npt_pages [ 3 ]; /* nested mappings of 4 KB, 2 MB and 1 GB */
+
+	struct cpuid_table cpuid;
+	struct guest_msrs msrs;
+	struct io_space io;
+	struct debugcon debugcon;
+
+	struct vm_stats stats;
+	struct vm_profile profile;
+
+	struct mem_account mem;  /* host memory used on behalf of the VM */
+
+	struct vm_snapshot *snapshot; /* the last one taken (HC_SNAPSHOT), or NULL */
+	struct zpool *zpool;          /* cold pages compressed (zpool=), or NULL */
+	struct vm_balloon balloon;
+
+	/* Host frame of each guest page once any has left the block allocated
+	 * with the VM (compressed pool, balloon): 0 if still there, else the
+	 * frame or VM_NO_FRAME.  NULL until then.  */
+	u32 *frames;
 };
 
-extern void vm_create ( struct vm *vm, unsigned long guest_image_start, unsigned long guest_image_size, unsigned long vm_pmem_size );
-extern void vm_boot ( struct vm *vm );
+#define VM_NO_FRAME	0xffffffffUL
+
+/* VMs share the CPU in slices of VM_SLICE_CYCLES; a VM is switched out at 
+ * the first #VMEXIT after its slice ends (VM_SLICE_END).  While several
+ * run, the APIC timer forces an exit every VM_SLICE_TIMER ticks at most, 
+ * so that a guest that never exits cannot keep the CPU.  */
+#define VM_SLICE_CYCLES 0x1000000
+#define VM_SLICE_TIMER	0x100000
+
+extern u64 vm_slice_end;
+
+extern void vm_create ( struct vm *vm, int id, const struct vm_config *cfg );
+extern void vm_destroy ( struct vm *vm );
+extern void vm_boot ( struct vm *vms, int nr_vms );
+extern void vm_map_pmem_range ( struct vm *vm, unsigned long pml4, unsigned long start, unsigned long end );
+extern void vm_map_pmem ( struct vm *vm, unsigned long pml4 );
+extern int vm_gpa_is_passthrough ( unsigned long gpa );
+extern unsigned long vm_page_frame ( const struct vm *vm, unsigned long gpa );
+extern void vm_set_page_frame ( struct vm *vm, unsigned long gpa, unsigned long pfn );
+extern int vm_unshare_page ( struct vm *vm, unsigned long gpa );
 
 
 #endif /* __VM_H__ */
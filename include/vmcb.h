@@ -8,7 +8,43 @@
 /* [REF] AMD64 manual Vol. 2, Appendix B */
 
 
-#define INTRCPT_VMRUN (1 << 0)
+/* General intercepts, word 1 (offset 0x0C) */
+#define INTRCPT_INTR      (1 << 0)
+#define INTRCPT_NMI       (1 << 1)
+#define INTRCPT_SMI       (1 << 2)
+#define INTRCPT_INIT      (1 << 3)
+#define INTRCPT_VINTR     (1 << 4)
+#define INTRCPT_RDTSC     (1 << 14)
+#define INTRCPT_RDPMC     (1 << 15)
+#define INTRCPT_CPUID     (1 << 18)
+#define INTRCPT_INVD      (1 << 22)
+#define INTRCPT_PAUSE     (1 << 23)
+#define INTRCPT_HLT       (1 << 24)
+#define INTRCPT_INVLPG    (1 << 25)
+#define INTRCPT_INVLPGA   (1 << 26)
+#define INTRCPT_IOIO_PROT (1 << 27)
+#define INTRCPT_MSR_PROT  (1 << 28)
+#define INTRCPT_SHUTDOWN  (1U << 31)
+
+/* General intercepts, word 2 (offset 0x10) */
+#define INTRCPT_VMRUN   (1 << 0)
+#define INTRCPT_VMMCALL (1 << 1)
+#define INTRCPT_VMLOAD  (1 << 2)
+#define INTRCPT_VMSAVE  (1 << 3)
+#define INTRCPT_STGI    (1 << 4)
+#define INTRCPT_CLGI    (1 << 5)
+#define INTRCPT_SKINIT  (1 << 6)
+#define INTRCPT_RDTSCP  (1 << 7)
+#define INTRCPT_ICEBP   (1 << 8)
+#define INTRCPT_WBINVD  (1 << 9)
+#define INTRCPT_MONITOR (1 << 10)
+#define INTRCPT_MWAIT   (1 << 11)
+
+
+/* Decode assists: EXITINFO1 of MOV-to/from-CRx and DRx intercepts
+ * [REF] AMD64 manual Vol. 2, 15.33 */
+#define CRDR_EXITINFO_MOV   ( 1UL << 63 ) /* Set for MOV CRx/DRx, clear for CLTS, LMSW and SMSW */
+#define CRDR_EXITINFO_GPR   0xfUL         /* The number of the GPR operand */
 
 
 /* 
@@ -104,17 +140,23 @@ struct vmcb {
 	u64 res08[2];
 	union eventinj eventinj;       /* offset 0xA8 */   
 	u64 h_cr3;                  /* offset 0xB0 */   /* physical memory of the VM --> physical memory of the PM */
-	u64 res09[105];             /* offset 0xB8 pad to save area */
+	u64 lbr_control;            /* offset 0xB8 */
+	u32 vmcb_clean;             /* offset 0xC0 */
+	u32 res09;                  /* offset 0xC4 */
+	u64 nrip;                   /* offset 0xC8 */   /* next sequential instruction pointer (NRIPS) */
+	u8  guest_ins_len;          /* offset 0xD0 */   /* number of bytes fetched (decode assists) */
+	u8  guest_ins_bytes[15];    /* offset 0xD1 */
+	u64 res10[100];             /* offset 0xE0 pad to save area */
 	
 	/*** State Save Area ****/
 
 	struct seg_selector es, cs, ss, ds, fs, gs, gdtr, ldtr, idtr, tr;      /* offset 1024 */
-	u64 res10[5];
-	u8 res11[3];
+	u64 res11[5];
+	u8 res12[3];
 	u8 cpl;
-	u32 res12;
+	u32 res13;
 	u64 efer;               	/* offset 1024 + 0xD0 */
-	u64 res13[14];
+	u64 res14[14];
 	u64 cr4;                  	/* loffset 1024 + 0x148 */
 	u64 cr3;
 	u64 cr0;
@@ -122,9 +164,9 @@ struct vmcb {
 	u64 dr6;
 	u64 rflags;
 	u64 rip;
-	u64 res14[11]; /* reserved */
+	u64 res15[11]; /* reserved */
 	u64 rsp;
-	u64 res15[3]; /* reserved */
+	u64 res16[3]; /* reserved */
 	u64 rax;
 	u64 star;
 	u64 lstar;
@@ -140,13 +182,36 @@ struct vmcb {
 	u64 pdpe2; /* reserved ? */
 	u64 pdpe3; /* reserved ? */
 	u64 g_pat;
-	u64 res16[50];
-	u64 res17[128];
+	u64 res17[50];
 	u64 res18[128];
+	u64 res19[128];
 } __attribute__ ((packed));
 
 
+static inline int
+vmcb_crdr_is_mov ( const struct vmcb *vmcb )
+{
+	return !! ( vmcb->exitinfo1 & CRDR_EXITINFO_MOV );
+}
+
+static inline int
+vmcb_crdr_gpr ( const struct vmcb *vmcb )
+{
+	return ( int ) ( vmcb->exitinfo1 & CRDR_EXITINFO_GPR );
+}
+
+/* With decode assists, EXITINFO1 of the INVLPG intercept holds the linear address. */
+static inline u64
+vmcb_invlpg_addr ( const struct vmcb *vmcb )
+{
+	return vmcb->exitinfo1;
+}
+
+
+extern void vmcb_inject_exception ( struct vmcb *vmcb, int vector, int has_error_code, u32 error_code );
 extern void vmcb_check_consistency ( struct vmcb *vmcb );
+extern int vmcb_efer_is_valid ( u64 efer );
+extern int vmcb_pat_is_valid ( u64 pat );
 extern void vmcb_dump( const struct vmcb *vmcb);
 
 
@@ -149,7 +149,15 @@ enum vmexit_exitcode {
 };
 
 
+#define NR_VMEXIT_HANDLERS ( VMEXIT_ICEBP + 1 )
+
+
+struct vm;
+
 extern void print_vmexit_exitcode ( enum vmexit_exitcode x );
+extern int handle_vmexit ( struct vm *vm );
+extern int vmexit_fastpath ( struct vm *vm );
+extern void vmexit_fastpath_set ( enum vmexit_exitcode exitcode, int ( *handler ) ( struct vm *vm ) );
 
 
 #endif /* __VMEXIT_H__ */
@@ -4,7 +4,7 @@
 
 #define STACK_SIZE	(1 << 16) /* 64 KB */
 #define	DEFAULT_VMM_HEAP_SIZE (1 << 22) /* 4 MB */
-#define	DEFAULT_VM_PMEM_SIZE  (1 << 22) /* 4 MB */
+#define	DEFAULT_VM_PMEM_SIZE  (1 << 25) /* 32 MB */
 
 #define VMM_CS64_ENTRY	2
 #define VMM_DS32_ENTRY	3
@@ -0,0 +1,75 @@
+#ifndef __VMSTAT_H__
+#define __VMSTAT_H__
+
+
+#include "types.h"
+#include "bitops.h"
+#include "vmexit.h"
+
+
+/* Exit statistics of a virtual CPU.  Only the physical CPU running the
+ * vCPU updates them, so plain (non-atomic) increments are used. */
+
+enum {
+	VMSTAT_SLOT_NPF   = NR_VMEXIT_HANDLERS, /* exitcodes are sparse above VMEXIT_ICEBP */
+	VMSTAT_SLOT_OTHER,
+	NR_VMSTAT_SLOTS
+};
+
+#define VMSTAT_NR_BUCKETS 64 /* bucket N counts values in [2^N, 2^(N+1)) */
+
+struct vm_stats {
+	u64 exits [ NR_VMSTAT_SLOTS ];
+	u64 cycles [ NR_VMSTAT_SLOTS ];  /* total handler cycles */
+	u64 fast_exits;                  /* exits handled inside svm_launch */
+
+	u64 handler_hist [ VMSTAT_NR_BUCKETS ];    /* cycles spent in a handler */
+	u64 round_trip_hist [ VMSTAT_NR_BUCKETS ]; /* cycles from one #VMEXIT to the next */
+
+	u64 last_exit_tsc;
+};
+
+
+static inline int
+vmstat_slot ( u64 exitcode )
+{
+	if ( exitcode < NR_VMEXIT_HANDLERS ) {
+		return exitcode;
+	}
+	return ( exitcode == VMEXIT_NPF ) ? VMSTAT_SLOT_NPF : VMSTAT_SLOT_OTHER;
+}
+
+static inline int
+vmstat_bucket ( u64 cycles )
+{
+	return ( cycles == 0 ) ? 0 : __fls ( cycles );
+}
+
+/* Called on every #VMEXIT with the TSC read at the exit */
+static inline void
+vmstat_exit ( struct vm_stats *s, u64 exitcode, u64 now )
+{
+	s->exits [ vmstat_slot ( exitcode ) ]++;
+
+	if ( s->last_exit_tsc != 0 ) {
+		s->round_trip_hist [ vmstat_bucket ( now - s->last_exit_tsc ) ]++;
+	}
+	s->last_exit_tsc = now;
+}
+
+static inline void
+vmstat_handler ( struct vm_stats *s, u64 exitcode, u64 cycles )
+{
+	s->cycles [ vmstat_slot ( exitcode ) ] += cycles;
+	s->handler_hist [ vmstat_bucket ( cycles ) ]++;
+}
+
+
+struct vm;
+
+extern void vmstat_init ( struct vm_stats *s );
+extern void vmstat_snapshot ( const struct vm *vm, struct vm_stats *dest );
+extern void vmstat_dump ( const struct vm *vm );
+
+
+#endif /* __VMSTAT_H__ */
@@ -0,0 +1,68 @@
+#ifndef __ZPOOL_H__
+#define __ZPOOL_H__
+
+
+#include "types.h"
+#include "page.h"
+
+
+/* Compressed store for cold guest pages (zpool=<scans> on the command 
+ * line).  Every ZPOOL_SCAN_CYCLES the accessed bits of the nested page 
+ * table are harvested; a page whose bit stayed clear for the given number 
+ * of scans is LZ4-compressed into a pool of VMM pages, unmapped and its 
+ * frame given back (VM_NO_FRAME in vm->frames).  The next nested page fault on it decompresses it 
+ * into a fresh frame.  All-zero pages take no pool space.  */
+
+#define ZPOOL_SCAN_CYCLES	0x40000000
+#define ZPOOL_UNIT		64                           /* pool allocation unit (bytes) */
+#define ZPOOL_UNITS_PER_PAGE	( PAGE_SIZE / ZPOOL_UNIT )  /* one bitmap word per pool page */
+#define ZPOOL_MAX_UNITS		48                           /* pages that do not shrink to 3/4 stay */
+#define ZPOOL_NR_BUCKETS	16                           /* fault-in latency histogram */
+#define ZPOOL_BUCKET_SHIFT	10                           /* bucket k: < 2^(k + 10) cycles */
+
+#define ZPOOL_SLOT_ZERO		0xffffffff
+
+/* Per guest page */
+struct zpool_page {
+	u32 slot;  /* pool page * ZPOOL_UNITS_PER_PAGE + first unit + 1, 
+		    * ZPOOL_SLOT_ZERO, or 0 if not compressed */
+	u16 len;   /* compressed bytes */
+	u8 age;    /* scans since the page was last accessed */
+	u8 pad;
+};
+
+struct zpool_block {
+	u32 pfn;   /* pool page */
+	u64 used;  /* a bit per unit */
+};
+
+struct zpool {
+	unsigned long cold_scans;
+	unsigned long nr_pages;     /* guest pages */
+	struct zpool_page *pages;
+	struct zpool_block *blocks;
+	unsigned long nr_blocks, max_blocks;
+	unsigned long nr_pool_pages; /* blocks with a page */
+
+	unsigned long nr_stored;    /* pages compressed now */
+	unsigned long nr_zero;      /* ... of which all zero */
+	u64 stored_bytes;           /* compressed bytes held */
+	u64 next_scan;
+
+	/* statistics */
+	unsigned long nr_scans, nr_evicted, nr_faults, nr_incompressible;
+	u64 bytes_in, bytes_out;    /* over all evictions */
+	u64 fault_cycles [ ZPOOL_NR_BUCKETS ];
+};
+
+struct vm;
+
+extern void zpool_init ( struct vm *vm, unsigned long cold_scans );
+extern void zpool_destroy ( struct vm *vm );
+extern void zpool_scan ( struct vm *vm, u64 now );
+extern int zpool_fault ( struct vm *vm, unsigned long gpa );
+extern int zpool_discard ( struct vm *vm, unsigned long gpa );
+extern void zpool_dump ( const struct vm *vm );
+
+
+#endif /* __ZPOOL_H__ */
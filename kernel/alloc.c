@@ -4,6 +4,11 @@
 #include "page.h"
 #include "pmem_layout.h"
 #include "e820.h"
+#include "trace.h"
+#include "bootprof.h"
+#include "pmu.h"
+#include "memacct.h"
+#include "reclaim.h"
 
 
 enum {
@@ -16,6 +21,10 @@ enum {
 struct naive_allocator  { 
 	unsigned long *alloc_bitmap;
 	unsigned long max_page;
+
+	unsigned long nr_calls;     /* statistics */
+	unsigned long nr_allocated;
+	unsigned long nr_freed;
 };
 
 static struct naive_allocator naive_allocator;
@@ -122,18 +131,24 @@ init_alloc_bitmap ( const struct e820_map *e820, struct naive_allocator *nalloc,
 		unsigned long s = p->addr;
 		unsigned long e = s + p->size;
 		
-		/* Skip vmm heap and guest image. */
+		/* Skip vmm heap. */
 		if ( s < pml->vmm_heap_end ) {
 			s = pml->vmm_heap_end;
 		}
 
-		const unsigned long guest_image_end = pml->guest_image_start + pml->guest_image_size;
-		if ( ( s < guest_image_end ) && ( e > pml->guest_image_start ) ) {
-			s = guest_image_end;
-		}
-
 		__init_alloc_bitmap ( nalloc, s, e );
 	}
+
+	/* The guest images stay where they are; their frames are never handed out. */
+	for ( i = 0; i < pml->nr_guest_images; i++ ) {
+		const struct guest_image *img = &pml->guest_images [ i ];
+		const unsigned long first = PFN_DOWN ( img->start );
+		const unsigned long last  = PFN_UP ( img->start + img->size );
+
+		if ( last > first ) {
+			map_alloc ( nalloc, first, last - first );
+		}
+	}
 }
 
 void __init
@@ -176,6 +191,7 @@ is_free_contiguous_region ( const struct naive_allocator *nalloc, unsigned long
 	return 1;
 }
 
+/* Return the first page of the region taken, or -1 if none is free */
 static unsigned long 
 alloc_boot_pages ( unsigned long nr_pfns, unsigned long pfn_align )
 {
@@ -190,12 +206,72 @@ alloc_boot_pages ( unsigned long nr_pfns, unsigned long pfn_align )
 		}
 	}
 
-	fatal_failure ( "alloc_boot_pages\n" );
-	return 0;
+	return -1UL;
 }
 
 unsigned long 
 alloc_pages ( unsigned long nr_pfns, unsigned long pfn_align )
 {
-	return alloc_boot_pages ( nr_pfns, pfn_align );
+	struct pmu_snapshot pmu;
+	unsigned long pfn;
+
+	PMU_BEGIN ( &pmu );
+	pfn = alloc_boot_pages ( nr_pfns, pfn_align );
+	if ( ( pfn == -1UL ) && ( reclaim_pending ( ) > 0 ) ) {
+		/* Memory of destroyed VMs is still on its way back */
+		reclaim_drain ( );
+		pfn = alloc_boot_pages ( nr_pfns, pfn_align );
+	}
+	PMU_END ( PMU_REGION_ALLOC, &pmu );
+
+	if ( pfn == -1UL ) {
+		fatal_failure ( "alloc_boot_pages\n" );
+	}
+
+	naive_allocator.nr_calls++;
+	naive_allocator.nr_allocated += nr_pfns;
+
+	TRACE ( TRACE_ALLOC_PAGES, nr_pfns, pfn_align, pfn );
+	bootprof_allocated ( nr_pfns );
+	memacct_allocated ( nr_pfns );
+	return pfn;
+}
+
+void
+free_pages ( unsigned long pfn, unsigned long nr_pfns )
+{
+	struct naive_allocator *nalloc = &naive_allocator;
+	unsigned long i;
+
+	for ( i = 0; i < nr_pfns; i++ ) {
+		if ( ! allocated_in_map ( nalloc, pfn + i ) ) {
+			fatal_failure ( "free_pages: page not allocated\n" );
+		}
+	}
+
+	map_free ( nalloc, pfn, nr_pfns );
+	nalloc->nr_freed += nr_pfns;
+
+	TRACE ( TRACE_FREE_PAGES, nr_pfns, 0, pfn );
+}
+
+void
+alloc_get_stats ( unsigned long *nr_calls, unsigned long *nr_allocated )
+{
+	*nr_calls     = naive_allocator.nr_calls;
+	*nr_allocated = naive_allocator.nr_allocated;
+}
+
+void
+alloc_print_stats ( void )
+{
+	const struct naive_allocator *nalloc = &naive_allocator;
+	unsigned long pfn, nr_free = 0;
+
+	for ( pfn = 0; pfn < nalloc->max_page; pfn++ ) {
+		nr_free += ! allocated_in_map ( nalloc, pfn );
+	}
+
+	printf ( "Allocator: calls=%x, allocated=%x, freed=%x, free=%x\n", 
+		 nalloc->nr_calls, nalloc->nr_allocated, nalloc->nr_freed, nr_free );
 }
@@ -0,0 +1,77 @@
+#include "types.h"
+#include "printf.h"
+#include "msr.h"
+#include "system.h"
+#include "page.h"
+#include "io.h"
+#include "apic.h"
+
+
+static unsigned long lapic_base; /* virtual address */
+
+
+static inline u32
+lapic_read ( u32 reg )
+{
+	return * ( volatile u32 * ) ( lapic_base + reg );
+}
+
+static inline void
+lapic_write ( u32 reg, u32 val )
+{
+	* ( volatile u32 * ) ( lapic_base + reg ) = val;
+}
+
+/* Mask all the lines of the legacy 8259 PICs; the VMM only takes the 
+ * local APIC timer. */
+static void
+disable_pic ( void )
+{
+	outb ( 0xff, 0xa1 );
+	outb ( 0xff, 0x21 );
+}
+
+void
+lapic_init ( void )
+{
+	u32 lo, hi;
+	unsigned long paddr;
+
+	rdmsr ( MSR_APIC_BASE, lo, hi );
+	paddr = ( ( ( unsigned long ) hi << 32 ) | lo ) & ~( ( unsigned long ) PAGE_SIZE - 1 );
+
+	/* [Note] Only the first 1 GB is mapped at boot.  Map the 2-Mbyte 
+	 * page holding the APIC registers (uncached by the MTRRs). */
+	mmap ( ( unsigned long ) VIRT ( read_cr3 ( ) ), ( unsigned long ) VIRT ( paddr & ~( PAGE_SIZE_2MB - 1UL ) ),
+	       paddr & ~( PAGE_SIZE_2MB - 1UL ), 0 );
+	lapic_base = ( unsigned long ) VIRT ( paddr );
+
+	disable_pic ( );
+
+	lapic_write ( APIC_LVT_TIMER, APIC_LVT_MASKED | APIC_TIMER_VECTOR );
+	lapic_write ( APIC_SVR, APIC_SVR_ENABLE | APIC_SPURIOUS_VECTOR );
+
+	printf ( "Local APIC enabled (paddr=%x, id=%x).\n", paddr, ( unsigned long ) ( lapic_read ( APIC_ID ) >> 24 ) );
+}
+
+/* Fire APIC_TIMER_VECTOR every PERIOD ticks of the APIC timer clock */
+void
+lapic_timer_start ( u32 period )
+{
+	lapic_write ( APIC_TIMER_DCR, APIC_TIMER_DIV_1 );
+	lapic_write ( APIC_LVT_TIMER, APIC_LVT_PERIODIC | APIC_TIMER_VECTOR );
+	lapic_write ( APIC_TIMER_ICR, period );
+}
+
+void
+lapic_timer_stop ( void )
+{
+	lapic_write ( APIC_LVT_TIMER, APIC_LVT_MASKED | APIC_TIMER_VECTOR );
+	lapic_write ( APIC_TIMER_ICR, 0 );
+}
+
+void
+lapic_eoi ( void )
+{
+	lapic_write ( APIC_EOI, 0 );
+}
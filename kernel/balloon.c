@@ -0,0 +1,194 @@
+#include "types.h"
+#include "string.h"
+#include "printf.h"
+#include "page.h"
+#include "alloc.h"
+#include "msr.h"
+#include "vm.h"
+#include "emulate.h"
+#include "memacct.h"
+#include "reclaim.h"
+#include "zpool.h"
+#include "balloon.h"
+
+
+/* HC_BALLOON_REPORT is handled on the only CPU, one exit at a time */
+static struct balloon_report reports [ BALLOON_MAX_REPORTS ];
+
+/* Is any of the NR pages at GPA passed through or outside guest RAM? */
+static int
+range_is_invalid ( const struct vm *vm, unsigned long gpa, unsigned long nr )
+{
+	unsigned long p;
+
+	if ( ( gpa & ( PAGE_SIZE - 1 ) ) || ( gpa >= vm->pmem_size ) || ( nr == 0 ) || 
+	     ( nr > PFN_DOWN ( vm->pmem_size - gpa ) ) ) {
+		return 1;
+	}
+	for ( p = gpa; p < gpa + PFN_PHYS ( nr ); p = ( p + PAGE_SIZE_2MB ) & ~( PAGE_SIZE_2MB - 1 ) ) {
+		if ( vm_gpa_is_passthrough ( p ) ) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* Unmap [GPA, END) and give back the frames still behind it, a nested leaf
+ * (or the part of one in the range) at a time.  Returns the pages given
+ * back.  */
+static unsigned long
+release_range ( struct vm *vm, unsigned long gpa, unsigned long end )
+{
+	const unsigned long pml4 = ( unsigned long ) VIRT ( vm->h_cr3 );
+	unsigned long released = 0;
+
+	while ( gpa < end ) {
+		unsigned long paddr, size, len, n, off;
+
+		if ( vm_page_frame ( vm, gpa ) == VM_NO_FRAME ) {
+			/* Already out of guest RAM; drop a compressed copy */
+			if ( zpool_discard ( vm, gpa ) == 0 ) {
+				released++;
+			}
+			gpa += PAGE_SIZE;
+			continue;
+		}
+
+		paddr = vaddr_to_paddr_page ( pml4, gpa, &size );
+		len   = size - ( gpa & ( size - 1 ) );
+		if ( len > end - gpa ) {
+			len = end - gpa;
+		}
+
+		/* The pages whose frames are the VM's own and follow each other */
+		for ( n = 0; n < len; n += PAGE_SIZE ) {
+			if ( PFN_PHYS ( vm_page_frame ( vm, gpa + n ) ) != paddr + n ) {
+				break;
+			}
+		}
+		if ( n == 0 ) {
+			gpa += PAGE_SIZE; /* not the VM's (e.g., a guest image page mapped in place) */
+			continue;
+		}
+
+		memacct_begin ( &vm->mem, MEM_NPT );
+		munmap_range ( pml4, gpa, n );
+		memacct_end ( );
+		reclaim_pages ( &vm->mem, MEM_GUEST_RAM, PFN_DOWN ( paddr ), PFN_DOWN ( n ) );
+
+		for ( off = 0; off < n; off += PAGE_SIZE ) {
+			vm_set_page_frame ( vm, gpa + off, VM_NO_FRAME );
+		}
+		released += PFN_DOWN ( n );
+		gpa += n;
+	}
+	return released;
+}
+
+/******************************************************/
+
+void
+balloon_init ( struct vm *vm, unsigned long target )
+{
+	struct vm_balloon *b = &vm->balloon;
+
+	memset ( b, 0, sizeof ( struct vm_balloon ) );
+	b->target = ( target < PFN_DOWN ( vm->pmem_size ) ) ? target : PFN_DOWN ( vm->pmem_size );
+
+	if ( b->target != 0 ) {
+		printf ( "Balloon: target=%x pages.\n", b->target );
+	}
+}
+
+/* Pages the guest is still asked to give back */
+unsigned long
+balloon_owed ( const struct vm *vm )
+{
+	const struct vm_balloon *b = &vm->balloon;
+
+	return ( b->target > b->nr_inflated ) ? b->target - b->nr_inflated : 0;
+}
+
+/* NR struct balloon_report at guest virtual address GVA.  Invalid ranges are
+ * skipped.  Returns the pages given back, or -1.  */
+unsigned long
+balloon_report ( struct vm *vm, unsigned long gva, unsigned long nr )
+{
+	struct vm_balloon *b = &vm->balloon;
+	unsigned long released = 0;
+	u64 start, end;
+	int i;
+
+	/* Snapshots are taken and restored in place */
+	if ( ( b->target == 0 ) || ( nr > BALLOON_MAX_REPORTS ) || ( vm->snapshot != NULL ) ) {
+		return -1UL;
+	}
+	if ( copy_from_guest ( vm, reports, gva, nr * sizeof ( struct balloon_report ) ) != 0 ) {
+		return -1UL;
+	}
+
+	rdtscll ( start );
+
+	for ( i = 0; i < nr; i++ ) {
+		const unsigned long gpa = reports [ i ].gpa;
+		const unsigned long nr_pages = reports [ i ].nr_pages;
+
+		if ( range_is_invalid ( vm, gpa, nr_pages ) ) {
+			b->nr_rejected++;
+			continue;
+		}
+		released += release_range ( vm, gpa, gpa + PFN_PHYS ( nr_pages ) );
+	}
+
+	rdtscll ( end );
+
+	b->nr_calls++;
+	b->nr_ranges     += nr;
+	b->nr_inflated   += released;
+	b->nr_released   += released;
+	b->report_cycles += end - start;
+	return released;
+}
+
+/* The guest reuses a page it reported: map a zeroed frame.  Returns -1 if
+ * GPA is not reported.  Compressed pages have no frame either, so
+ * zpool_fault must have been tried first.  */
+int
+balloon_fault ( struct vm *vm, unsigned long gpa )
+{
+	struct vm_balloon *b = &vm->balloon;
+	unsigned long pfn;
+
+	if ( ( gpa >= vm->pmem_size ) || ( vm_page_frame ( vm, gpa ) != VM_NO_FRAME ) ) {
+		return -1;
+	}
+
+	memacct_begin ( &vm->mem, MEM_GUEST_RAM );
+	pfn = alloc_pages ( 1, 1 );
+	clear_page ( VIRT ( PFN_PHYS ( pfn ) ) );
+	memacct_type ( MEM_NPT );
+	mmap_page ( ( unsigned long ) VIRT ( vm->h_cr3 ), PAGE_DOWN ( gpa ), PFN_PHYS ( pfn ), PGT_LEVEL_PT, PTTEF_RW | PTTEF_US );
+	memacct_end ( );
+
+	vm_set_page_frame ( vm, gpa, pfn );
+
+	if ( b->nr_inflated > 0 ) {
+		b->nr_inflated--;
+	}
+	b->nr_deflated++;
+	return 0;
+}
+
+void
+balloon_dump ( const struct vm *vm )
+{
+	const struct vm_balloon *b = &vm->balloon;
+
+	if ( b->target == 0 ) {
+		return;
+	}
+
+	printf ( "Balloon (target=%x, inflated=%x, calls=%x, ranges=%x, rejected=%x, released=%x, deflated=%x, cycles=%x).\n",
+		 b->target, b->nr_inflated, b->nr_calls, b->nr_ranges, b->nr_rejected,
+		 b->nr_released, b->nr_deflated, b->report_cycles );
+}
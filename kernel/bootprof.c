@@ -0,0 +1,99 @@
+#include "types.h"
+#include "string.h"
+#include "printf.h"
+#include "msr.h"
+#include "bootprof.h"
+
+
+struct bootprof bootprof;
+
+static const char *boot_phase_names [ NR_BOOT_PHASES ] = {
+	[ BOOT_PHASE_MEMORY_REGION ]    = "memory region",
+	[ BOOT_PHASE_COPY_GUEST_IMAGE ] = "copy guest image",
+	[ BOOT_PHASE_ALLOCATOR_INIT ]   = "allocator init",
+	[ BOOT_PHASE_TRACE_INIT ]       = "trace init",
+	[ BOOT_PHASE_IDENTIFY_CPU ]     = "identify cpu",
+	[ BOOT_PHASE_INTERRUPT_INIT ]   = "interrupt init",
+	[ BOOT_PHASE_VM_CONTROL ]       = "vm control",
+	[ BOOT_PHASE_VM_PMEM ]          = "vm pmem",
+	[ BOOT_PHASE_VM_LOAD_IMAGE ]    = "vm load image",
+};
+
+/* The phase being measured, or NULL outside start-up */
+static struct bootprof_phase *current;
+static u64 phase_start_tsc;
+
+
+static void
+end_current_phase ( u64 now )
+{
+	if ( current != NULL ) {
+		current->cycles += now - phase_start_tsc;
+	}
+}
+
+void
+bootprof_start ( void )
+{
+	memset ( &bootprof, 0, sizeof ( struct bootprof ) );
+	bootprof.nr_phases = NR_BOOT_PHASES;
+	rdtscll ( bootprof.start_tsc );
+	current = NULL;
+}
+
+void
+bootprof_phase ( enum boot_phase phase )
+{
+	u64 now;
+
+	rdtscll ( now );
+	end_current_phase ( now );
+
+	current = &bootprof.phases [ phase ];
+	phase_start_tsc = now;
+}
+
+void
+bootprof_finish ( void )
+{
+	u64 now;
+	int i;
+
+	rdtscll ( now );
+	end_current_phase ( now );
+	current = NULL;
+
+	bootprof.total_cycles = now - bootprof.start_tsc;
+	bootprof.done = 1;
+
+	printf ( "Boot profile (total cycles=%x):\n", bootprof.total_cycles );
+	for ( i = 0; i < NR_BOOT_PHASES; i++ ) {
+		const struct bootprof_phase *p = &bootprof.phases [ i ];
+		printf ( "  %s: cycles=%x, copied=%x, allocated=%x, zeroed=%x\n", boot_phase_names [ i ],
+			 p->cycles, p->bytes_copied, p->pages_allocated, p->pages_zeroed );
+	}
+}
+
+void
+bootprof_copied ( unsigned long bytes )
+{
+	if ( current != NULL ) {
+		current->bytes_copied += bytes;
+	}
+}
+
+void
+bootprof_allocated ( unsigned long nr_pages )
+{
+	if ( current != NULL ) {
+		current->pages_allocated += nr_pages;
+	}
+}
+
+void
+bootprof_zeroed ( unsigned long nr_pages )
+{
+	if ( current != NULL ) {
+		current->pages_zeroed += nr_pages;
+	}
+}
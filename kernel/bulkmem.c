@@ -0,0 +1,153 @@
+#include "types.h"
+#include "string.h"
+#include "page.h"
+#include "cpu.h"
+#include "bootprof.h"
+#include "bulkmem.h"
+
+
+struct bulk_work {
+	char *dest;
+	const char *src; /* NULL to clear */
+	size_t len;
+};
+
+/* MOVNTI stores 64 bytes per iteration; DEST is 8-byte aligned */
+static void
+nt_clear_blocks ( void *dest, unsigned long nr_blocks )
+{
+	__asm__ __volatile__(
+		"1:\tmovntiq %2, 0(%0)\n\t"
+		"movntiq %2, 8(%0)\n\t"
+		"movntiq %2, 16(%0)\n\t"
+		"movntiq %2, 24(%0)\n\t"
+		"movntiq %2, 32(%0)\n\t"
+		"movntiq %2, 40(%0)\n\t"
+		"movntiq %2, 48(%0)\n\t"
+		"movntiq %2, 56(%0)\n\t"
+		"addq $64, %0\n\t"
+		"decq %1\n\t"
+		"jnz 1b"
+		: "+r" (dest), "+r" (nr_blocks)
+		: "r" (0UL)
+		: "memory");
+}
+
+static void
+nt_copy_blocks ( void *dest, const void *src, unsigned long nr_blocks )
+{
+	unsigned long t0, t1, t2, t3;
+
+	__asm__ __volatile__(
+		"1:\tprefetchnta 256(%1)\n\t"
+		"movq 0(%1), %3\n\t"
+		"movq 8(%1), %4\n\t"
+		"movq 16(%1), %5\n\t"
+		"movq 24(%1), %6\n\t"
+		"movntiq %3, 0(%0)\n\t"
+		"movntiq %4, 8(%0)\n\t"
+		"movntiq %5, 16(%0)\n\t"
+		"movntiq %6, 24(%0)\n\t"
+		"movq 32(%1), %3\n\t"
+		"movq 40(%1), %4\n\t"
+		"movq 48(%1), %5\n\t"
+		"movq 56(%1), %6\n\t"
+		"movntiq %3, 32(%0)\n\t"
+		"movntiq %4, 40(%0)\n\t"
+		"movntiq %5, 48(%0)\n\t"
+		"movntiq %6, 56(%0)\n\t"
+		"addq $64, %0\n\t"
+		"addq $64, %1\n\t"
+		"decq %2\n\t"
+		"jnz 1b"
+		: "+r" (dest), "+r" (src), "+r" (nr_blocks), "=&r" (t0), "=&r" (t1), "=&r" (t2), "=&r" (t3)
+		:
+		: "memory");
+}
+
+/* Run one chunk: non-temporal stores for the whole 64-byte blocks after 
+ * aligning DEST, cached stores for the unaligned ends */
+static void
+bulk_chunk ( const struct bulk_work *w )
+{
+	char *d = w->dest;
+	const char *s = w->src;
+	size_t len = w->len;
+	size_t head = ( - ( unsigned long ) d ) & 63;
+
+	if ( head > len ) {
+		head = len;
+	}
+
+	if ( s == NULL ) {
+		memset ( d, 0, head );
+	} else {
+		memmove ( d, s, head );
+		s += head;
+	}
+	d += head; len -= head;
+
+	if ( len >= 64 ) {
+		if ( s == NULL ) {
+			nt_clear_blocks ( d, len >> 6 );
+		} else {
+			nt_copy_blocks ( d, s, len >> 6 );
+			s += len & ~63UL;
+		}
+		d += len & ~63UL;
+		len &= 63;
+	}
+
+	if ( s == NULL ) {
+		memset ( d, 0, len );
+	} else {
+		memmove ( d, s, len );
+	}
+
+	/* Non-temporal stores are weakly ordered */
+	__asm__ __volatile__( "sfence" ::: "memory" );
+}
+
+/* Split the work into one chunk per CPU.  [Note] Only the bootstrap 
+ * processor is brought up (NR_CPUS is 1), so the chunks run one after 
+ * another here; with application processors each would be handed to an 
+ * idle CPU and waited for. */
+static void
+bulk_run ( char *dest, const char *src, size_t len )
+{
+	unsigned long nr_chunks = NR_CPUS;
+	unsigned long chunk, off;
+	int cpu;
+
+	if ( len / nr_chunks < BULK_MIN_CHUNK ) {
+		nr_chunks = ( len + BULK_MIN_CHUNK - 1 ) / BULK_MIN_CHUNK;
+		if ( nr_chunks == 0 ) {
+			nr_chunks = 1;
+		}
+	}
+	chunk = PAGE_UP ( ( len + nr_chunks - 1 ) / nr_chunks );
+
+	for ( cpu = 0, off = 0; off < len; cpu++, off += chunk ) {
+		struct bulk_work w;
+
+		w.dest = dest + off;
+		w.src  = ( src != NULL ) ? src + off : NULL;
+		w.len  = ( len - off < chunk ) ? len - off : chunk;
+
+		bulk_chunk ( &w );
+	}
+}
+
+void
+bulk_clear ( void *dest, size_t len )
+{
+	bulk_run ( dest, NULL, len );
+	bootprof_zeroed ( PFN_UP ( len ) );
+}
+
+void
+bulk_copy ( void *dest, const void *src, size_t len )
+{
+	bulk_run ( dest, src, len );
+	bootprof_copied ( len );
+}
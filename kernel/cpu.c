@@ -6,8 +6,11 @@
 #include "cpufeature.h"
 #include "svm.h"
 #include "cpu.h"
+#include "system.h"
 
 
+struct cpuinfo_x86 boot_cpu_data;
+
 static void 
 display_cacheinfo ( struct cpuinfo_x86 *c )
 {
@@ -116,6 +119,12 @@ early_identify_cpu ( struct cpuinfo_x86 *c )
 		c->x86 = 4;
 	}
 
+	/* Structured extended flags: level 0x00000007, subleaf 0 */
+	if ( c->cpuid_level >= 0x00000007 ) {
+		u32 eax, ecx;
+		cpuid_count ( 0x00000007, 0, &eax, &c->x86_capability[8], &ecx, &c->x86_capability[9] );
+	}
+
 	u32 xlvl;
 	/* AMD-defined flags: level 0x80000001 */
 	xlvl = cpuid_eax ( 0x80000000 );
@@ -128,6 +137,10 @@ early_identify_cpu ( struct cpuinfo_x86 *c )
 		if ( xlvl >= 0x80000004 ) {
 			get_model_name ( c ); /* Default name */
 		}
+		/* SVM features: level 0x8000000a (AMD64 manual Vol. 3, Appendix E) */
+		if ( ( xlvl >= 0x8000000a ) && ( c->x86_capability[6] & ( 1 << ( X86_FEATURE_SVME & 31 ) ) ) ) {
+			c->x86_capability[7] = cpuid_edx ( 0x8000000a );
+		}
 	}
 
 	/* Transmeta-defined flags: level 0x80860001 */
@@ -150,8 +163,7 @@ __init_amd ( struct cpuinfo_x86 *c )
 //	unsigned int n_asids = cpuid_edx ( 0x80000000 );
 //	printf ( "The number of address space IDs: %x\n", n_asids );
 
-	unsigned int np = cpuid_ebx ( 0x80000000 ) & 1;
-	if ( ! np ) {
+	if ( ! cpu_has ( c, X86_FEATURE_NPT ) ) {
 		fatal_failure ( "Nested paging is not supported.\n" );
 	}
 }
@@ -189,13 +201,13 @@ init_amd ( struct cpuinfo_x86 *c )
 void __init
 identify_cpu ( void )
 {
-	struct cpuinfo_x86 c;
+	struct cpuinfo_x86 *c = &boot_cpu_data;
 
-	early_identify_cpu ( &c );
+	early_identify_cpu ( c );
 
-	switch ( c.x86_vendor ) {
+	switch ( c->x86_vendor ) {
 	case X86_VENDOR_AMD:
-		init_amd ( &c ); 
+		init_amd ( c ); 
 		break;
 
 	case X86_VENDOR_UNKNOWN:
@@ -203,5 +215,12 @@ identify_cpu ( void )
 		fatal_failure ( "Unknown CPU vendor\n" );
 		break;
 	}
+
+	/* Allow SSE instructions in the VMM (used by the string functions) */
+	if ( cpu_has_xmm2 ) {
+		write_cr4 ( read_cr4 ( ) | X86_CR4_OSFXSR | X86_CR4_OSXMMEXCPT );
+	}
+
+	string_init ( c );
 }
  
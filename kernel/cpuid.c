@@ -0,0 +1,158 @@
+#include "types.h"
+#include "string.h"
+#include "printf.h"
+#include "msr.h"
+#include "vmcb.h"
+#include "vm.h"
+#include "emulate.h"
+#include "cpuid.h"
+
+
+enum cpuid_reg { CPUID_EAX, CPUID_EBX, CPUID_ECX, CPUID_EDX };
+
+/* Features hidden from or added to what the host reports. */
+struct cpuid_mask {
+	u32 leaf;
+	enum cpuid_reg reg;
+	u32 clear;
+	u32 set;
+};
+
+static const struct cpuid_mask cpuid_masks [] = {
+	{ 0x00000001, CPUID_ECX, ( 1 << 3 ) | ( 1 << 5 ), 1U << 31 }, /* MONITOR and VMX off, hypervisor present */
+	{ 0x00000005, CPUID_EAX, ~0U, 0 },                            /* No MONITOR/MWAIT leaf */
+	{ 0x00000005, CPUID_EBX, ~0U, 0 },
+	{ 0x00000005, CPUID_ECX, ~0U, 0 },
+	{ 0x00000005, CPUID_EDX, ~0U, 0 },
+	{ 0x80000001, CPUID_ECX, ( 1 << 2 ), 0 },                     /* SVM off (no nested virtualization) */
+	{ 0x8000000a, CPUID_EAX, ~0U, 0 },                            /* No SVM leaf */
+	{ 0x8000000a, CPUID_EBX, ~0U, 0 },
+	{ 0x8000000a, CPUID_ECX, ~0U, 0 },
+	{ 0x8000000a, CPUID_EDX, ~0U, 0 },
+};
+
+static const struct cpuid_leaf cpuid_null_leaf = { 0, 0, 0, 0 };
+
+
+static u32 *
+leaf_reg ( struct cpuid_leaf *l, enum cpuid_reg reg )
+{
+	switch ( reg ) {
+	case CPUID_EAX: return &l->eax;
+	case CPUID_EBX: return &l->ebx;
+	case CPUID_ECX: return &l->ecx;
+	default:        return &l->edx;
+	}
+}
+
+static void
+apply_masks ( u32 leaf, struct cpuid_leaf *l )
+{
+	const size_t nelm = sizeof ( cpuid_masks ) / sizeof ( struct cpuid_mask );
+	int i;
+
+	for ( i = 0; i < nelm; i++ ) {
+		const struct cpuid_mask *m = &cpuid_masks [ i ];
+		if ( m->leaf == leaf ) {
+			u32 *r = leaf_reg ( l, m->reg );
+			*r = ( *r & ~m->clear ) | m->set;
+		}
+	}
+}
+
+/* Fill a range with the host's leaves and return the number of valid leaves. */
+static u32
+fill_host_range ( struct cpuid_leaf *leaves, u32 base, u32 max_leaves )
+{
+	const u32 max = cpuid_eax ( base );
+	u32 n, i;
+
+	if ( ( max < base ) || ( max - base >= 0x10000 ) ) {
+		return 0;
+	}
+
+	n = max - base + 1;
+	if ( n > max_leaves ) {
+		n = max_leaves;
+	}
+
+	for ( i = 0; i < n; i++ ) {
+		struct cpuid_leaf *l = &leaves [ i ];
+		cpuid_count ( base + i, 0, &l->eax, &l->ebx, &l->ecx, &l->edx );
+		apply_masks ( base + i, l );
+	}
+
+	/* The guest must not see leaves beyond the table */
+	leaves [ 0 ].eax = base + n - 1;
+
+	return n;
+}
+
+static void
+fill_hypervisor_range ( struct cpuid_leaf *leaves )
+{
+	const char *sig = CPUID_HYPERVISOR_SIGNATURE;
+
+	memset ( leaves, 0, sizeof ( struct cpuid_leaf ) * CPUID_NR_HYPERVISOR );
+	leaves [ 0 ].eax = 0x40000000 + CPUID_NR_HYPERVISOR - 1;
+	memmove ( &leaves [ 0 ].ebx, sig,     4 );
+	memmove ( &leaves [ 0 ].ecx, sig + 4, 4 );
+	memmove ( &leaves [ 0 ].edx, sig + 8, 4 );
+}
+
+void
+cpuid_table_init ( struct cpuid_table *tbl )
+{
+	memset ( tbl, 0, sizeof ( struct cpuid_table ) );
+
+	tbl->range [ 0 ].leaves      = tbl->basic;
+	tbl->range [ 0 ].nr_leaves   = fill_host_range ( tbl->basic, 0x00000000, CPUID_NR_BASIC );
+	tbl->range [ 0 ].subleaf_map = ( 1 << 0x4 ) | ( 1 << 0x7 ) | ( 1 << 0xb ) | ( 1 << 0xd ) | ( 1 << 0xf ) | ( 1 << 0x10 );
+
+	tbl->range [ 1 ].leaves      = tbl->hypervisor;
+	tbl->range [ 1 ].nr_leaves   = CPUID_NR_HYPERVISOR;
+	fill_hypervisor_range ( tbl->hypervisor );
+
+	tbl->range [ 2 ].leaves      = tbl->extended;
+	tbl->range [ 2 ].nr_leaves   = fill_host_range ( tbl->extended, 0x80000000, CPUID_NR_EXTENDED );
+	tbl->range [ 2 ].subleaf_map = ( 1 << 0x1d );
+
+	/* 0xc0000000 - : no leaves */
+	tbl->range [ 3 ].leaves      = NULL;
+	tbl->range [ 3 ].nr_leaves   = 0;
+
+	printf ( "CPUID table created (basic=%x, extended=%x).\n",
+		 tbl->range [ 0 ].nr_leaves, tbl->range [ 2 ].nr_leaves );
+}
+
+/* [REF] AMD64 manual Vol. 3, CPUID */
+int
+handle_cpuid ( struct vm *vm )
+{
+	struct vmcb *vmcb = vm->vmcb;
+	struct vcpu_regs *regs = &vm->regs;
+	const u32 leaf  = ( u32 ) vmcb->rax;
+	const u32 index = leaf & 0x3fffffff;
+	const struct cpuid_range *r = &vm->cpuid.range [ leaf >> 30 ];
+	const struct cpuid_leaf *l = &cpuid_null_leaf;
+	struct cpuid_leaf tmp;
+
+	if ( index < r->nr_leaves ) {
+		l = &r->leaves [ index ];
+
+		/* Rare: leaves with subleaves are not cached */
+		if ( ( index < 32 ) && ( r->subleaf_map & ( 1U << index ) ) && ( ( u32 ) regs->rcx != 0 ) ) {
+			cpuid_count ( leaf, ( u32 ) regs->rcx, &tmp.eax, &tmp.ebx, &tmp.ecx, &tmp.edx );
+			apply_masks ( leaf, &tmp );
+			l = &tmp;
+		}
+	}
+
+	vmcb->rax  = l->eax;
+	regs->rbx  = l->ebx;
+	regs->rcx  = l->ecx;
+	regs->rdx  = l->edx;
+
+	skip_instruction ( vm );
+	return 0;
+}
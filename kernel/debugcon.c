@@ -0,0 +1,59 @@
+#include "types.h"
+#include "string.h"
+#include "printf.h"
+#include "vm.h"
+#include "ioport.h"
+#include "debugcon.h"
+
+
+/* Lines from VMs other than the first are tagged with the VM number */
+static void
+debugcon_flush ( struct vm *vm, struct debugcon *con )
+{
+	con->buf [ con->len ] = '\0';
+	if ( vm->id == 0 ) {
+		printf ( "[guest] %s\n", con->buf );
+	} else {
+		printf ( "[guest%c] %s\n", '0' + vm->id, con->buf );
+	}
+	con->len = 0;
+}
+
+/* A whole REP OUTSB arrives in one call. */
+static int
+debugcon_io ( struct vm *vm, void *opaque, u16 port, int size, int is_in, void *buf, unsigned long count )
+{
+	struct debugcon *con = ( struct debugcon * ) opaque;
+	const u8 *p = ( const u8 * ) buf;
+	unsigned long i;
+
+	if ( is_in ) {
+		/* Reading the port returns its number to show that it is present */
+		memset ( buf, 0, size * count );
+		for ( i = 0; i < count; i++ ) {
+			( ( u8 * ) buf ) [ i * size ] = DEBUGCON_PORT;
+		}
+		return 0;
+	}
+
+	for ( i = 0; i < count; i++ ) {
+		const char c = ( char ) p [ i * size ];
+
+		if ( c == '\n' ) {
+			debugcon_flush ( vm, con );
+			continue;
+		}
+		con->buf [ con->len++ ] = c;
+		if ( con->len == DEBUGCON_BUF_SIZE - 1 ) {
+			debugcon_flush ( vm, con );
+		}
+	}
+	return 0;
+}
+
+void
+debugcon_init ( struct vm *vm )
+{
+	vm->debugcon.len = 0;
+	ioport_register ( &vm->io, DEBUGCON_PORT, 1, debugcon_io, &vm->debugcon );
+}
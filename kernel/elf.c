@@ -2,6 +2,25 @@
 #include "printf.h"
 #include "elf.h"
 #include "vm.h"
+#include "page.h"
+#include "bootprof.h"
+#include "bulkmem.h"
+#include "failure.h"
+#include "lz4.h"
+
+
+/* A compressed image is loaded in one pass over the decompressed stream: 
+ * the headers are collected from its first ELF_HDR_MAX bytes, and every 
+ * byte after that goes straight to the segment that holds it.  */
+#define ELF_HDR_MAX PAGE_SIZE
+
+struct elf_stream {
+	unsigned long vm_pmem_start;
+	unsigned long hdr_len;
+	int parsed;
+};
+
+static u8 elf_hdr [ ELF_HDR_MAX ];
 
 
 static int
@@ -10,6 +29,33 @@ is_loadable_phdr ( struct Elf_Phdr *phdr )
 	return ( ( phdr->p_type == PT_LOAD ) && ( ( phdr->p_flags & ( PF_W | PF_X ) ) ) );
 }
 
+/* Map the whole pages of a read-only segment to the image frames that 
+ * hold them instead of copying, if the segment has the same offset 
+ * within a page in both.  The guest's first write to such a page copies 
+ * it into its own frame (vm_unshare_page).  Returns the number of bytes mapped starting 
+ * at *SKIP, the offset of the first mapped byte within the segment.  */
+static unsigned long
+map_elf_segment ( struct vm *vm, struct Elf_Phdr *phdr, unsigned long image_paddr, unsigned long *skip )
+{
+	const unsigned long pml4 = ( unsigned long ) VIRT ( vm->h_cr3 );
+	const unsigned long src  = image_paddr + phdr->p_offset;
+	const unsigned long gpa  = PAGE_UP ( phdr->p_paddr );
+	const unsigned long end  = PAGE_DOWN ( phdr->p_paddr + phdr->p_filesz );
+	unsigned long off;
+
+	if ( ( phdr->p_flags & PF_W ) || ( ( src ^ phdr->p_paddr ) & ( PAGE_SIZE - 1 ) ) || ( end <= gpa ) ) {
+		return 0;
+	}
+
+	*skip = gpa - phdr->p_paddr;
+	for ( off = 0; off < end - gpa; off += PAGE_SIZE ) {
+		mmap_page ( pml4, gpa + off, src + *skip + off, PGT_LEVEL_PT, PTTEF_US );
+	}
+	vm->npt_pages [ 0 ] += ( end - gpa ) >> PAGE_SHIFT;
+
+	return end - gpa;
+}
+
 struct Elf_Phdr *
 get_elf_phdr ( struct Elf_Ehdr *ehdr, int i )
 {
@@ -17,14 +63,114 @@ get_elf_phdr ( struct Elf_Ehdr *ehdr, int i )
 	return ( struct Elf_Phdr * ) ( p + ehdr->e_phoff + ( i * ehdr->e_phentsize ) );
 }
 
+static void
+clear_elf_bss ( struct Elf_Phdr *phdr, unsigned long vm_pmem_start )
+{
+	const size_t len = phdr->p_memsz - phdr->p_filesz;
+
+	if ( len > 0 ) {
+		bulk_clear ( ( char * ) ( vm_pmem_start + phdr->p_paddr + phdr->p_filesz ), len );
+	}
+}
+
+/* Copy the stream bytes at file offset POS to the segments they belong to */
+static void
+put_elf_data ( struct elf_stream *es, unsigned long pos, const u8 *buf, size_t len )
+{
+	struct Elf_Ehdr *ehdr = ( struct Elf_Ehdr * ) elf_hdr;
+	int i;
+
+	for ( i = 0; i < ehdr->e_phnum; i++ ) {
+		struct Elf_Phdr *phdr = get_elf_phdr ( ehdr, i );
+		const unsigned long s = ( pos > phdr->p_offset ) ? pos : phdr->p_offset;
+		const unsigned long e = ( pos + len < phdr->p_offset + phdr->p_filesz ) ? pos + len : phdr->p_offset + phdr->p_filesz;
+
+		if ( is_loadable_phdr ( phdr ) && ( s < e ) ) {
+			bulk_copy ( ( char * ) ( es->vm_pmem_start + phdr->p_paddr + s - phdr->p_offset ), buf + s - pos, e - s );
+		}
+	}
+}
+
+static void
+parse_elf_hdr ( struct elf_stream *es )
+{
+	struct Elf_Ehdr *ehdr = ( struct Elf_Ehdr * ) elf_hdr;
+
+	if ( ( es->hdr_len < sizeof ( struct Elf_Ehdr ) ) || 
+	     ( ehdr->e_phoff + ehdr->e_phnum * ehdr->e_phentsize > es->hdr_len ) ) {
+		fatal_failure ( "Compressed guest image: program headers not found.\n" );
+	}
+	es->parsed = 1;
+
+	/* The segments may start within the headers' page */
+	put_elf_data ( es, 0, elf_hdr, es->hdr_len );
+}
+
+static void
+elf_stream_sink ( void *arg, unsigned long pos, const u8 *buf, size_t len )
+{
+	struct elf_stream *es = arg;
+
+	if ( ! es->parsed ) {
+		const size_t n = ( pos + len < ELF_HDR_MAX ) ? len : ELF_HDR_MAX - pos;
+
+		memmove ( elf_hdr + pos, buf, n );
+		es->hdr_len = pos + n;
+		if ( es->hdr_len < ELF_HDR_MAX ) {
+			return;
+		}
+		parse_elf_hdr ( es );
+		pos += n; buf += n; len -= n;
+	}
+
+	put_elf_data ( es, pos, buf, len );
+}
+
+static unsigned long 
+load_compressed_elf_image ( unsigned long guest_image_start, unsigned long guest_image_size, unsigned long vm_pmem_start )
+{
+	struct Elf_Ehdr *ehdr = ( struct Elf_Ehdr * ) elf_hdr;
+	struct elf_stream es = { vm_pmem_start, 0, 0 };
+	int i;
+
+	const long size = lz4_decompress_frame ( ( void * ) guest_image_start, guest_image_size, elf_stream_sink, &es );
+	if ( size < 0 ) {
+		fatal_failure ( "Compressed guest image is corrupted.\n" );
+	}
+	if ( ! es.parsed ) {
+		parse_elf_hdr ( &es );
+	}
+
+	for ( i = 0; i < ehdr->e_phnum; i++ ) {
+		struct Elf_Phdr *phdr = get_elf_phdr ( ehdr, i );
+
+		if ( is_loadable_phdr ( phdr ) ) {
+			clear_elf_bss ( phdr, vm_pmem_start );
+		}
+	}
+
+	printf ( "Compressed ELF image loaded (compressed=%x, size=%x).\n", guest_image_size, size );
+
+	return ehdr->e_entry;
+}
+
+/* Place the segments of the image at GUEST_IMAGE_START (a VMM virtual 
+ * address) in the guest physical memory at VM_PMEM_START.  The image 
+ * frames must stay allocated as long as the VM runs.  An LZ4 frame is 
+ * decompressed into place instead.  */
 unsigned long 
-load_elf_image ( unsigned long guest_image_start, unsigned long guest_image_size, unsigned long vm_pmem_start )
+load_elf_image ( struct vm *vm, unsigned long guest_image_start, unsigned long guest_image_size, unsigned long vm_pmem_start )
 {
 	struct Elf_Ehdr *ehdr = ( struct Elf_Ehdr * ) guest_image_start;
 
+	if ( lz4_is_frame ( ehdr, guest_image_size ) ) {
+		return load_compressed_elf_image ( guest_image_start, guest_image_size, vm_pmem_start );
+	}
+
 	// [DEBUG] 
 //	printf ( "Entry point address: %x\n",  ( unsigned long ) ehdr->e_entry );
 
+	unsigned long nr_mapped = 0;
 	int i;
 	for ( i = 0; i < ehdr->e_phnum; i++ ) {
 
@@ -38,16 +184,21 @@ load_elf_image ( unsigned long guest_image_start, unsigned long guest_image_size
 //		printf ( "[%x] vaddr=%x, paddr=%x, filesz=%x, memsz=%x\n", i, phdr->p_vaddr, phdr->p_paddr, phdr->p_filesz, phdr->p_memsz );
 
 		if ( phdr->p_filesz > 0 ) {
-			memmove ( ( char * ) ( vm_pmem_start + phdr->p_paddr ), ( ( char * ) ehdr ) + phdr->p_offset, phdr->p_filesz );
-		}
-		
-		size_t len = phdr->p_memsz - phdr->p_filesz;
-		if ( len > 0 ) {
-			memset ( ( char * ) ( vm_pmem_start + phdr->p_paddr + phdr->p_filesz ), 0, len );
+			char *dest = ( char * ) ( vm_pmem_start + phdr->p_paddr );
+			char *src  = ( ( char * ) ehdr ) + phdr->p_offset;
+			unsigned long skip = 0;
+			const unsigned long mapped = map_elf_segment ( vm, phdr, PHYS ( ehdr ), &skip );
+
+			/* Only the partial pages at either end are copied */
+			bulk_copy ( dest, src, skip );
+			bulk_copy ( dest + skip + mapped, src + skip + mapped, phdr->p_filesz - skip - mapped );
+			nr_mapped += mapped;
 		}
+
+		clear_elf_bss ( phdr, vm_pmem_start );
 	}
 
-	printf ( "ELF image loaded.\n" );
+	printf ( "ELF image loaded (mapped=%x).\n", nr_mapped );
 
 	return ehdr->e_entry;
 }
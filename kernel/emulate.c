@@ -0,0 +1,432 @@
+#include "types.h"
+#include "bitops.h"
+#include "string.h"
+#include "printf.h"
+#include "msr.h"
+#include "system.h"
+#include "page.h"
+#include "cpufeature.h"
+#include "cpu.h"
+#include "vmcb.h"
+#include "vm.h"
+#include "snapshot.h"
+#include "zpool.h"
+#include "balloon.h"
+#include "emulate.h"
+
+
+/* Guest physical address --> VMM virtual address (through the nested page 
+ * table), or NULL if GPA is not backed, or WRITE is set and the guest may 
+ * not write it.  */
+void *
+gpa_to_hva ( struct vm *vm, unsigned long gpa, int write )
+{
+	const unsigned long pml4 = ( unsigned long ) VIRT ( vm->h_cr3 );
+	unsigned long paddr, flags;
+
+	/* Bring back guest RAM that is not mapped yet (lazy restore) or any
+	 * more (compressed, ballooned) */
+	snapshot_fault ( vm, gpa );
+	zpool_fault ( vm, gpa );
+	balloon_fault ( vm, gpa );
+
+	if ( pgt_lookup ( pml4, gpa, &paddr, &flags ) != 0 ) {
+		return NULL;
+	}
+
+	/* As for a guest store: a guest image page gets its own copy */
+	if ( write && ! ( flags & PTTEF_RW ) ) {
+		if ( ( vm_unshare_page ( vm, gpa ) != 0 ) || ( pgt_lookup ( pml4, gpa, &paddr, NULL ) != 0 ) ) {
+			return NULL;
+		}
+	}
+	return VIRT ( paddr );
+}
+
+/* Walk the guest page table.  Return 0 on success, GUEST_ERR_PF if the 
+ * address is not mapped, or GUEST_ERR_GPA if a table is outside guest memory.
+ * [REF] AMD64 manual Vol. 2, pp. 121-135 (legacy mode) and pp. 135-140 (long mode) */
+int
+gva_to_gpa ( struct vm *vm, unsigned long gva, unsigned long *gpa )
+{
+	const struct vmcb *vmcb = vm->vmcb;
+	unsigned long table, addr_mask;
+	int shift, index_bits, entry_size;
+
+	if ( ! ( vmcb->cr0 & X86_CR0_PG ) ) {
+		*gpa = gva;
+		return 0;
+	}
+
+	if ( vmcb->efer & EFER_LMA ) {
+		/* 4-level, 64-bit entries */
+		shift = 39; index_bits = 9; entry_size = 8;
+		addr_mask = 0x000ffffffffff000UL;
+	} else if ( vmcb->cr4 & ( 1UL << _X86_CR4_PAE ) ) {
+		/* 3-level, 64-bit entries */
+		shift = 30; index_bits = 9; entry_size = 8;
+		addr_mask = 0x000ffffffffff000UL;
+		gva &= 0xffffffffUL;
+	} else {
+		/* 2-level, 32-bit entries */
+		shift = 22; index_bits = 10; entry_size = 4;
+		addr_mask = 0xfffff000UL;
+		gva &= 0xffffffffUL;
+	}
+
+	table = vmcb->cr3 & addr_mask;
+	if ( shift == 30 ) {
+		table = vmcb->cr3 & 0xffffffe0UL; /* PDPT is 32-byte aligned */
+	}
+
+	while ( 1 ) {
+		const unsigned long index = ( gva >> shift ) & ( ( 1UL << index_bits ) - 1 );
+		const void *p = gpa_to_hva ( vm, table + index * entry_size, 0 );
+		unsigned long e;
+
+		if ( p == NULL ) {
+			return GUEST_ERR_GPA;
+		}
+		e = ( entry_size == 8 ) ? * ( u64 * ) p : * ( u32 * ) p;
+
+		if ( ! ( e & PTTEF_PRESENT ) ) {
+			return GUEST_ERR_PF;
+		}
+
+		if ( ( shift == 12 ) || ( ( shift != 39 ) && ( e & PTTEF_PAGE_SIZE ) ) ) {
+			const unsigned long offset_mask = ( 1UL << shift ) - 1;
+			*gpa = ( e & addr_mask & ~offset_mask ) | ( gva & offset_mask );
+			return 0;
+		}
+
+		table = e & addr_mask;
+		shift -= index_bits;
+	}
+}
+
+/* The VMM address of GVA, which must not cross a page, to be written if 
+ * WRITE is set.  Return 0 or GUEST_ERR_*. */
+static int
+gva_to_hva ( struct vm *vm, unsigned long gva, int write, void **hva )
+{
+	unsigned long gpa;
+	int ret;
+
+	if ( ( ret = gva_to_gpa ( vm, gva, &gpa ) ) != 0 ) {
+		return ret;
+	}
+	if ( ( *hva = gpa_to_hva ( vm, gpa, write ) ) == NULL ) {
+		return GUEST_ERR_GPA;
+	}
+	return 0;
+}
+
+/* Copy LEN bytes at the guest virtual address GVA.  Return 0 or GUEST_ERR_*. */
+int
+copy_from_guest ( struct vm *vm, void *dest, unsigned long gva, size_t len )
+{
+	char *d = ( char * ) dest;
+
+	while ( len > 0 ) {
+		size_t n = PAGE_SIZE - ( gva & ( PAGE_SIZE - 1 ) );
+		void *hva;
+		int ret;
+
+		if ( n > len ) {
+			n = len;
+		}
+		if ( ( ret = gva_to_hva ( vm, gva, 0, &hva ) ) != 0 ) {
+			return ret;
+		}
+		memmove ( d, hva, n );
+
+		d += n; gva += n; len -= n;
+	}
+	return 0;
+}
+
+/* Copy LEN bytes to the guest virtual address GVA.  Return 0 or GUEST_ERR_*. */
+int
+copy_to_guest ( struct vm *vm, unsigned long gva, const void *src, size_t len )
+{
+	const char *s = ( const char * ) src;
+
+	while ( len > 0 ) {
+		size_t n = PAGE_SIZE - ( gva & ( PAGE_SIZE - 1 ) );
+		void *hva;
+		int ret;
+
+		if ( n > len ) {
+			n = len;
+		}
+		if ( ( ret = gva_to_hva ( vm, gva, 1, &hva ) ) != 0 ) {
+			return ret;
+		}
+		memmove ( hva, s, n );
+
+		s += n; gva += n; len -= n;
+	}
+	return 0;
+}
+
+/* Can LEN bytes at GVA be copied (to, if WRITE is set)?  Return 0, or
+ * GUEST_ERR_* with the first address that cannot in *FAULT.  */
+int
+guest_range_check ( struct vm *vm, unsigned long gva, size_t len, int write, unsigned long *fault )
+{
+	const unsigned long end = gva + len;
+	void *hva;
+	int ret;
+
+	while ( gva < end ) {
+		if ( ( ret = gva_to_hva ( vm, gva, write, &hva ) ) != 0 ) {
+			*fault = gva;
+			return ret;
+		}
+		gva = ( gva & PAGE_MASK ) + PAGE_SIZE;
+	}
+	return 0;
+}
+
+/* Reflect a failed access to GVA (ERR from the functions above) back to 
+ * the guest, which retries the instruction once it has dealt with it */
+void
+inject_guest_fault ( struct vm *vm, int err, unsigned long gva, u32 pfec )
+{
+	struct vmcb *vmcb = vm->vmcb;
+
+	if ( err == GUEST_ERR_PF ) {
+		vmcb->cr2 = gva;
+		vmcb_inject_exception ( vmcb, 14 /* #PF */, 1, pfec | ( ( vmcb->cpl == 3 ) ? PFEC_USER : 0 ) );
+	} else {
+		vmcb_inject_exception ( vmcb, 13 /* #GP */, 1, 0 );
+	}
+}
+
+/******************************************************/
+
+/* Default operand size of the guest: 16, 32 or 64 (bits) */
+int
+guest_cpu_mode ( const struct vmcb *vmcb )
+{
+	if ( ! ( vmcb->cr0 & X86_CR0_PE ) ) {
+		return 16;
+	}
+	if ( ( vmcb->efer & EFER_LMA ) && ( vmcb->cs.attrs.fields.l ) ) {
+		return 64;
+	}
+	return ( vmcb->cs.attrs.fields.db ) ? 32 : 16;
+}
+
+/* Opcode property bitmaps (bit N set <=> opcode N has the property).
+ * [REF] AMD64 manual Vol. 3, Appendix A */
+static const u32 onebyte_has_modrm [ 8 ]
+	= { 0x0f0f0f0f, 0x0f0f0f0f, 0x00000000, 0x00000a0c, 0x0000ffff, 0x00000000, 0xff0f00f3, 0xc0c00000 };
+static const u32 onebyte_has_imm8 [ 8 ]
+	= { 0x10101010, 0x10101010, 0x00000000, 0xffff0c00, 0x0000000d, 0x00ff0100, 0x00302043, 0x000008ff };
+static const u32 onebyte_has_immz [ 8 ]
+	= { 0x20202020, 0x20202020, 0x00000000, 0x00000300, 0x00000002, 0x00000200, 0x00000080, 0x00000300 };
+static const u32 twobyte_has_modrm [ 8 ]
+	= { 0xffffa00f, 0xff00ffff, 0xffffffff, 0xff7fffff, 0xffff0000, 0xfffff8f8, 0xffff00ff, 0xffffffff };
+static const u32 twobyte_has_imm8 [ 8 ]
+	= { 0x00008000, 0x00000000, 0x00000000, 0x000f0000, 0x00000000, 0x04001010, 0x00000074, 0x00000000 };
+
+static inline int
+opcode_test ( const u32 *bitmap, u8 op )
+{
+	return !! ( bitmap [ op >> 5 ] & ( 1U << ( op & 31 ) ) );
+}
+
+static int
+is_legacy_prefix ( u8 b )
+{
+	switch ( b ) {
+	case 0x66: case 0x67: case 0xf0: case 0xf2: case 0xf3:
+	case 0x26: case 0x2e: case 0x36: case 0x3e: case 0x64: case 0x65:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+/* Length of the ModRM byte and the following SIB byte and displacement */
+static int
+modrm_length ( const u8 *p, size_t avail, int addr_size )
+{
+	const u8 modrm = p [ 0 ];
+	const int mod = modrm >> 6;
+	const int rm  = modrm & 7;
+	int len = 1;
+
+	if ( mod == 3 ) {
+		return len;
+	}
+
+	if ( addr_size == 16 ) {
+		if ( mod == 1 ) { return len + 1; }
+		if ( ( mod == 2 ) || ( rm == 6 ) ) { return len + 2; }
+		return len;
+	}
+
+	if ( rm == 4 ) {
+		if ( avail < 2 ) { return -1; }
+		len++;
+		if ( ( mod == 0 ) && ( ( p [ 1 ] & 7 ) == 5 ) ) {
+			return len + 4;
+		}
+	} else if ( ( mod == 0 ) && ( rm == 5 ) ) {
+		return len + 4; /* disp32 (RIP-relative in 64-bit mode) */
+	}
+
+	if ( mod == 1 ) { return len + 1; }
+	if ( mod == 2 ) { return len + 4; }
+	return len;
+}
+
+/* Return the length of the instruction at BUF, or 0 if it cannot be decoded.
+ * Only the legacy and REX encodings are covered (no VEX/EVEX),
+ * which includes all the instructions the VMM intercepts. */
+int
+insn_length ( const u8 *buf, size_t len, int mode )
+{
+	int op_size   = ( mode == 16 ) ? 16 : 32;
+	int addr_size = mode;
+	int rex_w     = 0;
+	size_t i = 0;
+	int has_modrm;
+	int imm = 0;
+	u8 op;
+
+	if ( len > MAX_INSN_LEN ) {
+		len = MAX_INSN_LEN;
+	}
+
+	/* Prefixes */
+	for ( ; i < len; i++ ) {
+		if ( is_legacy_prefix ( buf [ i ] ) ) {
+			if ( buf [ i ] == 0x66 ) { op_size = ( mode == 16 ) ? 32 : 16; }
+			if ( buf [ i ] == 0x67 ) { addr_size = ( mode == 32 ) ? 16 : 32; }
+			rex_w = 0; /* REX must immediately precede the opcode */
+			continue;
+		}
+		if ( ( mode == 64 ) && ( ( buf [ i ] & 0xf0 ) == 0x40 ) ) {
+			rex_w = !! ( buf [ i ] & 0x08 );
+			continue;
+		}
+		break;
+	}
+	if ( i >= len ) {
+		return 0;
+	}
+	if ( rex_w ) {
+		op_size = 64;
+	}
+
+	op = buf [ i++ ];
+
+	if ( op != 0x0f ) {
+		/* One-byte opcode map */
+		if ( ( mode == 64 ) && ( ( op == 0xc4 ) || ( op == 0xc5 ) || ( op == 0x62 ) ) ) {
+			return 0; /* VEX / EVEX */
+		}
+
+		has_modrm = opcode_test ( onebyte_has_modrm, op );
+		if ( opcode_test ( onebyte_has_imm8, op ) ) { imm += 1; }
+		if ( opcode_test ( onebyte_has_immz, op ) ) { imm += ( op_size == 16 ) ? 2 : 4; }
+
+		switch ( op ) {
+		case 0xc2: case 0xca: imm = 2; break;
+		case 0xc8:            imm = 3; break;
+		case 0x9a: case 0xea: imm = ( ( op_size == 16 ) ? 2 : 4 ) + 2; break;
+		case 0xa0: case 0xa1: case 0xa2: case 0xa3: imm = addr_size / 8; break;
+		case 0xb8: case 0xb9: case 0xba: case 0xbb:
+		case 0xbc: case 0xbd: case 0xbe: case 0xbf:
+			imm = op_size / 8; break;
+		case 0xf6: case 0xf7:
+			/* TEST (/0, /1) is the only form with an immediate */
+			if ( ( i < len ) && ( ( ( buf [ i ] >> 3 ) & 7 ) < 2 ) ) {
+				imm = ( op == 0xf6 ) ? 1 : ( ( op_size == 16 ) ? 2 : 4 );
+			}
+			break;
+		}
+	} else {
+		/* Two-byte opcode map (0F xx) and three-byte maps (0F 38 xx, 0F 3A xx) */
+		if ( i >= len ) { return 0; }
+		op = buf [ i++ ];
+
+		if ( ( op == 0x38 ) || ( op == 0x3a ) ) {
+			if ( i >= len ) { return 0; }
+			i++;
+			has_modrm = 1;
+			imm = ( op == 0x3a ) ? 1 : 0;
+		} else {
+			has_modrm = opcode_test ( twobyte_has_modrm, op );
+			if ( opcode_test ( twobyte_has_imm8, op ) ) { imm = 1; }
+			if ( ( op & 0xf0 ) == 0x80 ) { imm = ( op_size == 16 ) ? 2 : 4; } /* Jcc rel16/32 */
+		}
+	}
+
+	if ( has_modrm ) {
+		int n;
+
+		if ( i >= len ) { return 0; }
+		n = modrm_length ( buf + i, len - i, addr_size );
+		if ( n < 0 ) { return 0; }
+		i += n;
+	}
+
+	i += imm;
+	return ( i <= len ) ? ( int ) i : 0;
+}
+
+/* Complete an intercepted instruction by advancing the guest RIP.  With
+ * NRIPS the processor already provides the address of the next
+ * instruction; otherwise fetch the instruction and decode its length. */
+void
+skip_instruction ( struct vm *vm )
+{
+	struct vmcb *vmcb = vm->vmcb;
+	u8 buf [ MAX_INSN_LEN ];
+	const u8 *insn = buf;
+	int len, ret;
+
+	/* An instruction boundary is crossed. */
+	vmcb->interrupt_shadow = 0;
+
+	if ( cpu_has_nrips && ( vmcb->nrip != 0 ) ) {
+		vmcb->rip = vmcb->nrip;
+		return;
+	}
+
+	if ( cpu_has_decode_assists && ( vmcb->guest_ins_len > 0 ) ) {
+		insn = vmcb->guest_ins_bytes;
+		len  = vmcb->guest_ins_len;
+	} else {
+		/* [Note] CS base is ignored in 64-bit mode. */
+		const unsigned long rip = vmcb->rip + ( ( guest_cpu_mode ( vmcb ) == 64 ) ? 0 : vmcb->cs.base );
+
+		/* The instruction may end just before an unmapped page. */
+		len = PAGE_SIZE - ( rip & ( PAGE_SIZE - 1 ) );
+		if ( len > MAX_INSN_LEN ) {
+			len = MAX_INSN_LEN;
+		}
+		if ( ( ret = copy_from_guest ( vm, buf, rip, len ) ) != 0 ) {
+			/* The guest changed its mapping; let it fetch the instruction again */
+			inject_guest_fault ( vm, ret, rip, PFEC_FETCH );
+			return;
+		} else if ( ( len < MAX_INSN_LEN ) && 
+			    ( copy_from_guest ( vm, buf + len, rip + len, MAX_INSN_LEN - len ) == 0 ) ) {
+			len = MAX_INSN_LEN;
+		}
+	}
+
+	len = insn_length ( insn, len, guest_cpu_mode ( vmcb ) );
+	if ( len == 0 ) {
+		/* Not what was intercepted (e.g., overwritten since): #UD */
+		printf ( "Failed to decode the guest instruction (rip=%x).\n", vmcb->rip );
+		vmcb_inject_exception ( vmcb, 6 /* #UD */, 0, 0 );
+		return;
+	}
+
+	vmcb->rip += len;
+}
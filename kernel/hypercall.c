@@ -0,0 +1,95 @@
+#include "types.h"
+#include "printf.h"
+#include "vmcb.h"
+#include "vm.h"
+#include "emulate.h"
+#include "vmstat.h"
+#include "bootprof.h"
+#include "snapshot.h"
+#include "balloon.h"
+#include "hypercall.h"
+
+
+static void
+hc_bench_result ( struct vm *vm )
+{
+	const struct vcpu_regs *regs = &vm->regs;
+	const unsigned long iterations = regs->rcx;
+	const unsigned long cycles     = regs->rdx;
+
+	printf ( "BENCH: id=%x, iterations=%x, cycles=%x, cycles/op=%x\n",
+		 regs->rbx, iterations, cycles, ( iterations > 0 ) ? cycles / iterations : 0 );
+}
+
+static unsigned long
+hc_bootprof_read ( struct vm *vm )
+{
+	const struct vcpu_regs *regs = &vm->regs;
+	unsigned long len = regs->rcx;
+
+	if ( len > sizeof ( struct bootprof ) ) {
+		len = sizeof ( struct bootprof );
+	}
+	if ( copy_to_guest ( vm, regs->rbx, &bootprof, len ) != 0 ) {
+		return -1UL;
+	}
+	return len;
+}
+
+static unsigned long
+hc_memacct_read ( struct vm *vm )
+{
+	const struct vcpu_regs *regs = &vm->regs;
+	unsigned long len = regs->rcx;
+
+	if ( len > sizeof ( struct mem_account ) ) {
+		len = sizeof ( struct mem_account );
+	}
+	if ( copy_to_guest ( vm, regs->rbx, &vm->mem, len ) != 0 ) {
+		return -1UL;
+	}
+	return len;
+}
+
+int
+handle_vmmcall ( struct vm *vm )
+{
+	struct vmcb *vmcb = vm->vmcb;
+	unsigned long ret = 0;
+
+	if ( vmcb->rax == HC_SHUTDOWN ) {
+		printf ( "Guest requested shutdown.\n" );
+		return 1;
+	}
+
+	/* Both leave the guest where the snapshot resumes it: after VMMCALL, 
+	 * with RAX = 1 */
+	if ( vmcb->rax == HC_SNAPSHOT ) {
+		skip_instruction ( vm );
+		vmcb->rax = 1;
+		vmcb->rax = ( snapshot_take ( vm ) == 0 ) ? 0 : -1UL;
+		return 0;
+	}
+	if ( ( vmcb->rax == HC_RESTORE ) && 
+	     ( ( vm->regs.rbx ? snapshot_restore_lazy ( vm ) : snapshot_restore ( vm ) ) == 0 ) ) {
+		return 0;
+	}
+
+	switch ( vmcb->rax ) {
+	case HC_NOP:          break;
+	case HC_BENCH_RESULT: hc_bench_result ( vm ); break;
+	case HC_VMSTAT_DUMP:  vmstat_dump ( vm ); break;
+	case HC_BOOTPROF_READ: ret = hc_bootprof_read ( vm ); break;
+	case HC_NPT_MODE:     ret = vm->npt_mode; break;
+	case HC_MEMACCT_READ: ret = hc_memacct_read ( vm ); break;
+	case HC_STATPAGE_GPA: ret = vm->statpage_gpa; break;
+	case HC_BALLOON_TARGET: ret = balloon_owed ( vm ); break;
+	case HC_BALLOON_REPORT: ret = balloon_report ( vm, vm->regs.rbx, vm->regs.rcx ); break;
+	case HC_MEM_SIZE:     ret = vm->pmem_size; break;
+	default:              ret = -1UL; break;
+	}
+
+	vmcb->rax = ret;
+	skip_instruction ( vm );
+	return 0;
+}
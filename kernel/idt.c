@@ -0,0 +1,68 @@
+#include "types.h"
+#include "string.h"
+#include "printf.h"
+#include "failure.h"
+#include "vmm.h"
+#include "apic.h"
+#include "idt.h"
+
+
+extern void timer_interrupt ( void );
+extern void spurious_interrupt ( void );
+extern void ignore_int ( void );
+
+static struct idt_entry idt_table [ NR_VECTORS ] __attribute__ ((aligned (16)));
+
+/* Set by the timer interrupt and consumed after #VMEXIT(INTR) */
+volatile int timer_ticks_pending;
+
+
+void
+idt_set_gate ( int vector, void ( *handler ) ( void ) )
+{
+	const unsigned long addr = ( unsigned long ) handler;
+	struct idt_entry *e = &idt_table [ vector ];
+
+	e->offset_low  = addr & 0xffff;
+	e->selector    = VMM_CS64;
+	e->ist         = 0;
+	e->type_attr   = 0x8e; /* P, DPL=0, 64-bit interrupt gate */
+	e->offset_mid  = ( addr >> 16 ) & 0xffff;
+	e->offset_high = addr >> 32;
+	e->reserved    = 0;
+}
+
+void
+idt_init ( void )
+{
+	struct {
+		u16 limit;
+		u64 base;
+	} __attribute__ ((packed)) descr;
+	int i;
+
+	for ( i = 0; i < NR_VECTORS; i++ ) {
+		idt_set_gate ( i, ignore_int );
+	}
+	idt_set_gate ( APIC_TIMER_VECTOR, timer_interrupt );
+	idt_set_gate ( APIC_SPURIOUS_VECTOR, spurious_interrupt );
+
+	descr.limit = sizeof ( idt_table ) - 1;
+	descr.base  = ( u64 ) idt_table;
+	asm volatile ( "lidt %0" :: "m" ( descr ) );
+
+	printf ( "IDT loaded.\n" );
+}
+
+void
+do_timer_interrupt ( void )
+{
+	timer_ticks_pending++;
+	lapic_eoi ( );
+}
+
+void
+do_unexpected_interrupt ( void )
+{
+	fatal_failure ( "Unexpected interrupt or exception.\n" );
+}
@@ -0,0 +1,244 @@
+#include "types.h"
+#include "bitops.h"
+#include "string.h"
+#include "printf.h"
+#include "failure.h"
+#include "page.h"
+#include "alloc.h"
+#include "cpufeature.h"
+#include "cpu.h"
+#include "vmcb.h"
+#include "vm.h"
+#include "emulate.h"
+#include "ioport.h"
+#include "bootprof.h"
+#include "memacct.h"
+
+
+static void *
+alloc_filled_pages ( unsigned long size, int c )
+{
+	const unsigned long pfn = alloc_pages ( PFN_UP ( size ), 1 );
+	void *p = VIRT ( pfn << PAGE_SHIFT );
+
+	memset ( p, c, size );
+	if ( c == 0 ) {
+		bootprof_zeroed ( PFN_UP ( size ) );
+	}
+	return p;
+}
+
+void
+ioport_init ( struct io_space *io )
+{
+	/* Intercept all the ports by default (vol. 2, p. 445) */
+	memacct_type ( MEM_IOPM );
+	io->iopm        = ( u8 * ) alloc_filled_pages ( IOPM_SIZE, 0xff );
+	memacct_type ( MEM_DEVICE );
+	io->port_map    = ( u8 * ) alloc_filled_pages ( NR_IO_PORTS, 0 );
+	io->nr_handlers = 0;
+}
+
+unsigned long
+ioport_iopm_base ( const struct io_space *io )
+{
+	return PHYS ( io->iopm );
+}
+
+void
+ioport_register ( struct io_space *io, u16 base, u16 count, ioport_handler_t func, void *opaque )
+{
+	struct io_handler *h;
+	unsigned long port;
+
+	if ( io->nr_handlers >= MAX_IO_HANDLERS ) {
+		fatal_failure ( "Too many I/O port handlers.\n" );
+	}
+
+	h = &io->handlers [ io->nr_handlers++ ];
+	h->base   = base;
+	h->count  = count;
+	h->func   = func;
+	h->opaque = opaque;
+
+	for ( port = base; port < ( unsigned long ) base + count; port++ ) {
+		io->port_map [ port ] = io->nr_handlers; /* index + 1 */
+	}
+}
+
+/* Let the guest access the ports directly. */
+void
+ioport_passthrough ( struct io_space *io, u16 base, u16 count )
+{
+	unsigned long port;
+
+	for ( port = base; port < ( unsigned long ) base + count; port++ ) {
+		io->iopm [ port >> 3 ] &= ~( 1 << ( port & 7 ) );
+	}
+}
+
+/******************************************************/
+
+static void
+decode_ioio ( const struct vmcb *vmcb, struct ioio_info *info )
+{
+	const u64 x = vmcb->exitinfo1;
+
+	info->port      = ( x >> 16 ) & 0xffff;
+	info->is_in     = !! ( x & ( 1 << 0 ) );
+	info->is_string = !! ( x & ( 1 << 2 ) );
+	info->is_rep    = !! ( x & ( 1 << 3 ) );
+	info->size      = ( x & ( 1 << 4 ) ) ? 1 : ( ( x & ( 1 << 5 ) ) ? 2 : 4 );
+	info->addr_size = ( x & ( 1 << 7 ) ) ? 16 : ( ( x & ( 1 << 8 ) ) ? 32 : 64 );
+	info->seg       = ( x >> 10 ) & 7;
+}
+
+/* Unclaimed ports float: reads return all ones and writes are dropped. */
+static int
+unclaimed_port ( struct vm *vm, void *opaque, u16 port, int size, int is_in, void *buf, unsigned long count )
+{
+	if ( is_in ) {
+		memset ( buf, 0xff, size * count );
+	}
+	return 0;
+}
+
+static void
+lookup_io_handler ( struct io_space *io, u16 port, ioport_handler_t *func, void **opaque )
+{
+	const u8 idx = io->port_map [ port ];
+
+	if ( idx == 0 ) {
+		*func   = unclaimed_port;
+		*opaque = NULL;
+		return;
+	}
+
+	*func   = io->handlers [ idx - 1 ].func;
+	*opaque = io->handlers [ idx - 1 ].opaque;
+}
+
+static unsigned long
+seg_base ( const struct vmcb *vmcb, int seg )
+{
+	const struct seg_selector *segs [] = { &vmcb->es, &vmcb->cs, &vmcb->ss, &vmcb->ds, &vmcb->fs, &vmcb->gs };
+
+	if ( ( guest_cpu_mode ( vmcb ) == 64 ) && ( seg < 4 ) ) {
+		return 0;
+	}
+	return ( seg < 6 ) ? segs [ seg ]->base : 0;
+}
+
+static inline u64
+update_addr_reg ( u64 reg, long delta, u64 mask )
+{
+	return ( reg & ~mask ) | ( ( reg + delta ) & mask );
+}
+
+/* INS and OUTS, with or without REP.  The whole transfer is done in this exit,
+ * unless guest memory faults: then the fault is injected with the registers
+ * updated up to the faulting element, and 1 returned.  */
+static int
+emulate_string_io ( struct vm *vm, const struct ioio_info *info, ioport_handler_t func, void *opaque )
+{
+	static u8 bounce [ PAGE_SIZE ];
+	struct vmcb *vmcb = vm->vmcb;
+	struct vcpu_regs *regs = &vm->regs;
+	const u64 mask   = ( info->addr_size == 64 ) ? ~0UL : ( ( 1UL << info->addr_size ) - 1 );
+	const int down   = !! ( vmcb->rflags & ( 1 << 10 ) ); /* DF */
+	u64 *addr_reg    = info->is_in ? &regs->rdi : &regs->rsi;
+	const int seg    = info->is_in ? 0 /* ES */ : ( cpu_has_decode_assists ? info->seg : 3 /* DS */ );
+	unsigned long left = info->is_rep ? ( regs->rcx & mask ) : 1;
+
+	while ( left > 0 ) {
+		const unsigned long gva = seg_base ( vmcb, seg ) + ( *addr_reg & mask );
+		unsigned long n, bytes, fault;
+		int err;
+
+		if ( down ) {
+			n = 1; /* rare: element by element */
+		} else {
+			n = ( PAGE_SIZE - ( gva & ( PAGE_SIZE - 1 ) ) ) / info->size;
+			if ( n == 0 ) { n = 1; }
+			if ( n > left ) { n = left; }
+		}
+		bytes = n * info->size;
+
+		/* Before the port is accessed, so that no data is lost or sent twice */
+		if ( ( err = guest_range_check ( vm, gva, bytes, info->is_in, &fault ) ) != 0 ) {
+			inject_guest_fault ( vm, err, fault, info->is_in ? PFEC_WRITE : 0 );
+			return 1;
+		}
+
+		if ( info->is_in ) {
+			if ( ( *func ) ( vm, opaque, info->port, info->size, 1, bounce, n ) != 0 ) { return -1; }
+			if ( copy_to_guest ( vm, gva, bounce, bytes ) != 0 ) { return -1; }
+		} else {
+			if ( copy_from_guest ( vm, bounce, gva, bytes ) != 0 ) { return -1; }
+			if ( ( *func ) ( vm, opaque, info->port, info->size, 0, bounce, n ) != 0 ) { return -1; }
+		}
+
+		*addr_reg = update_addr_reg ( *addr_reg, down ? - ( long ) bytes : ( long ) bytes, mask );
+		left -= n;
+		if ( info->is_rep ) {
+			regs->rcx = ( regs->rcx & ~mask ) | left;
+		}
+	}
+
+	return 0;
+}
+
+static int
+emulate_io ( struct vm *vm, const struct ioio_info *info, ioport_handler_t func, void *opaque )
+{
+	struct vmcb *vmcb = vm->vmcb;
+	u32 val = 0;
+
+	if ( info->is_in ) {
+		if ( ( *func ) ( vm, opaque, info->port, info->size, 1, &val, 1 ) != 0 ) {
+			return -1;
+		}
+		switch ( info->size ) {
+		case 1: vmcb->rax = ( vmcb->rax & ~0xffUL )   | ( val & 0xff ); break;
+		case 2: vmcb->rax = ( vmcb->rax & ~0xffffUL ) | ( val & 0xffff ); break;
+		default: vmcb->rax = val; break; /* zero-extended */
+		}
+		return 0;
+	}
+
+	val = ( u32 ) vmcb->rax;
+	return ( *func ) ( vm, opaque, info->port, info->size, 0, &val, 1 );
+}
+
+/* [REF] AMD64 manual Vol. 2, pp. 455-456 */
+int
+handle_ioio ( struct vm *vm )
+{
+	struct vmcb *vmcb = vm->vmcb;
+	struct ioio_info info;
+	ioport_handler_t func;
+	void *opaque;
+	int ret;
+
+	decode_ioio ( vmcb, &info );
+	lookup_io_handler ( &vm->io, info.port, &func, &opaque );
+
+	if ( info.is_string ) {
+		ret = emulate_string_io ( vm, &info, func, opaque );
+	} else {
+		ret = emulate_io ( vm, &info, func, opaque );
+	}
+
+	if ( ret < 0 ) {
+		printf ( "I/O port emulation failed: port=%x\n", info.port );
+		return -1;
+	}
+	if ( ret > 0 ) {
+		return 0; /* a fault is injected; the instruction is restarted */
+	}
+
+	/* EXITINFO2 holds the address of the next instruction. */
+	vmcb->rip = vmcb->exitinfo2;
+	vmcb->interrupt_shadow = 0;
+	return 0;
+}
@@ -0,0 +1,380 @@
+#include "types.h"
+#include "string.h"
+#include "lz4.h"
+
+
+enum {
+	LZ4_FLG_VERSION        = 0xc0,
+	LZ4_FLG_BLOCK_CHECKSUM = 0x10,
+	LZ4_FLG_CONTENT_SIZE   = 0x08,
+	LZ4_FLG_DICT_ID        = 0x01,
+
+	LZ4_BLOCK_UNCOMPRESSED = 0x80000000,
+	LZ4_MIN_MATCH          = 4,
+	LZ4_LAST_LITERALS      = 5,  /* a block ends with at least this many literals */
+	LZ4_MF_LIMIT           = 12, /* and its last match starts no later than this from the end */
+
+	LZ4_HASH_BITS          = 12,
+};
+
+/* The decompressed stream is built in a window holding the last 64 
+ * Kbytes, which is all that matches may refer to, and handed to the sink 
+ * whenever the window wraps or a block ends.  Nothing else is buffered.  */
+struct lz4_stream {
+	u8 *window;
+	unsigned long pos;     /* bytes decompressed */
+	unsigned long flushed; /* bytes handed to the sink */
+	lz4_sink_t sink;
+	void *arg;
+};
+
+static u8 lz4_window [ LZ4_WINDOW_SIZE ];
+
+/* Compressor: the last position of each hashed 4-byte sequence */
+static u16 lz4_hash_table [ 1 << LZ4_HASH_BITS ];
+
+
+static u32
+get_le32 ( const u8 *p )
+{
+	return p [ 0 ] | ( p [ 1 ] << 8 ) | ( p [ 2 ] << 16 ) | ( ( u32 ) p [ 3 ] << 24 );
+}
+
+static void
+flush ( struct lz4_stream *s )
+{
+	const unsigned long off = s->flushed & ( LZ4_WINDOW_SIZE - 1 );
+
+	if ( s->pos > s->flushed ) {
+		s->sink ( s->arg, s->flushed, s->window + off, s->pos - s->flushed );
+		s->flushed = s->pos;
+	}
+}
+
+/* Room before the window wraps, flushing first if it is full */
+static size_t
+room ( struct lz4_stream *s )
+{
+	size_t n = LZ4_WINDOW_SIZE - ( s->pos & ( LZ4_WINDOW_SIZE - 1 ) );
+
+	if ( n == LZ4_WINDOW_SIZE && s->pos > s->flushed ) {
+		flush ( s );
+	}
+	return n;
+}
+
+static void
+put_literals ( struct lz4_stream *s, const u8 *src, size_t len )
+{
+	while ( len > 0 ) {
+		size_t n = room ( s );
+
+		if ( n > len ) {
+			n = len;
+		}
+		__memcpy ( s->window + ( s->pos & ( LZ4_WINDOW_SIZE - 1 ) ), src, n );
+		s->pos += n; src += n; len -= n;
+	}
+}
+
+/* Copy LEN bytes from OFFSET back; the source may overlap the output */
+static void
+put_match ( struct lz4_stream *s, unsigned long offset, size_t len )
+{
+	while ( len > 0 ) {
+		const unsigned long from = ( s->pos - offset ) & ( LZ4_WINDOW_SIZE - 1 );
+		size_t n = room ( s );
+
+		if ( n > LZ4_WINDOW_SIZE - from ) {
+			n = LZ4_WINDOW_SIZE - from;
+		}
+		if ( n > offset ) {
+			n = offset;
+		}
+		if ( n > len ) {
+			n = len;
+		}
+		__memcpy ( s->window + ( s->pos & ( LZ4_WINDOW_SIZE - 1 ) ), s->window + from, n );
+		s->pos += n; len -= n;
+	}
+}
+
+/* Read a length continued in 255-valued bytes */
+static int
+get_length ( const u8 **ip, const u8 *end, size_t *len )
+{
+	u8 b;
+
+	do {
+		if ( *ip >= end ) {
+			return -1;
+		}
+		b = *( *ip )++;
+		*len += b;
+	} while ( b == 255 );
+	return 0;
+}
+
+static int
+decompress_block ( struct lz4_stream *s, const u8 *ip, const u8 *end )
+{
+	while ( ip < end ) {
+		const u8 token = *ip++;
+		size_t len = token >> 4;
+
+		if ( len == 15 && get_length ( &ip, end, &len ) != 0 ) {
+			return -1;
+		}
+		if ( len > end - ip ) {
+			return -1;
+		}
+		put_literals ( s, ip, len );
+		ip += len;
+
+		/* The last sequence has literals only */
+		if ( ip == end ) {
+			break;
+		}
+
+		if ( end - ip < 2 ) {
+			return -1;
+		}
+		const unsigned long offset = ip [ 0 ] | ( ip [ 1 ] << 8 );
+		ip += 2;
+		if ( offset == 0 || offset > s->pos ) {
+			return -1;
+		}
+
+		len = token & 15;
+		if ( len == 15 && get_length ( &ip, end, &len ) != 0 ) {
+			return -1;
+		}
+		put_match ( s, offset, len + LZ4_MIN_MATCH );
+	}
+	return 0;
+}
+
+int
+lz4_is_frame ( const void *src, size_t len )
+{
+	return ( len >= 4 ) && ( get_le32 ( src ) == LZ4_FRAME_MAGIC );
+}
+
+/* Decompress the LZ4 frame at SRC, passing the output to SINK as it is 
+ * produced.  Checksums are not verified.  Returns the decompressed size 
+ * or -1 if the frame is malformed.  */
+long
+lz4_decompress_frame ( const void *src, size_t len, lz4_sink_t sink, void *arg )
+{
+	const u8 *ip  = src;
+	const u8 *end = ip + len;
+	struct lz4_stream s = { lz4_window, 0, 0, sink, arg };
+
+	if ( ! lz4_is_frame ( src, len ) || len < 7 ) {
+		return -1;
+	}
+
+	const u8 flg = ip [ 4 ];
+	if ( ( flg & LZ4_FLG_VERSION ) != 0x40 ) {
+		return -1;
+	}
+	ip += 6; /* magic, FLG, BD */
+	ip += ( flg & LZ4_FLG_CONTENT_SIZE ) ? 8 : 0;
+	ip += ( flg & LZ4_FLG_DICT_ID ) ? 4 : 0;
+	ip += 1; /* header checksum */
+
+	for ( ;; ) {
+		if ( end - ip < 4 ) {
+			return -1;
+		}
+		const u32 size = get_le32 ( ip ) & ~LZ4_BLOCK_UNCOMPRESSED;
+		const int raw  = !! ( get_le32 ( ip ) & LZ4_BLOCK_UNCOMPRESSED );
+		ip += 4;
+
+		if ( size == 0 && ! raw ) { /* end mark */
+			break;
+		}
+		if ( size > end - ip ) {
+			return -1;
+		}
+
+		if ( raw ) {
+			put_literals ( &s, ip, size );
+		} else if ( decompress_block ( &s, ip, ip + size ) != 0 ) {
+			return -1;
+		}
+		flush ( &s );
+
+		ip += size + ( ( flg & LZ4_FLG_BLOCK_CHECKSUM ) ? 4 : 0 );
+	}
+
+	return s.pos;
+}
+
+/******************************************************/
+
+/* Decompress the LZ4 block at SRC into DEST.  Returns the decompressed 
+ * size or -1 if the block is malformed or does not fit in CAP bytes.  */
+long
+lz4_decompress_block ( const void *src, size_t len, void *dest, size_t cap )
+{
+	const u8 *ip  = src;
+	const u8 *end = ip + len;
+	u8 *op = dest;
+	u8 *const oend = op + cap;
+
+	while ( ip < end ) {
+		const u8 token = *ip++;
+		size_t n = token >> 4;
+
+		if ( n == 15 && get_length ( &ip, end, &n ) != 0 ) {
+			return -1;
+		}
+		if ( ( n > end - ip ) || ( n > oend - op ) ) {
+			return -1;
+		}
+		__memcpy ( op, ip, n );
+		op += n; ip += n;
+
+		if ( ip == end ) {
+			break;
+		}
+
+		if ( end - ip < 2 ) {
+			return -1;
+		}
+		const unsigned long offset = ip [ 0 ] | ( ip [ 1 ] << 8 );
+		ip += 2;
+		if ( offset == 0 || offset > op - ( u8 * ) dest ) {
+			return -1;
+		}
+
+		n = token & 15;
+		if ( n == 15 && get_length ( &ip, end, &n ) != 0 ) {
+			return -1;
+		}
+		n += LZ4_MIN_MATCH;
+		if ( n > oend - op ) {
+			return -1;
+		}
+
+		/* The source may overlap the output: copy at most OFFSET at a time */
+		while ( n > 0 ) {
+			const size_t m = ( n < offset ) ? n : offset;
+
+			__memcpy ( op, op - offset, m );
+			op += m; n -= m;
+		}
+	}
+
+	return op - ( u8 * ) dest;
+}
+
+static inline u32
+hash4 ( u32 v )
+{
+	return ( v * 2654435761U ) >> ( 32 - LZ4_HASH_BITS );
+}
+
+/* Write a length continued in 255-valued bytes */
+static u8 *
+put_length ( u8 *op, size_t len )
+{
+	for ( ; len >= 255; len -= 255 ) {
+		*op++ = 255;
+	}
+	*op++ = len;
+	return op;
+}
+
+/* One sequence: LIT literals, then (if MATCH is not 0) a match of MATCH 
+ * bytes at OFFSET back.  Returns NULL if it does not fit before OEND.  */
+static u8 *
+put_sequence ( u8 *op, u8 *oend, const u8 *lit, size_t nr_lit, unsigned long offset, size_t match )
+{
+	const size_t ml = ( match != 0 ) ? match - LZ4_MIN_MATCH : 0;
+	u8 *token = op;
+
+	if ( 1 + ( nr_lit / 255 + 1 ) + nr_lit + 2 + ( ml / 255 + 1 ) > oend - op ) {
+		return NULL;
+	}
+
+	op++;
+	*token = ( ( nr_lit < 15 ) ? nr_lit : 15 ) << 4;
+	if ( nr_lit >= 15 ) {
+		op = put_length ( op, nr_lit - 15 );
+	}
+	__memcpy ( op, lit, nr_lit );
+	op += nr_lit;
+
+	if ( match == 0 ) {
+		return op;
+	}
+
+	*op++ = offset & 0xff;
+	*op++ = offset >> 8;
+	*token |= ( ml < 15 ) ? ml : 15;
+	if ( ml >= 15 ) {
+		op = put_length ( op, ml - 15 );
+	}
+	return op;
+}
+
+/* Compress LEN bytes (at most LZ4_WINDOW_SIZE) at SRC into an LZ4 block 
+ * at DEST: greedy matching through a single hash table, which is quick 
+ * rather than thorough.  Returns the compressed size or -1 if it would 
+ * exceed CAP bytes.  */
+long
+lz4_compress_block ( const void *src, size_t len, void *dest, size_t cap )
+{
+	const u8 *const base = src;
+	const u8 *const end  = base + len;
+	const u8 *ip = base, *anchor = base;
+	u8 *op = dest;
+	u8 *const oend = op + cap;
+
+	if ( len > LZ4_WINDOW_SIZE ) {
+		return -1;
+	}
+
+	if ( len > LZ4_MF_LIMIT ) {
+		const u8 *const mflimit    = end - LZ4_MF_LIMIT;
+		const u8 *const matchlimit = end - LZ4_LAST_LITERALS;
+
+		memset ( lz4_hash_table, 0, sizeof ( lz4_hash_table ) );
+
+		while ( ip < mflimit ) {
+			const u32 seq = get_le32 ( ip );
+			const u32 h   = hash4 ( seq );
+			const u8 *ref = base + lz4_hash_table [ h ];
+
+			lz4_hash_table [ h ] = ip - base;
+			if ( ( ref >= ip ) || ( ip - ref > 0xffff ) || ( get_le32 ( ref ) != seq ) ) {
+				ip++;
+				continue;
+			}
+
+			while ( ( ip > anchor ) && ( ref > base ) && ( ip [ -1 ] == ref [ -1 ] ) ) {
+				ip--; ref--;
+			}
+
+			const u8 *mp = ip + LZ4_MIN_MATCH;
+			const u8 *rp = ref + LZ4_MIN_MATCH;
+			while ( ( mp < matchlimit ) && ( *mp == *rp ) ) {
+				mp++; rp++;
+			}
+
+			op = put_sequence ( op, oend, anchor, ip - anchor, ip - ref, mp - ip );
+			if ( op == NULL ) {
+				return -1;
+			}
+			ip = anchor = mp;
+		}
+	}
+
+	op = put_sequence ( op, oend, anchor, end - anchor, 0, 0 );
+	if ( op == NULL ) {
+		return -1;
+	}
+	return op - ( u8 * ) dest;
+}
@@ -0,0 +1,129 @@
+#include "types.h"
+#include "printf.h"
+#include "page.h"
+#include "memacct.h"
+
+
+struct mem_account memacct_host;
+
+static const char *mem_type_names [ NR_MEM_TYPES ] = {
+	[ MEM_GUEST_RAM ] = "guest ram",
+	[ MEM_NPT ]       = "nested page table",
+	[ MEM_VMCB ]      = "vmcb",
+	[ MEM_IOPM ]      = "iopm",
+	[ MEM_MSRPM ]     = "msrpm",
+	[ MEM_DEVICE ]    = "device",
+	[ MEM_VCPU ]      = "vcpu",
+	[ MEM_PROFILE ]   = "profile",
+	[ MEM_SNAPSHOT ]  = "snapshot",
+	[ MEM_ZPOOL ]     = "compressed pool",
+	[ MEM_VMM ]       = "vmm",
+};
+
+/* The account being charged, or NULL for the VMM's own allocations */
+static struct mem_account *current;
+static enum mem_type current_type;
+
+
+void
+memacct_begin ( struct mem_account *acct, enum mem_type type )
+{
+	current      = acct;
+	current_type = type;
+}
+
+/* Change what the following allocations are for */
+void
+memacct_type ( enum mem_type type )
+{
+	current_type = type;
+}
+
+void
+memacct_end ( void )
+{
+	current = NULL;
+}
+
+void
+memacct_charge ( struct mem_account *acct, enum mem_type type, unsigned long bytes )
+{
+	if ( acct != NULL ) {
+		acct->bytes [ type ] += bytes;
+	}
+	memacct_host.bytes [ type ] += bytes;
+}
+
+void
+memacct_allocated ( unsigned long nr_pages )
+{
+	if ( current != NULL ) {
+		memacct_charge ( current, current_type, nr_pages << PAGE_SHIFT );
+	} else {
+		memacct_charge ( NULL, MEM_VMM, nr_pages << PAGE_SHIFT );
+	}
+}
+
+/* Pages allocated under the current account are freed again */
+void
+memacct_unallocated ( unsigned long nr_pages )
+{
+	const enum mem_type type = ( current != NULL ) ? current_type : MEM_VMM;
+
+	if ( current != NULL ) {
+		memacct_release ( current, type, nr_pages << PAGE_SHIFT );
+	}
+	memacct_freed ( type, nr_pages << PAGE_SHIFT );
+}
+
+void
+memacct_release ( struct mem_account *acct, enum mem_type type, unsigned long bytes )
+{
+	acct->bytes [ type ] -= bytes;
+}
+
+void
+memacct_freed ( enum mem_type type, unsigned long bytes )
+{
+	memacct_host.bytes [ type ] -= bytes;
+}
+
+u64
+memacct_total ( const struct mem_account *acct )
+{
+	u64 total = 0;
+	int i;
+
+	for ( i = 0; i < NR_MEM_TYPES; i++ ) {
+		total += acct->bytes [ i ];
+	}
+	return total;
+}
+
+static void
+print_account ( const struct mem_account *acct )
+{
+	int i;
+
+	for ( i = 0; i < NR_MEM_TYPES; i++ ) {
+		if ( acct->bytes [ i ] != 0 ) {
+			printf ( "  %s: bytes=%x\n", mem_type_names [ i ], acct->bytes [ i ] );
+		}
+	}
+}
+
+void
+memacct_print_vm ( const struct mem_account *acct )
+{
+	const u64 total = memacct_total ( acct );
+
+	printf ( "Memory footprint of VM (total=%x, overhead=%x):\n", total, total - acct->bytes [ MEM_GUEST_RAM ] );
+	print_account ( acct );
+}
+
+void
+memacct_print_host ( void )
+{
+	printf ( "Host memory (total=%x):\n", memacct_total ( &memacct_host ) );
+	print_account ( &memacct_host );
+}
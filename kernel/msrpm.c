@@ -0,0 +1,336 @@
+#include "types.h"
+#include "string.h"
+#include "printf.h"
+#include "failure.h"
+#include "page.h"
+#include "msr.h"
+#include "system.h"
+#include "alloc.h"
+#include "cpufeature.h"
+#include "cpu.h"
+#include "vmcb.h"
+#include "vm.h"
+#include "emulate.h"
+#include "msrpm.h"
+#include "memacct.h"
+
+
+/* MSRs which need not exit.  Everything else is intercepted.
+ *
+ * [Note] The segment-base and SYSCALL/SYSENTER MSRs are switched by
+ * VMLOAD/VMSAVE in svm_launch.  TSC_AUX, which RDTSCP and RDPID read
+ * without an exit, holds the running VM's value: guest_msrs_load sets it
+ * at the start of each slice, and writes exit to keep the copy current. */
+struct msr_policy_entry {
+	u32 msr;
+	enum msr_policy policy;
+};
+
+static const struct msr_policy_entry msr_policies [] = {
+	{ MSR_TSC,            MSR_PASSTHROUGH_RO }, /* TSC_OFFSET applies to RDMSR too */
+	{ MSR_SYSENTER_CS,    MSR_PASSTHROUGH },
+	{ MSR_SYSENTER_ESP,   MSR_PASSTHROUGH },
+	{ MSR_SYSENTER_EIP,   MSR_PASSTHROUGH },
+	{ MSR_STAR,           MSR_PASSTHROUGH },
+	{ MSR_LSTAR,          MSR_PASSTHROUGH },
+	{ MSR_CSTAR,          MSR_PASSTHROUGH },
+	{ MSR_SFMASK,         MSR_PASSTHROUGH },
+	{ MSR_FS_BASE,        MSR_PASSTHROUGH },
+	{ MSR_GS_BASE,        MSR_PASSTHROUGH },
+	{ MSR_KERNEL_GS_BASE, MSR_PASSTHROUGH },
+	{ MSR_TSC_AUX,        MSR_PASSTHROUGH_RO },
+};
+
+/* Return the bit offset of MSR in the permission map, or -1 if the MSR 
+ * is out of the ranges covered by the map (such MSRs always exit). */
+static long
+msrpm_offset ( u32 msr )
+{
+	/* [REF] AMD64 manual Vol. 2, p. 455 */
+	const struct { u32 base; unsigned long bit_offset; } ranges [] 
+		= { { 0x00000000, 0x0000 * 8 },
+		    { 0xc0000000, 0x0800 * 8 },
+		    { 0xc0010000, 0x1000 * 8 } };
+	const size_t nelm = sizeof ( ranges ) / sizeof ( ranges [ 0 ] );
+	int i;
+
+	for ( i = 0; i < nelm; i++ ) {
+		if ( ( msr >= ranges [ i ].base ) && ( msr < ranges [ i ].base + 0x2000 ) ) {
+			return ranges [ i ].bit_offset + ( msr - ranges [ i ].base ) * 2;
+		}
+	}
+	return -1;
+}
+
+static void
+msrpm_set_policy ( u8 *msrpm, u32 msr, enum msr_policy policy )
+{
+	const long off = msrpm_offset ( msr );
+	u8 *p;
+
+	if ( off < 0 ) {
+		fatal_failure ( "MSR out of the permission map.\n" );
+	}
+
+	p = &msrpm [ off >> 3 ];
+	*p |= 3 << ( off & 7 ); /* intercept read (even bit) and write (odd bit) */
+
+	switch ( policy ) {
+	case MSR_PASSTHROUGH:    *p &= ~( 3 << ( off & 7 ) ); break;
+	case MSR_PASSTHROUGH_RO: *p &= ~( 1 << ( off & 7 ) ); break;
+	case MSR_INTERCEPT:      break;
+	}
+}
+
+/* Create the MSR permission map of a VM and return its physical address. */
+unsigned long
+msrpm_create ( void )
+{
+	const size_t nelm = sizeof ( msr_policies ) / sizeof ( struct msr_policy_entry );
+	u8 *msrpm;
+	unsigned long pfn;
+	int i;
+
+	memacct_type ( MEM_MSRPM );
+	pfn   = alloc_pages ( MSRPM_SIZE >> PAGE_SHIFT, 1 );
+	msrpm = ( u8 * ) VIRT ( pfn << PAGE_SHIFT );
+
+	/* Intercept everything by default (vol. 2, p. 445) */
+	memset ( msrpm, 0xff, MSRPM_SIZE );
+
+	for ( i = 0; i < nelm; i++ ) {
+		msrpm_set_policy ( msrpm, msr_policies [ i ].msr, msr_policies [ i ].policy );
+	}
+
+	return pfn << PAGE_SHIFT;
+}
+
+void
+guest_msrs_init ( struct guest_msrs *msrs )
+{
+	msrs->apic_base     = APIC_DEFAULT_BASE | APIC_BASE_BSP | APIC_BASE_ENABLE;
+	msrs->mtrr_def_type = 0;
+	msrs->mcg_status    = 0;
+	msrs->tsc_aux       = 0;
+}
+
+/* Put the guest's values into the MSRs it reads directly but other VMs 
+ * may have changed */
+void
+guest_msrs_load ( const struct vm *vm )
+{
+	if ( cpu_has_rdtscp ) {
+		wrmsr ( MSR_TSC_AUX, ( u32 ) vm->msrs.tsc_aux, 0 );
+	}
+}
+
+/******************************************************/
+
+static int
+rdmsr_tsc ( struct vm *vm, u64 *val )
+{
+	unsigned long tsc;
+	rdtscll ( tsc );
+	*val = tsc + vm->vmcb->tsc_offset;
+	return 0;
+}
+
+static int
+wrmsr_tsc ( struct vm *vm, u64 val )
+{
+	unsigned long tsc;
+	rdtscll ( tsc );
+	vm->vmcb->tsc_offset = val - tsc;
+	return 0;
+}
+
+static int
+rdmsr_apic_base ( struct vm *vm, u64 *val )
+{
+	*val = vm->msrs.apic_base;
+	return 0;
+}
+
+static int
+wrmsr_apic_base ( struct vm *vm, u64 val )
+{
+	vm->msrs.apic_base = val;
+	return 0;
+}
+
+static int
+rdmsr_zero ( struct vm *vm, u64 *val )
+{
+	*val = 0;
+	return 0;
+}
+
+static int
+wrmsr_ignore ( struct vm *vm, u64 val )
+{
+	return 0;
+}
+
+static int
+rdmsr_mcg_status ( struct vm *vm, u64 *val )
+{
+	*val = vm->msrs.mcg_status;
+	return 0;
+}
+
+static int
+wrmsr_mcg_status ( struct vm *vm, u64 val )
+{
+	vm->msrs.mcg_status = val;
+	return 0;
+}
+
+static int
+rdmsr_pat ( struct vm *vm, u64 *val )
+{
+	*val = vm->vmcb->g_pat;
+	return 0;
+}
+
+static int
+wrmsr_pat ( struct vm *vm, u64 val )
+{
+	if ( ! vmcb_pat_is_valid ( val ) ) {
+		return -1;
+	}
+	vm->vmcb->g_pat = val;
+	return 0;
+}
+
+static int
+rdmsr_mtrr_def_type ( struct vm *vm, u64 *val )
+{
+	*val = vm->msrs.mtrr_def_type;
+	return 0;
+}
+
+static int
+wrmsr_mtrr_def_type ( struct vm *vm, u64 val )
+{
+	vm->msrs.mtrr_def_type = val;
+	return 0;
+}
+
+static int
+rdmsr_efer ( struct vm *vm, u64 *val )
+{
+	/* Hide SVME from the guest */
+	*val = vm->vmcb->efer & ~EFER_SVME;
+	return 0;
+}
+
+static int
+wrmsr_efer ( struct vm *vm, u64 val )
+{
+	struct vmcb *vmcb = vm->vmcb;
+
+	/* Reserved bits, or LME changed with paging on, are #GP */
+	if ( ( ! vmcb_efer_is_valid ( val ) ) || 
+	     ( ( ( val ^ vmcb->efer ) & EFER_LME ) && ( vmcb->cr0 & X86_CR0_PG ) ) ) {
+		return -1;
+	}
+
+	/* EFER.SVME must stay set while the guest runs (vol. 2, p. 444) */
+	vmcb->efer = val | EFER_SVME;
+	return 0;
+}
+
+static int
+rdmsr_tsc_aux ( struct vm *vm, u64 *val )
+{
+	*val = vm->msrs.tsc_aux;
+	return 0;
+}
+
+static int
+wrmsr_tsc_aux ( struct vm *vm, u64 val )
+{
+	/* Bits 63:32 are reserved */
+	if ( ( ! cpu_has_rdtscp ) || ( ( val >> 32 ) != 0 ) ) {
+		return -1;
+	}
+	vm->msrs.tsc_aux = val;
+	guest_msrs_load ( vm );
+	return 0;
+}
+
+/* Handlers of the intercepted MSRs.  A NULL handler raises #GP.
+ * [Note] The table must be sorted by MSR (looked up by binary search). */
+struct msr_handler {
+	u32 msr;
+	int ( *read ) ( struct vm *vm, u64 *val );
+	int ( *write ) ( struct vm *vm, u64 val );
+};
+
+static const struct msr_handler msr_handlers [] = {
+	{ MSR_TSC,           rdmsr_tsc,           wrmsr_tsc },
+	{ MSR_APIC_BASE,     rdmsr_apic_base,     wrmsr_apic_base },
+	{ MSR_MTRR_CAP,      rdmsr_zero,          NULL },
+	{ MSR_MCG_CAP,       rdmsr_zero,          NULL },
+	{ MSR_MCG_STATUS,    rdmsr_mcg_status,    wrmsr_mcg_status },
+	{ MSR_MCG_CTL,       rdmsr_zero,          wrmsr_ignore },
+	{ MSR_PAT,           rdmsr_pat,           wrmsr_pat },
+	{ MSR_MTRR_DEF_TYPE, rdmsr_mtrr_def_type, wrmsr_mtrr_def_type },
+	{ MSR_EFER,          rdmsr_efer,          wrmsr_efer },
+	{ MSR_TSC_AUX,       rdmsr_tsc_aux,       wrmsr_tsc_aux },
+	{ MSR_K7_HWCR,       rdmsr_zero,          wrmsr_ignore },
+};
+
+static const struct msr_handler *
+lookup_msr_handler ( u32 msr )
+{
+	int lo = 0;
+	int hi = sizeof ( msr_handlers ) / sizeof ( struct msr_handler ) - 1;
+
+	while ( lo <= hi ) {
+		const int mid = ( lo + hi ) / 2;
+		const u32 x = msr_handlers [ mid ].msr;
+
+		if ( x == msr ) {
+			return &msr_handlers [ mid ];
+		}
+		if ( x < msr ) { lo = mid + 1; } else { hi = mid - 1; }
+	}
+	return NULL;
+}
+
+/* [REF] AMD64 manual Vol. 2, p. 455 (EXITINFO1: 0 = RDMSR, 1 = WRMSR) */
+int
+handle_msr ( struct vm *vm )
+{
+	struct vmcb *vmcb = vm->vmcb;
+	struct vcpu_regs *regs = &vm->regs;
+	const u32 msr = ( u32 ) regs->rcx;
+	const int is_write = ( vmcb->exitinfo1 & 1 );
+	const struct msr_handler *h = lookup_msr_handler ( msr );
+	int ret = -1;
+
+	if ( is_write ) {
+		const u64 val = ( ( regs->rdx & 0xffffffffUL ) << 32 ) | ( vmcb->rax & 0xffffffffUL );
+		if ( ( h != NULL ) && ( h->write != NULL ) ) {
+			ret = ( *h->write ) ( vm, val );
+		}
+	} else {
+		u64 val = 0;
+		if ( ( h != NULL ) && ( h->read != NULL ) ) {
+			ret = ( *h->read ) ( vm, &val );
+		}
+		if ( ret == 0 ) {
+			vmcb->rax = val & 0xffffffffUL;
+			regs->rdx = val >> 32;
+		}
+	}
+
+	if ( ret != 0 ) {
+		vmcb_inject_exception ( vmcb, 13 /* #GP */, 1, 0 );
+		return 0;
+	}
+
+	skip_instruction ( vm );
+	return 0;
+}
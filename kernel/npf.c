@@ -0,0 +1,49 @@
+#include "types.h"
+#include "printf.h"
+#include "vmcb.h"
+#include "vm.h"
+#include "emulate.h"
+#include "snapshot.h"
+#include "zpool.h"
+#include "balloon.h"
+#include "npf.h"
+
+
+/* [REF] AMD64 manual Vol. 2, p. 490.  EXITINFO2 holds the faulting
+ * guest-physical address. */
+int
+handle_npf ( struct vm *vm )
+{
+	struct vmcb *vmcb = vm->vmcb;
+	const u64 gpa = vmcb->exitinfo2;
+
+	/* Guest RAM not yet brought back by a lazy restore: retry the access */
+	if ( snapshot_fault ( vm, gpa ) == 0 ) {
+		return 0;
+	}
+
+	/* A cold page that was compressed: decompress it and retry */
+	if ( zpool_fault ( vm, gpa ) == 0 ) {
+		return 0;
+	}
+
+	/* A page reported to the balloon and now reused */
+	if ( balloon_fault ( vm, gpa ) == 0 ) {
+		return 0;
+	}
+
+	/* A store to a read-only guest image page (e.g., code patching) */
+	if ( ( vmcb->exitinfo1 & NPF_WRITE ) && ( vm_unshare_page ( vm, gpa ) == 0 ) ) {
+		return 0;
+	}
+
+	/* Guest-physical addresses above the guest memory are an empty MMIO
+	 * hole: reads leave the destination unchanged and writes are dropped. */
+	if ( ( gpa >= vm->pmem_size ) && ! ( vmcb->exitinfo1 & NPF_FETCH ) ) {
+		skip_instruction ( vm );
+		return 0;
+	}
+
+	printf ( "Nested page fault: gpa=%x, error_code=%x, rip=%x\n", gpa, vmcb->exitinfo1, vmcb->rip );
+	return -1;
+}
@@ -3,6 +3,10 @@
 #include "printf.h"
 #include "page.h"
 #include "alloc.h"
+#include "trace.h"
+#include "bootprof.h"
+#include "pmu.h"
+#include "memacct.h"
 
 static unsigned long 
 pg_table_create ( void )
@@ -10,8 +14,10 @@ pg_table_create ( void )
 	const unsigned long pfn   = alloc_pages ( 1, 1 );
 	const unsigned long paddr = pfn << PAGE_SHIFT;
 
-	memset ( ( char * ) VIRT ( paddr ), 0, PAGE_SIZE );
+	clear_page ( VIRT ( paddr ) );
 
+	TRACE ( TRACE_PGTABLE_ALLOC, 0, paddr, 0 );
+	bootprof_zeroed ( 1 );
 	return paddr;
 }
 
@@ -21,20 +27,49 @@ pml4_table_create ( void )
 	return pg_table_create ( );
 }
 
+/* A table no longer referenced, credited to the account it was charged to 
+ * (the current one).  [Note] Every VMRUN flushes the TLB, so no cached 
+ * translation refers to it afterwards.  */
+static void
+pg_table_free ( void *arg, unsigned long pfn )
+{
+	clear_page ( VIRT ( PFN_PHYS ( pfn ) ) );
+	free_pages ( pfn, 1 );
+	memacct_unallocated ( 1 );
+}
+
+static unsigned long __pg_table_destroy ( unsigned long pg_table_base_vaddr, enum pg_table_level level, 
+					  pgt_release_t release, void *arg );
+
 static unsigned long 
-get_index ( unsigned long vaddr, enum pg_table_level level )
+get_shift ( enum pg_table_level level )
 {
 	unsigned long shift = 0;
-	const unsigned long MASK = ( ( 1 << 9 ) - 1 );
 
 	switch ( level ) {
 	case PGT_LEVEL_PML4: shift = 39; break;
-	case PGT_LEVEL_PDP:  shift = 30; break;
-	case PGT_LEVEL_PD:   shift = 21; break;
+	case PGT_LEVEL_PDP:  shift = PAGE_SHIFT_1GB; break;
+	case PGT_LEVEL_PD:   shift = PAGE_SHIFT_2MB; break;
+	case PGT_LEVEL_PT:   shift = PAGE_SHIFT; break;
 	default:             fatal_failure ( "wrong level\n" ); break;
 	}
 
-	return ( vaddr >> shift ) & MASK;
+	return shift;
+}
+
+/* Bytes mapped by a leaf entry at LEVEL */
+unsigned long
+pgt_level_page_size ( enum pg_table_level level )
+{
+	return 1UL << get_shift ( level );
+}
+
+static unsigned long 
+get_index ( unsigned long vaddr, enum pg_table_level level )
+{
+	const unsigned long MASK = ( ( 1 << 9 ) - 1 );
+
+	return ( vaddr >> get_shift ( level ) ) & MASK;
 }
 
 static union pgt_entry *
@@ -50,24 +85,62 @@ entry_is_present ( const union pgt_entry *x )
 	return x->term.flags & PTTEF_PRESENT;
 }
 
-/* [Note] paging with compatibility-mode (long mode with 2-Mbyte page tranlation) is only supported.  */
+/* Does the entry at LEVEL map a page rather than point to a table? */
+static int 
+entry_is_leaf ( const union pgt_entry *x, enum pg_table_level level )
+{
+	return ( level == PGT_LEVEL_PT ) || ( x->raw & PTTEF_PAGE_SIZE );
+}
+
+/* Turn the large page mapped by E at LEVEL into a table of pages one level 
+ * down that map the same range with the same flags.  */
 static void
-__mmap ( unsigned long pg_table_base_vaddr, unsigned long vaddr, unsigned long paddr, enum pg_table_level level, int is_user )
+split_large_page ( union pgt_entry *e, enum pg_table_level level )
+{
+	const unsigned long table = pg_table_create ( );
+	const unsigned long size  = pgt_level_page_size ( level - 1 );
+	const unsigned long base  = e->raw & PGT_ENTRY_ADDR_MASK & ~ ( pgt_level_page_size ( level ) - 1 );
+	const unsigned long flags = ( e->raw & ( PTTEF_PRESENT | PTTEF_RW | PTTEF_US ) ) | 
+		( ( level - 1 != PGT_LEVEL_PT ) ? PTTEF_PAGE_SIZE : 0 );
+	union pgt_entry *t = ( union pgt_entry * ) VIRT ( table );
+	int i;
+
+	for ( i = 0; i < 512; i++ ) {
+		t [ i ].raw = ( base + i * size ) | flags;
+	}
+
+	e->non_term.base  = table >> PAGE_SHIFT;
+	e->non_term.flags = PTTEF_PRESENT | PTTEF_RW | PTTEF_US;
+}
+
+/* [Note] long mode paging with 4-Kbyte, 2-Mbyte and 1-Gbyte pages.  LEAF is 
+ * the level of the entry that maps the page.  A larger page already 
+ * covering VADDR is split; tables below an entry that now maps a page are 
+ * freed.  */
+static void
+__mmap ( unsigned long pg_table_base_vaddr, unsigned long vaddr, unsigned long paddr, 
+	 enum pg_table_level level, enum pg_table_level leaf, unsigned long flags )
 {
 //	printf ( "__mmap: level=%x, vaddr=%x, paddr=%x.\n", level, vaddr, paddr );
 
 	union pgt_entry *e = get_entry ( pg_table_base_vaddr, vaddr, level );
 
-	if ( level == PGT_LEVEL_PD ) {
-		/* For page directory entry */
+	if ( level == leaf ) {
+		TRACE ( TRACE_MMAP, level, vaddr, paddr );
 
-		e->term.base = paddr >> PAGE_SHIFT_2MB;
-		e->term.flags = PTTEF_PRESENT | PTTEF_RW | PTTEF_PAGE_SIZE;
-		if ( is_user ) { e->term.flags |= PTTEF_US; }
+		if ( entry_is_present ( e ) && ! entry_is_leaf ( e, level ) ) {
+			__pg_table_destroy ( ( unsigned long ) VIRT ( e->non_term.base << PAGE_SHIFT ), level - 1, pg_table_free, NULL );
+		}
+		e->raw = ( paddr & PGT_ENTRY_ADDR_MASK ) | PTTEF_PRESENT | ( flags & ( PTTEF_RW | PTTEF_US ) );
+		if ( level != PGT_LEVEL_PT ) { e->raw |= PTTEF_PAGE_SIZE; }
 		return;
 	}
 
-	/* For page-map level-4 entry and page-directory-pointer entry */
+	/* For an entry that points to the next level table */
+
+	if ( entry_is_present ( e ) && entry_is_leaf ( e, level ) ) {
+		split_large_page ( e, level );
+	}
 
 	if ( ! entry_is_present ( e ) ) {
 		const unsigned long paddr = pg_table_create ( );
@@ -77,45 +150,194 @@ __mmap ( unsigned long pg_table_base_vaddr, unsigned long vaddr, unsigned long p
 
 	// pg_table_base ǻꤵ줿ɥ쥹顤Υ٥ΥڡĴ٤
 	const unsigned long next_table_base_vaddr = ( unsigned long ) VIRT ( e->non_term.base << PAGE_SHIFT );
-	__mmap ( next_table_base_vaddr, vaddr, paddr, level - 1, is_user ); 
+	__mmap ( next_table_base_vaddr, vaddr, paddr, level - 1, leaf, flags ); 
 }
 
+/* Map a page whose size is given by the level of its entry: PGT_LEVEL_PDP 
+ * (1 Gbyte), PGT_LEVEL_PD (2 Mbytes) or PGT_LEVEL_PT (4 Kbytes).  FLAGS 
+ * may hold PTTEF_RW and PTTEF_US.  */
+void
+mmap_page ( unsigned long pml4_table_base_vaddr, unsigned long vaddr, unsigned long paddr, enum pg_table_level leaf, unsigned long flags )
+{
+	struct pmu_snapshot pmu;
+
+	PMU_BEGIN ( &pmu );
+	__mmap ( pml4_table_base_vaddr, vaddr, paddr, PGT_LEVEL_PML4, leaf, flags );
+	PMU_END ( PMU_REGION_PGTABLE, &pmu );
+}
+
+/* Map a 2-Mbyte page */
 void
 mmap ( unsigned long pml4_table_base_vaddr, unsigned long vaddr, unsigned long paddr, int is_user )
 {
-	__mmap ( pml4_table_base_vaddr, vaddr, paddr, PGT_LEVEL_PML4, is_user );
+	mmap_page ( pml4_table_base_vaddr, vaddr, paddr, PGT_LEVEL_PD, PTTEF_RW | ( is_user ? PTTEF_US : 0 ) );
+}
+
+/******************************************************/
+
+/* Remove the mappings of [VADDR, END).  Pages that straddle either end 
+ * are split first; a page table whose whole range goes is cleared but 
+ * kept for later mappings.  */
+static void
+__munmap ( unsigned long pg_table_base_vaddr, unsigned long vaddr, unsigned long end, enum pg_table_level level )
+{
+	const unsigned long size = pgt_level_page_size ( level );
+
+	while ( vaddr < end ) {
+		union pgt_entry *e = get_entry ( pg_table_base_vaddr, vaddr, level );
+		const unsigned long next = ( vaddr & ~ ( size - 1 ) ) + size;
+		const unsigned long stop = ( next < end ) ? next : end;
+		const int whole = ( ( vaddr & ( size - 1 ) ) == 0 ) && ( stop == next );
+
+		if ( entry_is_present ( e ) ) {
+			if ( whole && entry_is_leaf ( e, level ) ) {
+				e->raw = 0;
+			} else {
+				if ( entry_is_leaf ( e, level ) ) {
+					split_large_page ( e, level );
+				}
+
+				const unsigned long next_table_base_vaddr = ( unsigned long ) VIRT ( e->non_term.base << PAGE_SHIFT );
+				if ( whole && ( level - 1 == PGT_LEVEL_PT ) ) {
+					clear_page ( ( void * ) next_table_base_vaddr );
+				} else {
+					__munmap ( next_table_base_vaddr, vaddr, stop, level - 1 );
+				}
+			}
+		}
+		vaddr = stop;
+	}
+}
+
+void
+munmap_range ( unsigned long pml4_table_base_vaddr, unsigned long vaddr, unsigned long size )
+{
+	__munmap ( pml4_table_base_vaddr, vaddr, vaddr + size, PGT_LEVEL_PML4 );
+}
+
+/* Has the processor set the accessed bit of any page in [VADDR, END)?  
+ * The bits are cleared.  */
+static int
+__test_and_clear_accessed ( unsigned long pg_table_base_vaddr, unsigned long vaddr, unsigned long end, enum pg_table_level level )
+{
+	const unsigned long size = pgt_level_page_size ( level );
+	int accessed = 0;
+
+	while ( vaddr < end ) {
+		union pgt_entry *e = get_entry ( pg_table_base_vaddr, vaddr, level );
+		const unsigned long next = ( vaddr & ~ ( size - 1 ) ) + size;
+		const unsigned long stop = ( next < end ) ? next : end;
+
+		if ( entry_is_present ( e ) ) {
+			if ( entry_is_leaf ( e, level ) ) {
+				accessed |= !! ( e->raw & PTTEF_ACCESSED );
+				e->raw &= ~ ( u64 ) PTTEF_ACCESSED;
+			} else {
+				const unsigned long next_table_base_vaddr = ( unsigned long ) VIRT ( e->non_term.base << PAGE_SHIFT );
+				accessed |= __test_and_clear_accessed ( next_table_base_vaddr, vaddr, stop, level - 1 );
+			}
+		}
+		vaddr = stop;
+	}
+	return accessed;
+}
+
+int
+pgt_test_and_clear_accessed ( unsigned long pml4_table_base_vaddr, unsigned long vaddr, unsigned long size )
+{
+	return __test_and_clear_accessed ( pml4_table_base_vaddr, vaddr, vaddr + size, PGT_LEVEL_PML4 );
 }
 
 /******************************************************/
 
 static unsigned long
-__vaddr_to_paddr ( unsigned long pg_table_base_vaddr, unsigned long vaddr, enum pg_table_level level )
+__pg_table_destroy ( unsigned long pg_table_base_vaddr, enum pg_table_level level, pgt_release_t release, void *arg )
+{
+	unsigned long n = 1;
+	int i;
+
+	for ( i = 0; ( level > PGT_LEVEL_PT ) && ( i < 512 ); i++ ) {
+		union pgt_entry *e = ( union pgt_entry * ) ( pg_table_base_vaddr + i * sizeof ( union pgt_entry ) );
+
+		if ( entry_is_present ( e ) && ! entry_is_leaf ( e, level ) ) {
+			const unsigned long next_table_base_vaddr = ( unsigned long ) VIRT ( e->non_term.base << PAGE_SHIFT );
+			n += __pg_table_destroy ( next_table_base_vaddr, level - 1, release, arg );
+		}
+	}
+
+	release ( arg, PFN_DOWN ( PHYS ( pg_table_base_vaddr ) ) );
+	return n;
+}
+
+/* Hand the tables of the page table at PML4 to RELEASE, lower levels 
+ * first; the pages they map are left alone.  Return how many there were.  */
+unsigned long
+pml4_table_destroy ( unsigned long pml4_table_base_vaddr, pgt_release_t release, void *arg )
+{
+	return __pg_table_destroy ( pml4_table_base_vaddr, PGT_LEVEL_PML4, release, arg );
+}
+
+/******************************************************/
+
+/* Return 0 with the translation of VADDR in *PADDR, or -1 if it is not mapped.
+ * PAGE_SIZE and FLAGS (those of the leaf entry) may be NULL.  */
+static int
+__pgt_lookup ( unsigned long pg_table_base_vaddr, unsigned long vaddr, enum pg_table_level level, 
+	       unsigned long *paddr, unsigned long *page_size, unsigned long *flags )
 {
 	union pgt_entry *e = get_entry ( pg_table_base_vaddr, vaddr, level );
 
 	if ( ! entry_is_present ( e ) ) {
-		fatal_failure ( "Page table entry is not present.\n" );
+		return -1;
 	}
 
-	if ( level == PGT_LEVEL_PD ) {
-
-		/* For page directory entry */
+	if ( entry_is_leaf ( e, level ) ) {
+		const unsigned long offset_mask = pgt_level_page_size ( level ) - 1;
 
-		if ( ! ( e->term.flags & PTTEF_PAGE_SIZE ) ) {
-			fatal_failure ( "Not 2 Mbyte page size.\n" );
+		if ( page_size != NULL ) {
+			*page_size = offset_mask + 1;
 		}
-
-		return ( ( e->term.base << PAGE_SHIFT_2MB ) + ( vaddr & ( ( 1 << PAGE_SHIFT_2MB ) - 1 ) ) );
+		if ( flags != NULL ) {
+			*flags = e->raw & ~PGT_ENTRY_ADDR_MASK;
+		}
+		*paddr = ( e->raw & PGT_ENTRY_ADDR_MASK & ~offset_mask ) + ( vaddr & offset_mask );
+		return 0;
 	}
 
 	const unsigned long next_table_base_vaddr = ( unsigned long ) VIRT ( e->non_term.base << PAGE_SHIFT );
-	return __vaddr_to_paddr ( next_table_base_vaddr, vaddr, level - 1 ); 
+	return __pgt_lookup ( next_table_base_vaddr, vaddr, level - 1, paddr, page_size, flags ); 
+}
+
+static unsigned long
+__vaddr_to_paddr ( unsigned long pg_table_base_vaddr, unsigned long vaddr, enum pg_table_level level, unsigned long *page_size )
+{
+	unsigned long paddr;
+
+	if ( __pgt_lookup ( pg_table_base_vaddr, vaddr, level, &paddr, page_size, NULL ) != 0 ) {
+		fatal_failure ( "Page table entry is not present.\n" );
+	}
+	return paddr;
+}
+
+/* For addresses that may not be mapped (e.g., chosen by a guest).  FLAGS 
+ * (PTTEF_*) may be NULL.  */
+int
+pgt_lookup ( unsigned long pml4_table_base_vaddr, unsigned long vaddr, unsigned long *paddr, unsigned long *flags )
+{
+	return __pgt_lookup ( pml4_table_base_vaddr, vaddr, PGT_LEVEL_PML4, paddr, NULL, flags );
 }
 
 unsigned long 
 vaddr_to_paddr ( unsigned long pml4_table_base_vaddr, unsigned long vaddr )
 {
-	return __vaddr_to_paddr ( pml4_table_base_vaddr, vaddr, PGT_LEVEL_PML4 );
+	return __vaddr_to_paddr ( pml4_table_base_vaddr, vaddr, PGT_LEVEL_PML4, NULL );
+}
+
+/* Also return the size of the page that maps VADDR */
+unsigned long 
+vaddr_to_paddr_page ( unsigned long pml4_table_base_vaddr, unsigned long vaddr, unsigned long *page_size )
+{
+	return __vaddr_to_paddr ( pml4_table_base_vaddr, vaddr, PGT_LEVEL_PML4, page_size );
 }
 
 /******************************************************/
@@ -132,9 +354,9 @@ __print_pg_table ( unsigned long pg_table_base_vaddr, enum pg_table_level level
 			continue;
 		}
 
-		if ( level == PGT_LEVEL_PD ) {
-			printf ( "level=%x, index=%x, base=%x, flags=%x\n" ,
-				 level, i, e->term.base, e->term.flags );
+		if ( entry_is_leaf ( e, level ) ) {
+			printf ( "level=%x, index=%x, paddr=%x, flags=%x\n" ,
+				 level, i, e->raw & PGT_ENTRY_ADDR_MASK, e->raw & 0xfff );
 		} else {
 			printf ( "level=%x, index=%x, base=%x, flags=%x\n" ,
 				 level, i, e->non_term.base, e->non_term.flags );
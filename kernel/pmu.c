@@ -0,0 +1,120 @@
+#include "types.h"
+#include "string.h"
+#include "printf.h"
+#include "msr.h"
+#include "pmu.h"
+
+
+/* PerfEvtSel fields */
+#define EVNTSEL_OS		( 1UL << 17 )
+#define EVNTSEL_EN		( 1UL << 22 )
+#define EVNTSEL_HOST_ONLY	( 1UL << 41 )
+
+struct pmu_event {
+	const char *name;
+	u64 event_select; /* event and unit mask */
+};
+
+static const struct pmu_event pmu_events [ PMU_NR_COUNTERS ] = {
+	{ "insns",        0x00c0 }, /* Retired instructions */
+	{ "dc_misses",    0x0041 }, /* Data cache misses */
+	{ "dtlb_misses",  0x0746 }, /* L1 and L2 DTLB misses */
+	{ "br_mispred",   0x00c3 }, /* Retired mispredicted branches */
+};
+
+static const char *pmu_region_names [ PMU_REGION_HANDLER ] = {
+	[ PMU_REGION_DISPATCH ] = "dispatch",
+	[ PMU_REGION_ALLOC ]    = "alloc",
+	[ PMU_REGION_PGTABLE ]  = "pgtable",
+};
+
+int pmu_enabled;
+
+static struct pmu_region_stats pmu_stats [ NR_PMU_REGIONS ];
+
+
+void
+pmu_init ( int enable )
+{
+	int i;
+
+	memset ( pmu_stats, 0, sizeof ( pmu_stats ) );
+
+	if ( ! enable ) {
+		pmu_enabled = 0;
+		return;
+	}
+
+	for ( i = 0; i < PMU_NR_COUNTERS; i++ ) {
+		const u64 sel = pmu_events [ i ].event_select | EVNTSEL_OS | EVNTSEL_EN | EVNTSEL_HOST_ONLY;
+
+		wrmsr ( MSR_K7_EVNTSEL0 + i, 0, 0 );
+		wrmsr ( MSR_K7_PERFCTR0 + i, 0, 0 );
+		wrmsr ( MSR_K7_EVNTSEL0 + i, ( u32 ) sel, ( u32 ) ( sel >> 32 ) );
+	}
+
+	pmu_enabled = 1;
+	printf ( "Performance counters enabled for VMM self-profiling.\n" );
+}
+
+void
+pmu_read ( struct pmu_snapshot *s )
+{
+	int i;
+
+	for ( i = 0; i < PMU_NR_COUNTERS; i++ ) {
+		rdpmcll ( i, s->count [ i ] );
+	}
+}
+
+void
+pmu_account ( enum pmu_region region, const struct pmu_snapshot *start )
+{
+	struct pmu_region_stats *r = &pmu_stats [ region ];
+	struct pmu_snapshot now;
+	int i;
+
+	pmu_read ( &now );
+
+	r->calls++;
+	for ( i = 0; i < PMU_NR_COUNTERS; i++ ) {
+		/* The counters are 48 bits wide */
+		r->count [ i ] += ( now.count [ i ] - start->count [ i ] ) & ( ( 1UL << 48 ) - 1 );
+	}
+}
+
+static void
+print_region ( int region )
+{
+	const struct pmu_region_stats *r = &pmu_stats [ region ];
+	int i;
+
+	if ( region < PMU_REGION_HANDLER ) {
+		printf ( "  %s:", pmu_region_names [ region ] );
+	} else {
+		printf ( "  handler %x:", ( unsigned long ) ( region - PMU_REGION_HANDLER ) );
+	}
+
+	printf ( " calls=%x", r->calls );
+	for ( i = 0; i < PMU_NR_COUNTERS; i++ ) {
+		printf ( ", %s=%x", pmu_events [ i ].name, r->count [ i ] );
+	}
+	printf ( "\n" );
+}
+
+void
+pmu_dump ( void )
+{
+	int i;
+
+	if ( ! pmu_enabled ) {
+		return;
+	}
+
+	printf ( "VMM performance counters:\n" );
+	for ( i = 0; i < NR_PMU_REGIONS; i++ ) {
+		if ( pmu_stats [ i ].calls > 0 ) {
+			print_region ( i );
+		}
+	}
+}
@@ -18,6 +18,9 @@ struct screen_info {
 };
 static struct screen_info scr_info;
 
+/* Another console (e.g. a serial port) which receives everything written to VGA */
+void ( *console_hook ) ( const char *s );
+
 static void 
 scroll( void )
 {
@@ -35,6 +38,10 @@ putstr ( const char *s )
 	int x, y;
 	char c;
 
+	if ( console_hook != NULL ) {
+		( *console_hook ) ( s );
+	}
+
 	x = scr_info.orig_x;
 	y = scr_info.orig_y;
 
@@ -163,6 +170,19 @@ vsnprintf ( char *buf, size_t size, const char *fmt, va_list args )
 	return j;
 }
 
+int
+snprintf ( char *buf, size_t size, const char *fmt, ... )
+{
+	va_list args;
+	int len;
+
+	va_start ( args, fmt );
+	len = vsnprintf ( buf, size, fmt, args );
+	va_end ( args );
+
+	return len;
+}
+
 void
 printf ( const char *fmt, ... )
 {
@@ -0,0 +1,142 @@
+#include "types.h"
+#include "string.h"
+#include "printf.h"
+#include "page.h"
+#include "alloc.h"
+#include "vmcb.h"
+#include "vm.h"
+#include "apic.h"
+#include "profile.h"
+#include "memacct.h"
+#include "reclaim.h"
+
+
+enum { PROF_TOP = 8 }; /* hot spots printed by profile_dump */
+
+#define PROF_BUFFER_SIZE ( sizeof ( struct prof_buffer ) + PROF_NR_SAMPLES * sizeof ( struct prof_sample ) )
+
+void
+profile_init ( struct vm *vm, u32 period )
+{
+	struct vm_profile *prof = &vm->profile;
+	const unsigned long size = PROF_BUFFER_SIZE;
+	unsigned long pfn;
+
+	prof->period = period;
+	prof->buf    = NULL;
+
+	if ( period == 0 ) {
+		return;
+	}
+
+	memacct_begin ( &vm->mem, MEM_PROFILE );
+	pfn = alloc_pages ( PFN_UP ( size ), 1 );
+	memacct_end ( );
+
+	prof->buf = ( struct prof_buffer * ) VIRT ( pfn << PAGE_SHIFT );
+	memset ( prof->buf, 0, sizeof ( struct prof_buffer ) );
+	prof->buf->magic      = PROF_MAGIC;
+	prof->buf->nr_samples = PROF_NR_SAMPLES;
+
+	printf ( "Guest profiler: period=%x, buffer paddr=%x, size=%x\n", ( unsigned long ) period, pfn << PAGE_SHIFT, size );
+}
+
+void
+profile_destroy ( struct vm *vm )
+{
+	struct vm_profile *prof = &vm->profile;
+
+	if ( prof->buf != NULL ) {
+		reclaim_pages ( &vm->mem, MEM_PROFILE, PFN_DOWN ( PHYS ( prof->buf ) ), PFN_UP ( PROF_BUFFER_SIZE ) );
+		prof->buf = NULL;
+	}
+}
+
+void
+profile_start ( struct vm *vm )
+{
+	if ( vm->profile.buf != NULL ) {
+		lapic_timer_start ( vm->profile.period );
+	}
+}
+
+void
+profile_stop ( struct vm *vm )
+{
+	if ( vm->profile.buf != NULL ) {
+		lapic_timer_stop ( );
+	}
+}
+
+/* Called on #VMEXIT(INTR) caused by the profiling timer */
+void
+profile_sample ( struct vm *vm )
+{
+	struct prof_buffer *buf = vm->profile.buf;
+	const struct vmcb *vmcb = vm->vmcb;
+	struct prof_sample *s;
+
+	if ( buf == NULL ) {
+		return;
+	}
+
+	s = &buf->samples [ buf->head % buf->nr_samples ];
+	s->rip = vmcb->rip;
+	s->cr3 = vmcb->cr3;
+	s->cpl = vmcb->cpl;
+	buf->head++;
+}
+
+/* Print the most frequent RIPs.  The whole buffer can be saved from the 
+ * physical address printed by profile_init for tools/profsym. */
+void
+profile_dump ( const struct vm *vm )
+{
+	const struct prof_buffer *buf = vm->profile.buf;
+	u64 top_rip [ PROF_TOP ], top_count [ PROF_TOP ];
+	unsigned long nr, i, j, k;
+
+	if ( buf == NULL ) {
+		return;
+	}
+
+	nr = ( buf->head < buf->nr_samples ) ? buf->head : buf->nr_samples;
+	memset ( top_count, 0, sizeof ( top_count ) );
+	memset ( top_rip, 0, sizeof ( top_rip ) );
+
+	/* Quadratic, but only run once when the guest stops */
+	for ( i = 0; i < nr; i++ ) {
+		const u64 rip = buf->samples [ i ].rip;
+		u64 count = 0;
+
+		for ( j = 0; j < i; j++ ) {
+			if ( buf->samples [ j ].rip == rip ) {
+				break;
+			}
+		}
+		if ( j < i ) {
+			continue; /* already counted */
+		}
+
+		for ( j = i; j < nr; j++ ) {
+			count += ( buf->samples [ j ].rip == rip );
+		}
+
+		for ( k = 0; k < PROF_TOP && top_count [ k ] >= count; k++ )
+			;
+		if ( k == PROF_TOP ) {
+			continue;
+		}
+		for ( j = PROF_TOP - 1; j > k; j-- ) {
+			top_rip [ j ]   = top_rip [ j - 1 ];
+			top_count [ j ] = top_count [ j - 1 ];
+		}
+		top_rip [ k ]   = rip;
+		top_count [ k ] = count;
+	}
+
+	printf ( "Guest profile: samples=%x (kept %x)\n", buf->head, nr );
+	for ( k = 0; k < PROF_TOP && top_count [ k ] > 0; k++ ) {
+		printf ( "  rip=%x count=%x\n", top_rip [ k ], top_count [ k ] );
+	}
+}
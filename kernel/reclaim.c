@@ -0,0 +1,126 @@
+#include "types.h"
+#include "printf.h"
+#include "page.h"
+#include "alloc.h"
+#include "msr.h"
+#include "memacct.h"
+#include "bulkmem.h"
+#include "reclaim.h"
+
+
+struct reclaim_extent {
+	unsigned long pfn;
+	unsigned long nr_pfns;
+	enum mem_type type;
+};
+
+struct reclaim_queue {
+	struct reclaim_extent extents [ RECLAIM_QUEUE_SIZE ];
+	unsigned long head, tail;  /* extents taken, extents queued */
+	unsigned long nr_pending;  /* pages */
+
+	unsigned long nr_queued;   /* statistics (pages) */
+	unsigned long nr_freed;
+	unsigned long nr_batches;
+	u64 cycles;
+};
+
+static struct reclaim_queue reclaim_queue;
+
+
+/* Queue NR_PFNS pages from PFN, charged to ACCT as TYPE, for freeing.  
+ * They leave the account now.  */
+void
+reclaim_pages ( struct mem_account *acct, enum mem_type type, unsigned long pfn, unsigned long nr_pfns )
+{
+	struct reclaim_queue *q = &reclaim_queue;
+	struct reclaim_extent *last = &q->extents [ ( q->tail - 1 ) % RECLAIM_QUEUE_SIZE ];
+
+	if ( nr_pfns == 0 ) {
+		return;
+	}
+
+	memacct_release ( acct, type, nr_pfns << PAGE_SHIFT );
+	q->nr_pending += nr_pfns;
+	q->nr_queued  += nr_pfns;
+
+	/* Page tables are mostly allocated one after another */
+	if ( ( q->tail > q->head ) && ( last->type == type ) && ( last->pfn + last->nr_pfns == pfn ) ) {
+		last->nr_pfns += nr_pfns;
+		return;
+	}
+
+	/* Full: make room the slow way */
+	while ( q->tail - q->head == RECLAIM_QUEUE_SIZE ) {
+		reclaim_run ( q->extents [ q->head % RECLAIM_QUEUE_SIZE ].nr_pfns );
+	}
+
+	last = &q->extents [ q->tail % RECLAIM_QUEUE_SIZE ];
+	last->pfn     = pfn;
+	last->nr_pfns = nr_pfns;
+	last->type    = type;
+	q->tail++;
+}
+
+/* Scrub and free up to BUDGET pages, oldest first; return how many */
+unsigned long
+reclaim_run ( unsigned long budget )
+{
+	struct reclaim_queue *q = &reclaim_queue;
+	unsigned long done = 0;
+	u64 start, end;
+
+	if ( q->nr_pending == 0 ) {
+		return 0;
+	}
+
+	rdtscll ( start );
+
+	while ( ( done < budget ) && ( q->head < q->tail ) ) {
+		struct reclaim_extent *e = &q->extents [ q->head % RECLAIM_QUEUE_SIZE ];
+		const unsigned long n = ( e->nr_pfns < budget - done ) ? e->nr_pfns : budget - done;
+
+		/* Nothing of the VM may reach whoever gets the pages next */
+		bulk_clear ( VIRT ( e->pfn << PAGE_SHIFT ), n << PAGE_SHIFT );
+		free_pages ( e->pfn, n );
+		memacct_freed ( e->type, n << PAGE_SHIFT );
+
+		e->pfn     += n;
+		e->nr_pfns -= n;
+		if ( e->nr_pfns == 0 ) {
+			q->head++;
+		}
+		done += n;
+	}
+
+	q->nr_pending -= done;
+	q->nr_freed   += done;
+	q->nr_batches++;
+
+	rdtscll ( end );
+	q->cycles += end - start;
+	return done;
+}
+
+void
+reclaim_drain ( void )
+{
+	while ( reclaim_run ( RECLAIM_BATCH_PAGES ) > 0 ) {
+		;
+	}
+}
+
+unsigned long
+reclaim_pending ( void )
+{
+	return reclaim_queue.nr_pending;
+}
+
+void
+reclaim_print_stats ( void )
+{
+	const struct reclaim_queue *q = &reclaim_queue;
+
+	printf ( "Reclaim: queued=%x, freed=%x, pending=%x, batches=%x, cycles=%x\n", 
+		 q->nr_queued, q->nr_freed, q->nr_pending, q->nr_batches, q->cycles );
+}
@@ -0,0 +1,55 @@
+#include "types.h"
+#include "printf.h"
+#include "io.h"
+#include "serial.h"
+
+
+/* 8250/16550 UART registers */
+enum {
+	UART_TX  = 0, /* Transmit holding (DLAB=0) */
+	UART_DLL = 0, /* Divisor latch low (DLAB=1) */
+	UART_IER = 1, /* Interrupt enable (DLAB=0) */
+	UART_DLM = 1, /* Divisor latch high (DLAB=1) */
+	UART_FCR = 2, /* FIFO control */
+	UART_LCR = 3, /* Line control */
+	UART_MCR = 4, /* Modem control */
+	UART_LSR = 5, /* Line status */
+};
+
+#define UART_LCR_DLAB	0x80
+#define UART_LCR_8N1	0x03
+#define UART_LSR_THRE	0x20 /* Transmit holding register empty */
+
+static void
+serial_putc ( char c )
+{
+	while ( ! ( inb ( SERIAL_COM1 + UART_LSR ) & UART_LSR_THRE ) )
+		;
+	outb ( c, SERIAL_COM1 + UART_TX );
+}
+
+static void
+serial_puts ( const char *s )
+{
+	for ( ; *s != '\0'; s++ ) {
+		if ( *s == '\n' ) {
+			serial_putc ( '\r' );
+		}
+		serial_putc ( *s );
+	}
+}
+
+/* Mirror the console to COM1 at 115200 baud, 8N1, without interrupts */
+void
+serial_init ( void )
+{
+	outb ( 0, SERIAL_COM1 + UART_IER );
+	outb ( UART_LCR_DLAB, SERIAL_COM1 + UART_LCR );
+	outb ( 1, SERIAL_COM1 + UART_DLL ); /* 115200 / 1 */
+	outb ( 0, SERIAL_COM1 + UART_DLM );
+	outb ( UART_LCR_8N1, SERIAL_COM1 + UART_LCR );
+	outb ( 0xc7, SERIAL_COM1 + UART_FCR ); /* Enable and clear the FIFOs */
+	outb ( 0x03, SERIAL_COM1 + UART_MCR ); /* DTR, RTS */
+
+	console_hook = serial_puts;
+}
@@ -7,42 +7,178 @@
 #include "e820.h"
 #include "pmem_layout.h"
 #include "alloc.h"
+#include "reclaim.h"
 #include "cpu.h"
 #include "elf.h"
 #include "vm.h"
+#include "sos.h"
 #include "vmm.h"
+#include "trace.h"
+#include "bootprof.h"
+#include "idt.h"
+#include "apic.h"
+#include "profile.h"
+#include "pmu.h"
+#include "serial.h"
+#include "memacct.h"
+#include "statpage.h"
+#include "zpool.h"
 
 
 struct cmdline_option {
 	unsigned long vmm_heap_size;
 	unsigned long vm_pmem_size;
+	unsigned long profile_period; /* profile=<APIC timer ticks>, 0 to disable */
+	int pmu;                      /* pmu=1: count VMM events with the performance counters */
+	enum npt_mode npt_mode;       /* npt=4k|2m|1g|mix: nested page sizes */
+	int statpage;                 /* statpage=1: map the statistics page into the VM */
+	unsigned long zpool;          /* zpool=<scans>: compress pages cold that long, 0 to disable */
+	unsigned long balloon;        /* balloon=<Mbytes>: memory asked back from each VM */
+	u32 trace;                    /* trace=<mask>: events to record (bit N: event N), 0 to disable */
 };
 
+/* Parse a decimal or 0x-prefixed hexadecimal number */
+static unsigned long __init
+parse_number ( const char *s )
+{
+	unsigned long val = 0;
+	int base = 10;
+
+	if ( ( s [ 0 ] == '0' ) && ( s [ 1 ] == 'x' ) ) {
+		base = 16;
+		s += 2;
+	}
+
+	for ( ; *s != '\0' && *s != ' '; s++ ) {
+		int d;
+
+		if      ( *s >= '0' && *s <= '9' )               { d = *s - '0'; }
+		else if ( base == 16 && *s >= 'a' && *s <= 'f' ) { d = *s - 'a' + 10; }
+		else                                             { break; }
+
+		val = val * base + d;
+	}
+	return val;
+}
+
+/* Return the value of the "NAME=" option in CMDLINE or NULL */
+static const char * __init
+find_option ( const char *cmdline, const char *name )
+{
+	const size_t len = strlen ( name );
+	const char *p = cmdline;
+
+	while ( *p != '\0' ) {
+		if ( ( strncmp ( p, name, len ) == 0 ) && ( p [ len ] == '=' ) ) {
+			return p + len + 1;
+		}
+
+		/* next word */
+		while ( *p != '\0' && *p != ' ' ) { p++; }
+		while ( *p == ' ' )               { p++; }
+	}
+	return NULL;
+}
+
+static enum npt_mode __init
+parse_npt_mode ( const char *s )
+{
+	if ( strncmp ( s, "4k", 2 ) == 0 )  { return NPT_MODE_4K; }
+	if ( strncmp ( s, "1g", 2 ) == 0 )  { return NPT_MODE_1G; }
+	if ( strncmp ( s, "mix", 3 ) == 0 ) { return NPT_MODE_MIX; }
+	return NPT_MODE_2M;
+}
+
 static struct cmdline_option __init
 parse_cmdline ( const struct multiboot_info *mbi )
 {
 	struct cmdline_option opt 
 		= { DEFAULT_VMM_HEAP_SIZE, 
-		    DEFAULT_VM_PMEM_SIZE };
+		    DEFAULT_VM_PMEM_SIZE,
+		    PROF_DEFAULT_PERIOD,
+		    0,
+		    NPT_MODE_2M,
+		    0,
+		    0,
+		    0,
+		    0 };
 
 	if ( ( mbi->flags & MBI_CMDLINE ) && ( mbi->cmdline != 0 ) ) {
-		char *cmdline = VIRT ( mbi->cmdline );
+		const char *cmdline = VIRT ( mbi->cmdline );
+		const char *val;
+
 		printf ("Command line: %s\n", cmdline );
+
+		if ( ( val = find_option ( cmdline, "profile" ) ) != NULL ) {
+			opt.profile_period = parse_number ( val );
+		}
+		if ( ( val = find_option ( cmdline, "pmu" ) ) != NULL ) {
+			opt.pmu = ( parse_number ( val ) != 0 );
+		}
+		if ( ( val = find_option ( cmdline, "npt" ) ) != NULL ) {
+			opt.npt_mode = parse_npt_mode ( val );
+		}
+		if ( ( val = find_option ( cmdline, "statpage" ) ) != NULL ) {
+			opt.statpage = ( parse_number ( val ) != 0 );
+		}
+		if ( ( val = find_option ( cmdline, "zpool" ) ) != NULL ) {
+			opt.zpool = parse_number ( val );
+		}
+		if ( ( val = find_option ( cmdline, "balloon" ) ) != NULL ) {
+			opt.balloon = parse_number ( val );
+		}
+		if ( ( val = find_option ( cmdline, "trace" ) ) != NULL ) {
+			opt.trace = parse_number ( val );
+		}
 	}
-	
-	/* [TODO] */
 
 	return opt;
 }
 
+/* Options in a module string override the command line for that VM:
+ *   mem=<Mbytes>   guest memory
+ *   npt=4k|2m|1g|mix
+ *   vcpus=<n>      */
+static struct vm_config __init
+parse_module_options ( const struct guest_image *img, const struct cmdline_option *opt )
+{
+	struct vm_config cfg 
+		= { ( unsigned long ) VIRT ( img->start ),
+		    img->size,
+		    opt->vm_pmem_size,
+		    opt->npt_mode,
+		    1 };
+	const char *val;
+
+	if ( ( val = find_option ( img->cmdline, "mem" ) ) != NULL ) {
+		cfg.pmem_size = parse_number ( val ) << 20;
+	}
+	if ( ( val = find_option ( img->cmdline, "npt" ) ) != NULL ) {
+		cfg.npt_mode = parse_npt_mode ( val );
+	}
+	if ( ( val = find_option ( img->cmdline, "vcpus" ) ) != NULL ) {
+		cfg.nr_vcpus = parse_number ( val );
+	}
+
+	if ( ( cfg.pmem_size == 0 ) || ( cfg.pmem_size & ( PAGE_SIZE_2MB - 1 ) ) ) {
+		fatal_failure ( "mem= must be a non-zero multiple of 2 Mbytes.\n" );
+	}
+	/* The guest page table and the benchmark buffers are laid out for this */
+	if ( ( cfg.pmem_size < SOS_MIN_PMEM_SIZE ) || ( cfg.pmem_size > SOS_MAX_PMEM_SIZE ) ) {
+		fatal_failure ( "mem= is out of the range the guest supports (see sos.h).\n" );
+	}
+	return cfg;
+}
+
 static int __init
 has_guest_image ( const struct multiboot_info *mbi )
 {
 	return ( ( mbi->flags & MBI_MODULES ) && ( mbi->mods_count > 0 ) );
 }
 
-static int __init
-find_memory_region_for_saving_guest_image ( const struct e820_map *e820, const struct pmem_layout *pml, unsigned long len ) 
+/* The lowest RAM address at or above FLOOR with LEN bytes free */
+static unsigned long __init
+find_memory_region_for_saving_guest_image ( const struct e820_map *e820, unsigned long floor, unsigned long len ) 
 {
 	int i;
 	
@@ -53,11 +189,11 @@ find_memory_region_for_saving_guest_image ( const struct e820_map *e820, const s
 			continue;
 		}
 
-		if ( ( p->addr < pml->vmm_heap_end ) && ( pml->vmm_heap_end + len < p->addr + p->size ) ) {
-			return pml->vmm_heap_end;
+		if ( ( p->addr < floor ) && ( floor + len < p->addr + p->size ) ) {
+			return floor;
 		}
 
-		if ( p->addr >= pml->vmm_heap_end ) {
+		if ( p->addr >= floor ) {
 			return p->addr;
 		} 
 	}
@@ -66,46 +202,103 @@ find_memory_region_for_saving_guest_image ( const struct e820_map *e820, const s
 	return -1;
 }
 
+/* Leave each guest image in the frames the bootloader put it in when 
+ * they are outside the VMM heap and within the direct mapping; the 
+ * allocator then reserves them.  Otherwise move it out of the way, above 
+ * every module so that none is overwritten.  */
 static void __init
-copy_guest_image ( const struct multiboot_info *mbi, const struct e820_map *e820, struct pmem_layout *pml )
+place_guest_images ( const struct multiboot_info *mbi, const struct e820_map *e820, struct pmem_layout *pml )
 {
+	const struct module *mods = ( struct module * ) VIRT ( mbi->mods_addr );
+	unsigned long floor = pml->vmm_heap_end;
+	int i;
+
 	if ( ! has_guest_image ( mbi ) ) {
 		fatal_failure ( "No guest operating system is specified. Check bootloader configuration.\n");
 	}
 
-	const struct module *mod = ( struct module * ) VIRT ( mbi->mods_addr );
+	pml->nr_guest_images = ( mbi->mods_count < MAX_GUEST_IMAGES ) ? mbi->mods_count : MAX_GUEST_IMAGES;
 
-	pml->guest_image_size  = mod->mod_end - mod->mod_start;
-	pml->guest_image_start = find_memory_region_for_saving_guest_image ( e820, pml, pml->guest_image_size );
-	
-	memmove ( VIRT ( pml->guest_image_start ), VIRT ( mod->mod_start ), pml->guest_image_size );
+	for ( i = 0; i < pml->nr_guest_images; i++ ) {
+		if ( mods [ i ].mod_end > floor ) {
+			floor = PAGE_UP ( mods [ i ].mod_end );
+		}
+	}
+
+	for ( i = 0; i < pml->nr_guest_images; i++ ) {
+		const struct module *mod = &mods [ i ];
+		struct guest_image *img = &pml->guest_images [ i ];
+
+		img->size = mod->mod_end - mod->mod_start;
+		img->cmdline [ 0 ] = '\0';
+		if ( mod->string != 0 ) {
+			const char *s = VIRT ( mod->string );
+			int n;
+
+			for ( n = 0; ( n < GUEST_CMDLINE_SIZE - 1 ) && ( s [ n ] != '\0' ); n++ ) {
+				img->cmdline [ n ] = s [ n ];
+			}
+			img->cmdline [ n ] = '\0';
+		}
+
+		if ( ( PAGE_DOWN ( mod->mod_start ) >= pml->vmm_heap_end ) && ( mod->mod_end <= PAGE_SIZE_1GB ) ) {
+			img->start = mod->mod_start;
+			printf ( "Guest image used in place (start=%x, size=%x).\n", img->start, img->size );
+			continue;
+		}
+
+		img->start = find_memory_region_for_saving_guest_image ( e820, floor, img->size );
+		floor = PAGE_UP ( img->start + img->size );
+
+		memmove ( VIRT ( img->start ), VIRT ( mod->mod_start ), img->size );
+		bootprof_copied ( img->size );
+	}
+
+	if ( mbi->mods_count > MAX_GUEST_IMAGES ) {
+		printf ( "Only the first %x modules are booted.\n", ( unsigned long ) MAX_GUEST_IMAGES );
+	}
 }
 
 static void __init 
 setup_arch ( const struct multiboot_info *mbi, const struct cmdline_option *opt, struct pmem_layout *pml )
 {
 	struct e820_map e820;
+	bootprof_phase ( BOOT_PHASE_MEMORY_REGION );
 	setup_memory_region ( &e820, mbi );
 
 	pml->total_pages  = get_nr_pages ( &e820 );
 	pml->max_page     = get_max_pfn ( &e820 );
 	pml->vmm_heap_end = opt->vmm_heap_size;
 
-	/* [Note] We need move a guest image to elsewhere since the
-	 * page allocater may destroy the image */
-	copy_guest_image ( mbi, &e820, pml );
+	/* [Note] We need move a guest image to elsewhere if it lies in 
+	 * the VMM heap, which the page allocator does not manage */
+	bootprof_phase ( BOOT_PHASE_COPY_GUEST_IMAGE );
+	place_guest_images ( mbi, &e820, pml );
 
+	bootprof_phase ( BOOT_PHASE_ALLOCATOR_INIT );
 	naive_allocator_init ( &e820, pml );
 
+	bootprof_phase ( BOOT_PHASE_TRACE_INIT );
+	trace_init ( opt->trace );
+
 	/* [Note] only first 1 GB of the virtual memory of the VMM is 
 	 * mapped to the physical memory of the physical machine.  */
 
+	bootprof_phase ( BOOT_PHASE_IDENTIFY_CPU );
 	identify_cpu ( );
+	pmu_init ( opt->pmu );
+
+	bootprof_phase ( BOOT_PHASE_INTERRUPT_INIT );
+	idt_init ( );
+	lapic_init ( );
 }
 
 void __init
 start_vmm ( const struct multiboot_info *mbi )
 {
+	bootprof_start ( );
+	serial_init ( );
+
 	printf ( "\n\n\n\n\n\n\n\n" ); /* [DEBUG] */
 
 	struct cmdline_option opt = parse_cmdline ( mbi );
@@ -113,7 +306,36 @@ start_vmm ( const struct multiboot_info *mbi )
 	struct pmem_layout pml;	
 	setup_arch ( mbi, &opt, &pml );
 
-	struct vm vm;
-	vm_create ( &vm, ( unsigned long ) VIRT ( pml.guest_image_start ), pml.guest_image_size, opt.vm_pmem_size ); 
-	vm_boot ( &vm );
+	/* One VM per module.  [Note] The VMs are built one after another on 
+	 * the bootstrap processor, the only CPU brought up.  */
+	static struct vm vms [ MAX_GUEST_IMAGES ];
+	int i;
+
+	for ( i = 0; i < pml.nr_guest_images; i++ ) {
+		const struct vm_config cfg = parse_module_options ( &pml.guest_images [ i ], &opt );
+
+		vm_create ( &vms [ i ], i, &cfg ); 
+		profile_init ( &vms [ i ], opt.profile_period );
+		zpool_init ( &vms [ i ], opt.zpool );
+		balloon_init ( &vms [ i ], opt.balloon << ( 20 - PAGE_SHIFT ) );
+	}
+
+	/* The first VM is the management guest */
+	statpage_init ( );
+	if ( opt.statpage ) {
+		statpage_map ( &vms [ 0 ] );
+	}
+
+	bootprof_finish ( );
+	vm_boot ( vms, pml.nr_guest_images );
+
+	alloc_print_stats ( );
+	reclaim_print_stats ( );
+	memacct_print_host ( );
+
+	/* The benchmark harness (tools/bench.sh) waits for this line */
+	printf ( "VMM halted.\n" );
+	for ( ;; ) {
+		asm volatile ( "cli; hlt" );
+	}
 }
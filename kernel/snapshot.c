@@ -0,0 +1,482 @@
+#include "types.h"
+#include "string.h"
+#include "printf.h"
+#include "page.h"
+#include "alloc.h"
+#include "msr.h"
+#include "vm.h"
+#include "memacct.h"
+#include "bulkmem.h"
+#include "reclaim.h"
+#include "zpool.h"
+#include "snapshot.h"
+
+
+#define BITS_PER_LONG	64
+
+#define BITMAP_SIZE(n)	( ( ( n ) + BITS_PER_LONG - 1 ) / BITS_PER_LONG * sizeof ( unsigned long ) )
+
+static inline int
+bitmap_test ( const unsigned long *map, unsigned long n )
+{
+	return !! ( map [ n / BITS_PER_LONG ] & ( 1UL << ( n % BITS_PER_LONG ) ) );
+}
+
+static inline void
+bitmap_assign ( unsigned long *map, unsigned long n, int val )
+{
+	if ( val ) {
+		map [ n / BITS_PER_LONG ] |= 1UL << ( n % BITS_PER_LONG );
+	} else {
+		map [ n / BITS_PER_LONG ] &= ~ ( 1UL << ( n % BITS_PER_LONG ) );
+	}
+}
+
+static inline int
+page_present ( const struct vm_snapshot *snap, unsigned long pfn )
+{
+	return bitmap_test ( snap->present, pfn );
+}
+
+static inline void
+set_page_present ( struct vm_snapshot *snap, unsigned long pfn, int present )
+{
+	bitmap_assign ( snap->present, pfn, present );
+}
+
+static inline unsigned long
+chunk_start ( unsigned long chunk )
+{
+	return chunk * SNAPSHOT_CHUNK_SIZE;
+}
+
+static inline unsigned long
+chunk_end ( const struct vm *vm, unsigned long chunk )
+{
+	const unsigned long end = chunk_start ( chunk + 1 );
+
+	return ( end < vm->pmem_size ) ? end : vm->pmem_size;
+}
+
+/* The guest memory at GPA as seen by the guest, and in *LEN how much of it 
+ * is contiguous in the host (up to the end of the nested page) */
+static u8 *
+guest_range ( struct vm *vm, unsigned long gpa, unsigned long *len )
+{
+	const unsigned long pml4 = ( unsigned long ) VIRT ( vm->h_cr3 );
+	unsigned long size;
+	const unsigned long paddr = vaddr_to_paddr_page ( pml4, gpa, &size );
+
+	*len = size - ( gpa & ( size - 1 ) );
+	if ( *len > vm->pmem_size - gpa ) {
+		*len = vm->pmem_size - gpa;
+	}
+	return VIRT ( paddr );
+}
+
+/* The structure is followed by the page and chunk bitmaps and the chunk 
+ * tables */
+static unsigned long
+snapshot_size ( unsigned long nr_pages, unsigned long nr_chunks )
+{
+	return sizeof ( struct vm_snapshot ) + BITMAP_SIZE ( nr_pages ) + BITMAP_SIZE ( nr_chunks ) + 
+		nr_chunks * sizeof ( u32 ) * 2;
+}
+
+static struct vm_snapshot *
+snapshot_alloc ( struct vm *vm )
+{
+	const unsigned long nr_pages  = PFN_UP ( vm->pmem_size );
+	const unsigned long nr_chunks = ( vm->pmem_size + SNAPSHOT_CHUNK_SIZE - 1 ) / SNAPSHOT_CHUNK_SIZE;
+	const unsigned long size = snapshot_size ( nr_pages, nr_chunks );
+	const unsigned long pfn = alloc_pages ( PFN_UP ( size ), 1 );
+	struct vm_snapshot *snap = ( struct vm_snapshot * ) VIRT ( pfn << PAGE_SHIFT );
+
+	memset ( snap, 0, size );
+	snap->nr_pages    = nr_pages;
+	snap->nr_chunks   = nr_chunks;
+	snap->present     = ( unsigned long * ) ( snap + 1 );
+	snap->pending     = ( unsigned long * ) ( ( u8 * ) snap->present + BITMAP_SIZE ( nr_pages ) );
+	snap->chunk_data  = ( u32 * ) ( ( u8 * ) snap->pending + BITMAP_SIZE ( nr_chunks ) );
+	snap->working_set = snap->chunk_data + nr_chunks;
+	return snap;
+}
+
+/* Record which pages hold data, and where each chunk's go; return how many */
+static unsigned long
+scan_guest_memory ( struct vm *vm, struct vm_snapshot *snap )
+{
+	unsigned long gpa, len, off, n = 0;
+
+	for ( gpa = 0; gpa < vm->pmem_size; gpa += len ) {
+		const u8 *p = guest_range ( vm, gpa, &len );
+
+		for ( off = 0; off < len; off += PAGE_SIZE ) {
+			const int present = ! vm_gpa_is_passthrough ( gpa ) && ! page_is_zero ( p + off );
+
+			if ( ( ( gpa + off ) & ( SNAPSHOT_CHUNK_SIZE - 1 ) ) == 0 ) {
+				snap->chunk_data [ ( gpa + off ) / SNAPSHOT_CHUNK_SIZE ] = n;
+			}
+			set_page_present ( snap, PFN_DOWN ( gpa + off ), present );
+			n += present;
+		}
+	}
+	return n;
+}
+
+/* The chunks the guest has touched since the accessed bits of the nested 
+ * page table were last cleared, which is done here */
+static void
+record_working_set ( struct vm *vm, struct vm_snapshot *snap )
+{
+	const unsigned long pml4 = ( unsigned long ) VIRT ( vm->h_cr3 );
+	unsigned long chunk;
+
+	snap->nr_working_set = 0;
+	for ( chunk = 0; chunk < snap->nr_chunks; chunk++ ) {
+		const unsigned long start = chunk_start ( chunk );
+
+		if ( pgt_test_and_clear_accessed ( pml4, start, chunk_end ( vm, chunk ) - start ) && 
+		     ! vm_gpa_is_passthrough ( start ) ) {
+			snap->working_set [ snap->nr_working_set++ ] = chunk;
+		}
+	}
+}
+
+/* Copy the pages that hold data, a run of them at a time; with 2-Mbyte 
+ * nested pages a dense region goes in one copy.  */
+static void
+save_guest_memory ( struct vm *vm, struct vm_snapshot *snap )
+{
+	u8 *dest = snap->data;
+	unsigned long gpa, len, off, run;
+
+	for ( gpa = 0; gpa < vm->pmem_size; gpa += len ) {
+		const u8 *p = guest_range ( vm, gpa, &len );
+
+		for ( off = 0; off < len; off += run ) {
+			const int present = page_present ( snap, PFN_DOWN ( gpa + off ) );
+
+			for ( run = PAGE_SIZE; off + run < len; run += PAGE_SIZE ) {
+				if ( page_present ( snap, PFN_DOWN ( gpa + off + run ) ) != present ) {
+					break;
+				}
+			}
+			if ( present ) {
+				bulk_copy ( dest, p + off, run );
+				dest += run;
+			}
+		}
+	}
+}
+
+/* Guest memory is restored into the VM's own RAM, which the nested page 
+ * table is then pointed back at.  SRC holds the stored pages of the NR 
+ * pages from FIRST on.  */
+static void
+load_guest_pages ( struct vm *vm, const struct vm_snapshot *snap, unsigned long first, unsigned long nr, const u8 *src )
+{
+	const unsigned long last = first + nr;
+	unsigned long pfn, run;
+
+	for ( pfn = first; pfn < last; pfn += run ) {
+		const int present = page_present ( snap, pfn );
+		u8 *dest = ( u8 * ) ( vm->pmem_start + ( pfn << PAGE_SHIFT ) );
+
+		if ( vm_gpa_is_passthrough ( pfn << PAGE_SHIFT ) ) {
+			run = 1;
+			continue;
+		}
+
+		for ( run = 1; pfn + run < last; run++ ) {
+			if ( ( page_present ( snap, pfn + run ) != present ) || 
+			     vm_gpa_is_passthrough ( ( pfn + run ) << PAGE_SHIFT ) ) {
+				break;
+			}
+		}
+
+		if ( present ) {
+			bulk_copy ( dest, src, run << PAGE_SHIFT );
+			src += run << PAGE_SHIFT;
+		} else {
+			bulk_clear ( dest, run << PAGE_SHIFT );
+		}
+	}
+}
+
+static void
+load_guest_memory ( struct vm *vm, const struct vm_snapshot *snap )
+{
+	load_guest_pages ( vm, snap, 0, snap->nr_pages, snap->data );
+}
+
+static void
+restore_vcpu ( struct vm *vm, const struct vm_snapshot *snap )
+{
+	struct vmcb *vmcb = vm->vmcb;
+
+	memmove ( ( u8 * ) vmcb + VMCB_SAVE_OFFSET, snap->save, VMCB_SAVE_SIZE );
+	vmcb->eventinj.bytes  = 0;
+	vmcb->interrupt_shadow = 0;
+	vm->regs     = snap->regs;
+	vm->msrs     = snap->msrs;
+	vm->debugcon = snap->debugcon;
+
+	guest_msrs_load ( vm );
+}
+
+/* Guest RAM is mapped anew, in the largest pages, by every restore, so 
+ * each complete one leaves as many nested page tables behind as the one 
+ * before; more means tables leaked on the way.  */
+static void
+check_npt ( struct vm *vm, struct vm_snapshot *snap )
+{
+	const u64 bytes = vm->mem.bytes [ MEM_NPT ];
+
+	if ( ( snap->npt_bytes != 0 ) && ( bytes != snap->npt_bytes ) ) {
+		printf ( "Nested page table changed across restores (before=%x, after=%x).\n", 
+			 snap->npt_bytes, bytes );
+	}
+	snap->npt_bytes = bytes;
+}
+
+/* Bring one chunk of a lazy restore in and map it */
+static void
+load_chunk ( struct vm *vm, struct vm_snapshot *snap, unsigned long chunk )
+{
+	const unsigned long start = chunk_start ( chunk );
+	const unsigned long end   = chunk_end ( vm, chunk );
+	u64 now;
+
+	load_guest_pages ( vm, snap, PFN_DOWN ( start ), PFN_DOWN ( end - start ), 
+			   snap->data + ( ( unsigned long ) snap->chunk_data [ chunk ] << PAGE_SHIFT ) );
+
+	memacct_begin ( &vm->mem, MEM_NPT );
+	vm_map_pmem_range ( vm, ( unsigned long ) VIRT ( vm->h_cr3 ), start, end );
+	memacct_end ( );
+
+	bitmap_assign ( snap->pending, chunk, 0 );
+	if ( --snap->nr_pending == 0 ) {
+		rdtscll ( now );
+		printf ( "Lazy restore complete (faults=%x, prefetched=%x, cycles=%x).\n", 
+			 snap->nr_faults, snap->nr_prefetched, now - snap->lazy_start );
+		check_npt ( vm, snap );
+	}
+}
+
+static void
+finish_lazy_restore ( struct vm *vm, struct vm_snapshot *snap )
+{
+	unsigned long chunk;
+
+	for ( chunk = 0; snap->nr_pending > 0; chunk++ ) {
+		if ( bitmap_test ( snap->pending, chunk ) ) {
+			load_chunk ( vm, snap, chunk );
+		}
+	}
+}
+
+/* Save the VM as it is now.  Called with the guest stopped in a #VMEXIT, 
+ * so the VMCB and the register file are up to date.  */
+int
+snapshot_take ( struct vm *vm )
+{
+	struct vm_snapshot *snap;
+	unsigned long nr_stored;
+	u64 start, end;
+
+	rdtscll ( start );
+
+	/* Guest pages that left their frames (compressed pool, balloon) 
+	 * cannot be restored in place */
+	if ( vm->frames != NULL ) {
+		printf ( "Snapshot refused: guest pages have left their frames.\n" );
+		return -1;
+	}
+
+	/* Memory still in the previous snapshot is part of this one */
+	if ( vm->snapshot != NULL ) {
+		finish_lazy_restore ( vm, vm->snapshot );
+	}
+
+	memacct_begin ( &vm->mem, MEM_SNAPSHOT );
+
+	if ( vm->snapshot == NULL ) {
+		vm->snapshot = snapshot_alloc ( vm );
+	}
+	snap = vm->snapshot;
+
+	nr_stored = scan_guest_memory ( vm, snap );
+	if ( nr_stored > snap->capacity ) {
+		if ( snap->data != NULL ) {
+			reclaim_pages ( &vm->mem, MEM_SNAPSHOT, PFN_DOWN ( PHYS ( snap->data ) ), snap->capacity );
+		}
+		snap->data     = VIRT ( alloc_pages ( nr_stored, 1 ) << PAGE_SHIFT );
+		snap->capacity = nr_stored;
+	}
+	snap->nr_stored = nr_stored;
+
+	memacct_end ( );
+
+	save_guest_memory ( vm, snap );
+	record_working_set ( vm, snap );
+
+	memmove ( snap->save, ( u8 * ) vm->vmcb + VMCB_SAVE_OFFSET, VMCB_SAVE_SIZE );
+	snap->regs     = vm->regs;
+	snap->msrs     = vm->msrs;
+	snap->debugcon = vm->debugcon;
+
+	rdtscll ( end );
+	snap->take_cycles = end - start;
+
+	printf ( "Snapshot taken (pages=%x, stored=%x, zero=%x, working_set=%x, cycles=%x).\n", 
+		 snap->nr_pages, snap->nr_stored, snap->nr_pages - snap->nr_stored, snap->nr_working_set, snap->take_cycles );
+	return 0;
+}
+
+/* Return the VM to its snapshot.  The nested mappings of guest memory are 
+ * rebuilt a range at a time, so pages mapped elsewhere (the read-only 
+ * image pages) become ordinary guest RAM again.  */
+int
+snapshot_restore ( struct vm *vm )
+{
+	struct vm_snapshot *snap = vm->snapshot;
+	u64 start, end;
+
+	if ( snap == NULL ) {
+		return -1;
+	}
+
+	rdtscll ( start );
+
+	/* All of memory is reloaded: drop what a lazy restore had left */
+	memset ( snap->pending, 0, BITMAP_SIZE ( snap->nr_chunks ) );
+	snap->nr_pending = 0;
+
+	load_guest_memory ( vm, snap );
+
+	memacct_begin ( &vm->mem, MEM_NPT );
+	vm_map_pmem ( vm, ( unsigned long ) VIRT ( vm->h_cr3 ) );
+	memacct_end ( );
+	check_npt ( vm, snap );
+
+	restore_vcpu ( vm, snap );
+
+	rdtscll ( end );
+	snap->restore_cycles = end - start;
+
+	printf ( "Snapshot restored (pages=%x, stored=%x, cycles=%x).\n", 
+		 snap->nr_pages, snap->nr_stored, snap->restore_cycles );
+	return 0;
+}
+
+/* Return the VM to its snapshot without copying its memory first.  Guest 
+ * RAM is unmapped from the nested page table and each chunk is loaded on 
+ * the first nested page fault in it, or earlier by snapshot_prefetch ( ), 
+ * so the guest resumes after work that does not depend on its memory.  */
+int
+snapshot_restore_lazy ( struct vm *vm )
+{
+	struct vm_snapshot *snap = vm->snapshot;
+	const unsigned long pml4 = ( unsigned long ) VIRT ( vm->h_cr3 );
+	unsigned long chunk;
+	u64 end;
+
+	if ( snap == NULL ) {
+		return -1;
+	}
+
+	rdtscll ( snap->lazy_start );
+
+	memset ( snap->pending, 0, BITMAP_SIZE ( snap->nr_chunks ) );
+	snap->nr_pending = 0;
+
+	/* Each chunk costs one entry, or one page table, to unmap; large 
+	 * pages split on the way take tables */
+	memacct_begin ( &vm->mem, MEM_NPT );
+	for ( chunk = 0; chunk < snap->nr_chunks; chunk++ ) {
+		const unsigned long start = chunk_start ( chunk );
+
+		if ( vm_gpa_is_passthrough ( start ) ) {
+			continue;
+		}
+		munmap_range ( pml4, start, chunk_end ( vm, chunk ) - start );
+		bitmap_assign ( snap->pending, chunk, 1 );
+		snap->nr_pending++;
+	}
+	memacct_end ( );
+	memset ( vm->npt_pages, 0, sizeof ( vm->npt_pages ) );
+
+	snap->prefetch_pos  = 0;
+	snap->nr_faults     = 0;
+	snap->nr_prefetched = 0;
+
+	restore_vcpu ( vm, snap );
+
+	rdtscll ( end );
+	snap->restore_cycles = end - snap->lazy_start;
+
+	printf ( "Snapshot restored lazily (chunks=%x, working_set=%x, cycles=%x).\n", 
+		 snap->nr_pending, snap->nr_working_set, snap->restore_cycles );
+	return 0;
+}
+
+/* A nested page fault at GPA: load its chunk if a lazy restore has not 
+ * yet.  Return 0 if the guest can retry the access.  */
+int
+snapshot_fault ( struct vm *vm, unsigned long gpa )
+{
+	struct vm_snapshot *snap = vm->snapshot;
+	const unsigned long chunk = gpa / SNAPSHOT_CHUNK_SIZE;
+
+	if ( ( snap == NULL ) || ( snap->nr_pending == 0 ) || ( gpa >= vm->pmem_size ) || 
+	     ! bitmap_test ( snap->pending, chunk ) ) {
+		return -1;
+	}
+
+	snap->nr_faults++;
+	load_chunk ( vm, snap, chunk );
+	return 0;
+}
+
+/* Load one more chunk of a lazy restore: the working set recorded when the 
+ * snapshot was taken first, then the rest in address order.  */
+void
+snapshot_prefetch ( struct vm *vm )
+{
+	struct vm_snapshot *snap = vm->snapshot;
+	unsigned long chunk;
+
+	if ( ( snap == NULL ) || ( snap->nr_pending == 0 ) ) {
+		return;
+	}
+
+	do {
+		if ( snap->prefetch_pos < snap->nr_working_set ) {
+			chunk = snap->working_set [ snap->prefetch_pos ];
+		} else {
+			chunk = snap->prefetch_pos - snap->nr_working_set;
+		}
+		snap->prefetch_pos++;
+	} while ( ! bitmap_test ( snap->pending, chunk ) );
+
+	snap->nr_prefetched++;
+	load_chunk ( vm, snap, chunk );
+}
+
+/* Give the snapshot's memory back; the VM no longer has one */
+void
+snapshot_destroy ( struct vm *vm )
+{
+	struct vm_snapshot *snap = vm->snapshot;
+
+	if ( snap == NULL ) {
+		return;
+	}
+
+	if ( snap->data != NULL ) {
+		reclaim_pages ( &vm->mem, MEM_SNAPSHOT, PFN_DOWN ( PHYS ( snap->data ) ), snap->capacity );
+	}
+	reclaim_pages ( &vm->mem, MEM_SNAPSHOT, PFN_DOWN ( PHYS ( snap ) ), PFN_UP ( snapshot_size ( snap->nr_pages, snap->nr_chunks ) ) );
+	vm->snapshot = NULL;
+}
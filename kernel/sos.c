@@ -1,3 +1,452 @@
 /*
  * Sample Operating System (SOS)
+ *
+ * A benchmark guest: it runs calibrated loops of operations which exit
+ * to the VMM (or deliberately do not) and reports the cycles per
+ * operation on the debug console port, one line per benchmark:
+ *
+ *   bench <name> id=<id> iterations=<n> cycles=<c> cycles_per_op=<c/n>
+ *
+ * The TLB kernels (tlb_*) are meant to be compared across the nested page
+ * sizes selected with the VMM's "npt=" option, which is reported first:
+ *
+ *   bench config npt_mode=<enum npt_mode>
+ *
+ * If the VMM asks for memory back (balloon=), the idle TLB buffer is 
+ * reported free in 2-Mbyte runs and then touched again:
+ *
+ *   bench balloon id=<id> pages=<given back> calls=<exits> cycles=<c> refault_cycles=<c>
+ *
+ * Last, the guest snapshots itself, dirties memory and restores, first 
+ * copying memory back at once and then on demand.  The VMM refuses once
+ * memory has been ballooned.
+ *
+ *   bench snapshot id=<id> cycles=<round trip> restored=<1 if undone>
+ *   bench snapshot_lazy id=<id> cycles=<round trip> restored=<1 if undone>
  */
+
+#include "types.h"
+#include "string.h"
+#include "printf.h"
+#include "msr.h"
+#include "io.h"
+#include "debugcon.h"
+#include "hypercall.h"
+#include "sos.h"
+#include "statpage.h"
+#include "balloon.h"
+
+
+/* A benchmark is run with 2^k iterations, doubling until it takes at least
+ * BENCH_MIN_CYCLES (or BENCH_MAX_ITERS is reached). */
+#define BENCH_MIN_ITERS		0x40
+#define BENCH_MAX_ITERS		0x100000
+#define BENCH_MIN_CYCLES	0x1000000
+
+#define BENCH_PIO_PORT		0x510	/* no device: intercepted and unclaimed */
+#define BENCH_PASS_PORT		0x80	/* passed through */
+
+#define PIO_INS_SIZE		4096
+#define CACHE_LINE_SIZE		64
+
+#define TLB_PAGE_SIZE		4096
+#define TLB_PAGES		( SOS_TLB_BUF_SIZE / TLB_PAGE_SIZE )
+#define TLB_SEED		0x9e3779b97f4a7c15UL
+
+
+static inline u64
+rdtsc ( void )
+{
+	u64 t;
+	rdtscll ( t );
+	return t;
+}
+
+static inline unsigned long
+vmmcall ( unsigned long nr, unsigned long a0, unsigned long a1, unsigned long a2 )
+{
+	unsigned long ret;
+	asm volatile ( "vmmcall" : "=a" ( ret ) : "a" ( nr ), "b" ( a0 ), "c" ( a1 ), "d" ( a2 ) : "memory" );
+	return ret;
+}
+
+static void
+debug_puts ( const char *s )
+{
+	outsb ( DEBUGCON_PORT, s, strlen ( s ) );
+}
+
+/******************************************************/
+
+static void
+bench_cpuid ( unsigned long n )
+{
+	asm volatile ( "1: movl $1, %%eax; xorl %%ecx, %%ecx; cpuid; decq %0; jnz 1b"
+		       : "+r" ( n ) :: "rax", "rbx", "rcx", "rdx" );
+}
+
+static void
+bench_vmmcall ( unsigned long n )
+{
+	asm volatile ( "1: movl %1, %%eax; vmmcall; decq %0; jnz 1b"
+		       : "+r" ( n ) : "i" ( HC_NOP ) : "rax" );
+}
+
+static void
+bench_pio_in ( unsigned long n )
+{
+	asm volatile ( "1: inb %w1, %%al; decq %0; jnz 1b"
+		       : "+r" ( n ) : "d" ( BENCH_PIO_PORT ) : "rax" );
+}
+
+static void
+bench_pio_out_pass ( unsigned long n )
+{
+	asm volatile ( "1: outb %%al, %w1; decq %0; jnz 1b"
+		       : "+r" ( n ) : "d" ( BENCH_PASS_PORT ), "a" ( 0 ) );
+}
+
+/* One REP INSB of a page per iteration */
+static void
+bench_pio_ins ( unsigned long n )
+{
+	while ( n-- > 0 ) {
+		void *dst = ( void * ) SOS_BENCH_BUF;
+		unsigned long count = PIO_INS_SIZE;
+		asm volatile ( "rep; insb" : "+D" ( dst ), "+c" ( count ) : "d" ( BENCH_PIO_PORT ) : "memory" );
+	}
+}
+
+static void
+bench_msr_intercept ( unsigned long n )
+{
+	asm volatile ( "1: movl %1, %%ecx; rdmsr; decq %0; jnz 1b"
+		       : "+r" ( n ) : "i" ( MSR_APIC_BASE ) : "rax", "rcx", "rdx" );
+}
+
+static void
+bench_msr_pass ( unsigned long n )
+{
+	asm volatile ( "1: movl %1, %%ecx; rdmsr; decq %0; jnz 1b"
+		       : "+r" ( n ) : "i" ( MSR_KERNEL_GS_BASE ) : "rax", "rcx", "rdx" );
+}
+
+static void
+bench_hlt ( unsigned long n )
+{
+	asm volatile ( "1: hlt; decq %0; jnz 1b" : "+r" ( n ) );
+}
+
+/* The first byte above the guest memory (HC_MEM_SIZE) */
+static unsigned long mmio_hole;
+
+static void
+bench_npf ( unsigned long n )
+{
+	asm volatile ( "1: movb (%1), %%al; decq %0; jnz 1b"
+		       : "+r" ( n ) : "r" ( mmio_hole ) : "rax", "memory" );
+}
+
+/* The memory kernels count one operation per cache line and sweep a
+ * buffer repeatedly. */
+#define LINES_PER_BUF ( SOS_BENCH_BUF_SIZE / CACHE_LINE_SIZE )
+
+static void
+bench_mem_read ( unsigned long n )
+{
+	unsigned long passes = ( n + LINES_PER_BUF - 1 ) / LINES_PER_BUF;
+
+	while ( passes-- > 0 ) {
+		const u64 *p = ( const u64 * ) SOS_BENCH_BUF;
+		unsigned long lines = LINES_PER_BUF;
+		asm volatile ( "1: movq (%0), %%rax; addq %2, %0; decq %1; jnz 1b"
+			       : "+r" ( p ), "+r" ( lines ) : "i" ( CACHE_LINE_SIZE ) : "rax", "memory" );
+	}
+}
+
+static void
+bench_mem_write ( unsigned long n )
+{
+	unsigned long passes = ( n + LINES_PER_BUF - 1 ) / LINES_PER_BUF;
+
+	while ( passes-- > 0 ) {
+		void *dst = ( void * ) SOS_BENCH_BUF;
+		unsigned long count = SOS_BENCH_BUF_SIZE / 8;
+		asm volatile ( "rep; stosq" : "+D" ( dst ), "+c" ( count ) : "a" ( 0 ) : "memory" );
+	}
+}
+
+static void
+bench_mem_copy ( unsigned long n )
+{
+	unsigned long passes = ( n + LINES_PER_BUF - 1 ) / LINES_PER_BUF;
+
+	while ( passes-- > 0 ) {
+		void *dst = ( void * ) ( SOS_BENCH_BUF + SOS_BENCH_BUF_SIZE );
+		const void *src = ( const void * ) SOS_BENCH_BUF;
+		unsigned long count = SOS_BENCH_BUF_SIZE / 8;
+		asm volatile ( "rep; movsq" : "+D" ( dst ), "+S" ( src ), "+c" ( count ) :: "memory" );
+	}
+}
+
+/* The TLB kernels count one operation per page touched.  Each page is
+ * touched at a different line so that they do not share cache sets. */
+
+static inline unsigned long
+tlb_addr ( unsigned long page )
+{
+	return SOS_TLB_BUF + page * TLB_PAGE_SIZE + ( ( page * CACHE_LINE_SIZE ) & ( TLB_PAGE_SIZE - 1 ) );
+}
+
+static inline u64
+xorshift ( u64 *x )
+{
+	*x ^= *x << 13;
+	*x ^= *x >> 7;
+	*x ^= *x << 17;
+	return *x;
+}
+
+/* Link every page of the TLB buffer into one cycle in random order
+ * (Sattolo's algorithm) for bench_tlb_chase. */
+static void
+tlb_chase_init ( void )
+{
+	u32 *perm = ( u32 * ) SOS_BENCH_BUF;
+	u64 x = TLB_SEED;
+	unsigned long i;
+
+	for ( i = 0; i < TLB_PAGES; i++ ) {
+		perm [ i ] = i;
+	}
+
+	for ( i = TLB_PAGES - 1; i > 0; i-- ) {
+		const unsigned long j = xorshift ( &x ) % i;
+		const u32 t = perm [ i ];
+		perm [ i ] = perm [ j ];
+		perm [ j ] = t;
+	}
+
+	for ( i = 0; i < TLB_PAGES; i++ ) {
+		*( unsigned long * ) tlb_addr ( i ) = tlb_addr ( perm [ i ] );
+	}
+}
+
+static void
+bench_tlb_seq ( unsigned long n )
+{
+	unsigned long i;
+
+	for ( i = 0; i < n; i++ ) {
+		( void ) *( volatile unsigned long * ) tlb_addr ( i & ( TLB_PAGES - 1 ) );
+	}
+}
+
+static void
+bench_tlb_rand ( unsigned long n )
+{
+	u64 x = TLB_SEED;
+
+	while ( n-- > 0 ) {
+		( void ) *( volatile unsigned long * ) tlb_addr ( xorshift ( &x ) & ( TLB_PAGES - 1 ) );
+	}
+}
+
+static void
+bench_tlb_chase ( unsigned long n )
+{
+	unsigned long p = tlb_addr ( 0 );
+
+	asm volatile ( "1: movq (%1), %1; decq %0; jnz 1b"
+		       : "+r" ( n ), "+r" ( p ) :: "memory" );
+}
+
+/* Statistics page polling (only when the VMM maps the page) */
+static const struct statpage *statpage;
+static struct statpage_data statpage_copy;
+
+static void
+bench_statpage_read ( unsigned long n )
+{
+	while ( n-- > 0 ) {
+		statpage_read ( statpage, &statpage_copy );
+	}
+}
+
+/* Not a loop: a snapshot copies all of guest memory.  The VMM reports the
+ * time taken by each half ("Snapshot taken", "Snapshot restored").  With 
+ * LAZY, the round trip ends at the first access after the restore.  */
+static void
+bench_snapshot ( int id, const char *name, int lazy )
+{
+	volatile u64 *p = ( volatile u64 * ) SOS_BENCH_BUF;
+	char buf [ 96 ];
+	unsigned long ret;
+	u64 start, cycles;
+
+	p [ 0 ] = 1;
+	start = rdtsc ( );
+
+	/* Returns a second time, with 1, after the restore */
+	if ( ( ret = vmmcall ( HC_SNAPSHOT, 0, 0, 0 ) ) == 0 ) {
+		p [ 0 ] = 2;
+		vmmcall ( HC_RESTORE, lazy, 0, 0 );
+	}
+
+	cycles = rdtsc ( ) - start;
+	snprintf ( buf, sizeof ( buf ), "bench %s id=%x cycles=%x restored=%x\n",
+		   name, ( unsigned long ) id, cycles, ( unsigned long ) ( ( ret == 1 ) && ( p [ 0 ] == 1 ) ) );
+	debug_puts ( buf );
+}
+
+/* Not a loop either: memory can be given back once.  The TLB buffer is 
+ * idle after its benchmarks; it goes in 2-Mbyte runs, BALLOON_MAX_REPORTS
+ * of them per exit.  */
+static void
+bench_balloon ( void )
+{
+	static struct balloon_report reports [ BALLOON_MAX_REPORTS ];
+	const unsigned long run = 0x200000 / TLB_PAGE_SIZE;
+	unsigned long owed = vmmcall ( HC_BALLOON_TARGET, 0, 0, 0 );
+	unsigned long gpa = SOS_TLB_BUF, pages = 0, calls = 0, nr = 0, p;
+	char buf [ 128 ];
+	u64 start, cycles, refault_cycles;
+
+	if ( ( owed == 0 ) || ( owed == -1UL ) ) {
+		return;
+	}
+
+	start = rdtsc ( );
+	while ( ( owed > 0 ) && ( gpa < SOS_TLB_BUF + SOS_TLB_BUF_SIZE ) ) {
+		const unsigned long n = ( owed < run ) ? owed : run;
+		unsigned long ret;
+
+		reports [ nr ].gpa      = gpa;
+		reports [ nr ].nr_pages = n;
+		nr++;
+		owed -= n;
+		gpa  += n * TLB_PAGE_SIZE;
+
+		if ( ( nr < BALLOON_MAX_REPORTS ) && ( owed > 0 ) && ( gpa < SOS_TLB_BUF + SOS_TLB_BUF_SIZE ) ) {
+			continue;
+		}
+		ret = vmmcall ( HC_BALLOON_REPORT, ( unsigned long ) reports, nr, 0 );
+		calls++;
+		nr = 0;
+		if ( ret == -1UL ) {
+			break;
+		}
+		pages += ret;
+	}
+	cycles = rdtsc ( ) - start;
+
+	/* Each page faults in a zeroed frame */
+	start = rdtsc ( );
+	for ( p = SOS_TLB_BUF; p < gpa; p += TLB_PAGE_SIZE ) {
+		* ( volatile u64 * ) p = p;
+	}
+	refault_cycles = rdtsc ( ) - start;
+
+	snprintf ( buf, sizeof ( buf ), "bench balloon id=%x pages=%x calls=%x cycles=%x refault_cycles=%x\n",
+		   ( unsigned long ) BENCH_BALLOON, pages, calls, cycles, refault_cycles );
+	debug_puts ( buf );
+}
+
+/******************************************************/
+
+struct bench {
+	int id;
+	const char *name;
+	void ( *func ) ( unsigned long n );
+	unsigned long min_iters;  /* the memory kernels work on whole buffers */
+};
+
+static const struct bench benches [] = {
+	{ BENCH_CPUID,         "cpuid",         bench_cpuid,         BENCH_MIN_ITERS },
+	{ BENCH_VMMCALL,       "vmmcall",       bench_vmmcall,       BENCH_MIN_ITERS },
+	{ BENCH_PIO_IN,        "pio_in",        bench_pio_in,        BENCH_MIN_ITERS },
+	{ BENCH_PIO_OUT_PASS,  "pio_out_pass",  bench_pio_out_pass,  BENCH_MIN_ITERS },
+	{ BENCH_PIO_INS,       "pio_ins_4k",    bench_pio_ins,       BENCH_MIN_ITERS },
+	{ BENCH_MSR_INTERCEPT, "msr_intercept", bench_msr_intercept, BENCH_MIN_ITERS },
+	{ BENCH_MSR_PASS,      "msr_pass",      bench_msr_pass,      BENCH_MIN_ITERS },
+	{ BENCH_HLT,           "hlt",           bench_hlt,           BENCH_MIN_ITERS },
+	{ BENCH_NPF,           "npf",           bench_npf,           BENCH_MIN_ITERS },
+	{ BENCH_MEM_READ,      "mem_read",      bench_mem_read,      LINES_PER_BUF },
+	{ BENCH_MEM_WRITE,     "mem_write",     bench_mem_write,     LINES_PER_BUF },
+	{ BENCH_MEM_COPY,      "mem_copy",      bench_mem_copy,      LINES_PER_BUF },
+	{ BENCH_TLB_SEQ,       "tlb_seq",       bench_tlb_seq,       TLB_PAGES },
+	{ BENCH_TLB_RAND,      "tlb_rand",      bench_tlb_rand,      TLB_PAGES },
+	{ BENCH_TLB_CHASE,     "tlb_chase",     bench_tlb_chase,     TLB_PAGES },
+};
+
+static const struct bench statpage_bench =
+	{ BENCH_STATPAGE_READ, "statpage_read", bench_statpage_read, BENCH_MIN_ITERS };
+
+static void
+run_bench ( const struct bench *b )
+{
+	char buf [ 160 ];
+	unsigned long n = b->min_iters;
+	u64 cycles;
+
+	/* Warm up caches and the VMM's paths */
+	( *b->func ) ( n );
+
+	for ( ;; ) {
+		const u64 start = rdtsc ( );
+		( *b->func ) ( n );
+		cycles = rdtsc ( ) - start;
+
+		if ( ( cycles >= BENCH_MIN_CYCLES ) || ( n >= BENCH_MAX_ITERS ) ) {
+			break;
+		}
+		n <<= 1;
+	}
+
+	snprintf ( buf, sizeof ( buf ), "bench %s id=%x iterations=%x cycles=%x cycles_per_op=%x\n",
+		   b->name, ( unsigned long ) b->id, n, cycles, cycles / n );
+	debug_puts ( buf );
+}
+
+void
+sos_main ( void )
+{
+	const int nr_benches = sizeof ( benches ) / sizeof ( struct bench );
+	char buf [ 64 ];
+	int i;
+
+	debug_puts ( "bench start\n" );
+
+	/* The nested page sizes the TLB kernels ran under */
+	snprintf ( buf, sizeof ( buf ), "bench config npt_mode=%x\n", vmmcall ( HC_NPT_MODE, 0, 0, 0 ) );
+	debug_puts ( buf );
+
+	mmio_hole = vmmcall ( HC_MEM_SIZE, 0, 0, 0 );
+
+	tlb_chase_init ( );
+
+	for ( i = 0; i < nr_benches; i++ ) {
+		run_bench ( &benches [ i ] );
+	}
+
+	/* Read the VMM's counters without exits if this is the management guest */
+	statpage = ( const struct statpage * ) vmmcall ( HC_STATPAGE_GPA, 0, 0, 0 );
+	if ( ( statpage != NULL ) && ( statpage->magic == STATPAGE_MAGIC ) ) {
+		run_bench ( &statpage_bench );
+
+		statpage_read ( statpage, &statpage_copy );
+		snprintf ( buf, sizeof ( buf ), "bench statpage version=%x updates=%x fast_exits=%x\n",
+			   ( unsigned long ) statpage->version, statpage_copy.nr_updates, statpage_copy.fast_exits );
+		debug_puts ( buf );
+	}
+
+	bench_balloon ( );
+
+	bench_snapshot ( BENCH_SNAPSHOT, "snapshot", 0 );
+	bench_snapshot ( BENCH_SNAPSHOT_LAZY, "snapshot_lazy", 1 );
+
+	debug_puts ( "bench done\n" );
+
+	vmmcall ( HC_VMSTAT_DUMP, 0, 0, 0 );
+	vmmcall ( HC_SHUTDOWN, 0, 0, 0 );
+}
@@ -0,0 +1,103 @@
+#include "types.h"
+#include "string.h"
+#include "printf.h"
+#include "page.h"
+#include "alloc.h"
+#include "vm.h"
+#include "vmstat.h"
+#include "memacct.h"
+#include "statpage.h"
+
+
+static struct statpage *statpage;
+
+/* TSC at which the next #VMEXIT refreshes the page; never while the page
+ * is not mapped into any guest */
+u64 statpage_next_tsc = ~0UL;
+
+
+void
+statpage_init ( void )
+{
+	const unsigned long pfn = alloc_pages ( 1, 1 );
+
+	statpage = ( struct statpage * ) VIRT ( pfn << PAGE_SHIFT );
+	clear_page ( statpage );
+	statpage->magic   = STATPAGE_MAGIC;
+	statpage->version = STATPAGE_VERSION;
+	statpage->size    = sizeof ( struct statpage_data );
+}
+
+/* Map the page read-only above the guest memory.  Writes through 
+ * copy_to_guest are refused as well (see gpa_to_hva).  */
+void
+statpage_map ( struct vm *vm )
+{
+	const unsigned long gpa = PAGE_UP ( vm->pmem_size ) + STATPAGE_GAP;
+
+	memacct_begin ( &vm->mem, MEM_NPT );
+	mmap_page ( ( unsigned long ) VIRT ( vm->h_cr3 ), gpa, PHYS ( statpage ), PGT_LEVEL_PT, PTTEF_US );
+	memacct_end ( );
+
+	vm->statpage_gpa  = gpa;
+	statpage_next_tsc = 0;
+	printf ( "Statistics page mapped: gpa=%x, paddr=%x.\n", gpa, PHYS ( statpage ) );
+}
+
+static void
+fill_data ( struct statpage_data *d, const struct vm *vm, u64 now )
+{
+	unsigned long calls, pages;
+
+	d->update_tsc = now;
+	d->nr_updates++;
+
+	memmove ( d->exits, vm->stats.exits, sizeof ( d->exits ) );
+	memmove ( d->exit_cycles, vm->stats.cycles, sizeof ( d->exit_cycles ) );
+	d->fast_exits = vm->stats.fast_exits;
+
+	alloc_get_stats ( &calls, &pages );
+	d->alloc_calls = calls;
+	d->alloc_pages = pages;
+
+	memmove ( d->vm_mem, vm->mem.bytes, sizeof ( d->vm_mem ) );
+	memmove ( d->host_mem, memacct_host.bytes, sizeof ( d->host_mem ) );
+
+	if ( vm->zpool != NULL ) {
+		d->zpool_stored     = vm->zpool->nr_stored;
+		d->zpool_bytes      = vm->zpool->stored_bytes;
+		d->zpool_pool_pages = vm->zpool->nr_pool_pages;
+		d->zpool_faults     = vm->zpool->nr_faults;
+		memmove ( d->zpool_fault_cycles, vm->zpool->fault_cycles, sizeof ( d->zpool_fault_cycles ) );
+	}
+
+	d->balloon_target   = vm->balloon.target;
+	d->balloon_inflated = vm->balloon.nr_inflated;
+	d->balloon_released = vm->balloon.nr_released;
+	d->balloon_deflated = vm->balloon.nr_deflated;
+}
+
+/* Writer side of the sequence lock.  Stores are not reordered with other
+ * stores on x86, so compiler barriers order SEQ and DATA. */
+void
+statpage_update ( const struct vm *vm, u64 now )
+{
+	if ( statpage == NULL ) {
+		return;
+	}
+
+	/* Only the VM the page is mapped into is reported.  The deadline moves
+	 * on for the others too, or each of their exits would come here.  */
+	statpage_next_tsc = now + STATPAGE_UPDATE_CYCLES;
+	if ( vm->statpage_gpa == 0 ) {
+		return;
+	}
+
+	statpage->seq++;
+	barrier ( );
+
+	fill_data ( &statpage->data, vm, now );
+
+	barrier ( );
+	statpage->seq++;
+}
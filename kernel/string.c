@@ -1,3 +1,9 @@
+#include "types.h"
+#include "bitops.h"
+#include "cpufeature.h"
+#include "cpu.h"
+#include "page.h"
+#include "printf.h"
 #include "string.h"
 
 int
@@ -35,49 +41,358 @@ strncmp ( const char *cs, const char *ct, size_t count )
 	return __res;
 }
 
+size_t
+strlen ( const char *s )
+{
+	const char *sc;
+
+	for (sc = s; *sc != '\0'; ++sc)
+		/* nothing */;
+	return sc - s;
+}
+
+
+
+/* memcpy, memset and the page helpers come in variants selected once by
+ * string_init () from the boot CPU's features.  The guest (SOS) links this
+ * file as well and keeps the default, which runs on any x86-64 CPU. */
+
+struct string_ops {
+	const char *name;
+	void *( *memcpy ) ( void *to, const void *from, size_t n );
+	void *( *memset ) ( void *s, int c, size_t n );
+	void ( *clear_page ) ( void *page );
+	void ( *copy_page ) ( void *to, const void *from );
+};
 
+#define SSE_MIN_SIZE 256 /* smaller blocks are not worth saving the XMM registers */
 
-/* Only used for special circumstances. Stolen from i386/string.h */ 
-static inline void *
-__inline_memcpy ( void * to, const void * from, size_t n )
+/******************************************************/
+
+/* REP MOVSQ/STOSQ with a byte tail: any x86-64 CPU */
+
+static void *
+memcpy_movsq ( void *to, const void *from, size_t n )
 {
 	unsigned long d0, d1, d2;
 	__asm__ __volatile__(
-		"rep ; movsl\n\t"
-		"testb $2,%b4\n\t"
-		"je 1f\n\t"
-		"movsw\n"
-		"1:\ttestb $1,%b4\n\t"
-		"je 2f\n\t"
-		"movsb\n"
-		"2:"
+		"rep ; movsq\n\t"
+		"movq %4, %%rcx\n\t"
+		"andq $7, %%rcx\n\t"
+		"rep ; movsb"
 		: "=&c" (d0), "=&D" (d1), "=&S" (d2)
-		:"0" (n/4), "q" (n),"1" ((long) to),"2" ((long) from)
+		: "0" (n >> 3), "r" (n), "1" ((long) to), "2" ((long) from)
 		: "memory");
-	return (to);
+	return to;
 }
 
-void *
-memmove ( void *dest, const void *src, size_t count )
+static void *
+memset_stosq ( void *s, int c, size_t n )
+{
+	const u64 pattern = 0x0101010101010101UL * ( u8 ) c;
+	unsigned long d0, d1;
+	__asm__ __volatile__(
+		"rep ; stosq\n\t"
+		"movq %3, %%rcx\n\t"
+		"andq $7, %%rcx\n\t"
+		"rep ; stosb"
+		: "=&c" (d0), "=&D" (d1)
+		: "a" (pattern), "r" (n), "0" (n >> 3), "1" ((long) s)
+		: "memory");
+	return s;
+}
+
+static void
+clear_page_stosq ( void *page )
+{
+	memset_stosq ( page, 0, PAGE_SIZE );
+}
+
+static void
+copy_page_movsq ( void *to, const void *from )
+{
+	memcpy_movsq ( to, from, PAGE_SIZE );
+}
+
+/******************************************************/
+
+/* REP MOVSB/STOSB: fast for any size with ERMS (and for short copies 
+ * with FSRM) */
+
+static void *
+memcpy_movsb ( void *to, const void *from, size_t n )
+{
+	unsigned long d0, d1, d2;
+	__asm__ __volatile__(
+		"rep ; movsb"
+		: "=&c" (d0), "=&D" (d1), "=&S" (d2)
+		: "0" (n), "1" ((long) to), "2" ((long) from)
+		: "memory");
+	return to;
+}
+
+static void *
+memset_stosb ( void *s, int c, size_t n )
+{
+	unsigned long d0, d1;
+	__asm__ __volatile__(
+		"rep ; stosb"
+		: "=&c" (d0), "=&D" (d1)
+		: "a" (c), "0" (n), "1" ((long) s)
+		: "memory");
+	return s;
+}
+
+static void
+clear_page_stosb ( void *page )
+{
+	memset_stosb ( page, 0, PAGE_SIZE );
+}
+
+static void
+copy_page_movsb ( void *to, const void *from )
+{
+	memcpy_movsb ( to, from, PAGE_SIZE );
+}
+
+/******************************************************/
+
+/* SSE2, 64 bytes per iteration.  The VMM runs with the guest's XMM 
+ * registers loaded (VMRUN does not switch them), so the registers used 
+ * are saved and restored around each loop. */
+
+/* On the stack, which may not be 16-byte aligned */
+struct xmm_save {
+	u8 regs [ 4 ] [ 16 ];
+};
+
+static inline void
+xmm_save ( struct xmm_save *x )
+{
+	__asm__ __volatile__(
+		"movdqu %%xmm0, 0(%0)\n\t"
+		"movdqu %%xmm1, 16(%0)\n\t"
+		"movdqu %%xmm2, 32(%0)\n\t"
+		"movdqu %%xmm3, 48(%0)"
+		: : "r" (x) : "memory");
+}
+
+static inline void
+xmm_restore ( const struct xmm_save *x )
+{
+	__asm__ __volatile__(
+		"movdqu 0(%0), %%xmm0\n\t"
+		"movdqu 16(%0), %%xmm1\n\t"
+		"movdqu 32(%0), %%xmm2\n\t"
+		"movdqu 48(%0), %%xmm3"
+		: : "r" (x) : "memory", "xmm0", "xmm1", "xmm2", "xmm3");
+}
+
+/* Copy NR_BLOCKS of 64 bytes to a 16-byte aligned destination */
+static void
+copy_blocks_sse2 ( void *to, const void *from, unsigned long nr_blocks )
+{
+	struct xmm_save x;
+
+	xmm_save ( &x );
+	__asm__ __volatile__(
+		"1:\tmovdqu 0(%1), %%xmm0\n\t"
+		"movdqu 16(%1), %%xmm1\n\t"
+		"movdqu 32(%1), %%xmm2\n\t"
+		"movdqu 48(%1), %%xmm3\n\t"
+		"movdqa %%xmm0, 0(%0)\n\t"
+		"movdqa %%xmm1, 16(%0)\n\t"
+		"movdqa %%xmm2, 32(%0)\n\t"
+		"movdqa %%xmm3, 48(%0)\n\t"
+		"addq $64, %0\n\t"
+		"addq $64, %1\n\t"
+		"decq %2\n\t"
+		"jnz 1b"
+		: "+r" (to), "+r" (from), "+r" (nr_blocks)
+		: : "memory", "xmm0", "xmm1", "xmm2", "xmm3");
+	xmm_restore ( &x );
+}
+
+/* Fill NR_BLOCKS of 64 bytes at a 16-byte aligned destination */
+static void
+fill_blocks_sse2 ( void *s, const u64 *pattern, unsigned long nr_blocks )
+{
+	struct xmm_save x;
+
+	xmm_save ( &x );
+	__asm__ __volatile__(
+		"movdqu (%2), %%xmm0\n\t"
+		"1:\tmovdqa %%xmm0, 0(%0)\n\t"
+		"movdqa %%xmm0, 16(%0)\n\t"
+		"movdqa %%xmm0, 32(%0)\n\t"
+		"movdqa %%xmm0, 48(%0)\n\t"
+		"addq $64, %0\n\t"
+		"decq %1\n\t"
+		"jnz 1b"
+		: "+r" (s), "+r" (nr_blocks)
+		: "r" (pattern)
+		: "memory", "xmm0");
+	xmm_restore ( &x );
+}
+
+static void *
+memcpy_sse2 ( void *to, const void *from, size_t n )
+{
+	char *d = to;
+	const char *s = from;
+	size_t head;
+
+	if ( n < SSE_MIN_SIZE ) {
+		return memcpy_movsq ( to, from, n );
+	}
+
+	/* Align the destination */
+	head = ( - ( unsigned long ) d ) & 15;
+	memcpy_movsq ( d, s, head );
+	d += head; s += head; n -= head;
+
+	copy_blocks_sse2 ( d, s, n >> 6 );
+	memcpy_movsq ( d + ( n & ~63UL ), s + ( n & ~63UL ), n & 63 );
+	return to;
+}
+
+static void *
+memset_sse2 ( void *s, int c, size_t n )
+{
+	const u64 pattern [ 2 ] = { 0x0101010101010101UL * ( u8 ) c, 0x0101010101010101UL * ( u8 ) c };
+	char *d = s;
+	size_t head;
+
+	if ( n < SSE_MIN_SIZE ) {
+		return memset_stosq ( s, c, n );
+	}
+
+	head = ( - ( unsigned long ) d ) & 15;
+	memset_stosq ( d, c, head );
+	d += head; n -= head;
+
+	fill_blocks_sse2 ( d, pattern, n >> 6 );
+	memset_stosq ( d + ( n & ~63UL ), c, n & 63 );
+	return s;
+}
+
+static void
+clear_page_sse2 ( void *page )
+{
+	const u64 zero [ 2 ] = { 0, 0 };
+	fill_blocks_sse2 ( page, zero, PAGE_SIZE >> 6 );
+}
+
+static void
+copy_page_sse2 ( void *to, const void *from )
+{
+	copy_blocks_sse2 ( to, from, PAGE_SIZE >> 6 );
+}
+
+/******************************************************/
+
+static const struct string_ops string_ops_movsq = {
+	"rep movsq", memcpy_movsq, memset_stosq, clear_page_stosq, copy_page_movsq
+};
+
+static const struct string_ops string_ops_erms = {
+	"erms", memcpy_movsb, memset_stosb, clear_page_stosb, copy_page_movsb
+};
+
+static const struct string_ops string_ops_sse2 = {
+	"sse2", memcpy_sse2, memset_sse2, clear_page_sse2, copy_page_sse2
+};
+
+static const struct string_ops *string_ops = &string_ops_movsq;
+
+
+/* Select the variants for the boot CPU.  SSE2 must already be enabled in 
+ * CR4 when it is chosen.  */
+void
+string_init ( const struct cpuinfo_x86 *c )
 {
-	if ( dest < src ) { 
-		__inline_memcpy ( dest, src, count );
+	if ( cpu_has ( c, X86_FEATURE_ERMS ) || cpu_has ( c, X86_FEATURE_FSRM ) ) {
+		string_ops = &string_ops_erms;
+	} else if ( cpu_has ( c, X86_FEATURE_REP_GOOD ) || ! cpu_has ( c, X86_FEATURE_XMM2 ) ) {
+		string_ops = &string_ops_movsq;
 	} else {
-		char *p = (char *) dest + count;
-		char *s = (char *) src + count;
-		while ( count-- ) {
+		string_ops = &string_ops_sse2;
+	}
+
+	printf ( "String functions: %s\n", string_ops->name );
+}
+
+void *
+__memcpy ( void *to, const void *from, size_t len )
+{
+	return ( *string_ops->memcpy ) ( to, from, len );
+}
+
+/* Copy backwards (DEST above an overlapping SRC): the quadwords at the 
+ * top first, then the remaining low bytes */
+static void
+memmove_backward ( void *dest, const void *src, size_t count )
+{
+	const size_t low = count & 7;
+	unsigned long d0, d1, d2;
+
+	__asm__ __volatile__(
+		"std\n\t"
+		"rep ; movsq\n\t"
+		"cld"
+		: "=&c" (d0), "=&D" (d1), "=&S" (d2)
+		: "0" (count >> 3), "1" ((char *) dest + count - 8), "2" ((const char *) src + count - 8)
+		: "memory");
+
+	{
+		char *p = (char *) dest + low;
+		const char *s = (const char *) src + low;
+		size_t n = low;
+		while ( n-- ) {
 			*--p = *--s;
 		}
 	}
+}
+
+void *
+memmove ( void *dest, const void *src, size_t count )
+{
+	if ( ( dest <= src ) || ( ( const char * ) src + count <= ( char * ) dest ) ) {
+		( *string_ops->memcpy ) ( dest, src, count );
+	} else {
+		memmove_backward ( dest, src, count );
+	}
 	return dest;
 } 
 
 void *
-memset(void *s, int c, size_t count)
+memset ( void *s, int c, size_t count )
+{
+	return ( *string_ops->memset ) ( s, c, count );
+}
+
+void
+clear_page ( void *page )
 {
-	char *xs = s;
+	( *string_ops->clear_page ) ( page );
+}
 
-	while (count--)
-		*xs++ = c;
-	return s;
+void
+copy_page ( void *to, const void *from )
+{
+	( *string_ops->copy_page ) ( to, from );
+}
+
+int
+page_is_zero ( const void *page )
+{
+	const u64 *p = page;
+	int i;
+
+	for ( i = 0; i < PAGE_SIZE / sizeof ( u64 ); i += 4 ) {
+		if ( p [ i ] | p [ i + 1 ] | p [ i + 2 ] | p [ i + 3 ] ) {
+			return 0;
+		}
+	}
+	return 1;
 }
@@ -14,6 +14,10 @@
 /* Host save area */
 static void *host_save_area;
 
+/* Physical address of the page where svm_launch keeps the host state
+ * handled by VMSAVE/VMLOAD (FS, GS, TR, LDTR, and the SYSCALL/SYSENTER MSRs) */
+u64 host_vmcb_pa;
+
 
 void *
 alloc_host_save_area ( void )
@@ -24,7 +28,7 @@ alloc_host_save_area ( void )
 	hsa = ( void * ) VIRT ( n << PAGE_SHIFT );
 	
 	if ( hsa ) {
-		memset ( hsa, 0, PAGE_SIZE );
+		clear_page ( hsa );
 	}
 	
 	return hsa;
@@ -55,6 +59,13 @@ enable_svm ( struct cpuinfo_x86 *c )
 
 	printf ( "AMD SVM Extension is enabled.\n" );
 
+	if ( ! cpu_has ( c, X86_FEATURE_NRIPS ) ) {
+		printf ( "Next-RIP saving is not supported; falling back to the instruction decoder.\n" );
+	}
+	if ( cpu_has ( c, X86_FEATURE_DECODEASSISTS ) ) {
+		printf ( "Decode assists are supported.\n" );
+	}
+
 	/* Initialize the HSA */
 	{
 		u64 phys_hsa;
@@ -66,4 +77,6 @@ enable_svm ( struct cpuinfo_x86 *c )
 		phys_hsa_hi = ( u32 ) (phys_hsa >> 32);    
 		wrmsr ( MSR_K8_VM_HSAVE_PA, phys_hsa_lo, phys_hsa_hi ); 
 	}
+
+	host_vmcb_pa = ( u64 ) PHYS ( alloc_host_save_area ( ) );
 }
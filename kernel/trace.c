@@ -0,0 +1,90 @@
+#include "types.h"
+#include "string.h"
+#include "printf.h"
+#include "msr.h"
+#include "system.h"
+#include "page.h"
+#include "alloc.h"
+#include "cpu.h"
+#include "trace.h"
+
+
+u32 trace_mask; /* events to record; 0 unless trace= asks for some */
+
+static struct trace_ring *trace_rings [ NR_CPUS ];
+
+
+static struct trace_ring *
+trace_ring_create ( int cpu )
+{
+	const unsigned long size = ( TRACE_RING_PAGES + 1 ) << PAGE_SHIFT;
+	const unsigned long pfn  = alloc_pages ( TRACE_RING_PAGES + 1, 1 );
+	struct trace_ring *ring  = ( struct trace_ring * ) VIRT ( pfn << PAGE_SHIFT );
+	const unsigned long n    = ( TRACE_RING_PAGES << PAGE_SHIFT ) / sizeof ( struct trace_record ); /* power of 2 */
+
+	memset ( ring, 0, sizeof ( struct trace_ring ) );
+
+	ring->magic       = TRACE_MAGIC;
+	ring->version     = TRACE_VERSION;
+	ring->record_size = sizeof ( struct trace_record );
+	ring->nr_records  = n;
+	ring->cpu         = cpu;
+	ring->head        = 0;
+
+	printf ( "Trace ring: cpu=%x, paddr=%x, size=%x\n", ( unsigned long ) cpu, pfn << PAGE_SHIFT, size );
+	return ring;
+}
+
+/* MASK has bit N set to record event N (trace=<mask>).  Without any, no
+ * ring is allocated and every tracepoint stays a not-taken branch.  */
+void
+trace_init ( u32 mask )
+{
+	int cpu;
+
+	mask &= TRACE_ALL_EVENTS;
+	if ( mask == 0 ) {
+		return;
+	}
+
+	for ( cpu = 0; cpu < NR_CPUS; cpu++ ) {
+		trace_rings [ cpu ] = trace_ring_create ( cpu );
+	}
+
+	trace_enable ( mask );
+}
+
+void
+trace_enable ( u32 mask )
+{
+	trace_mask = mask;
+}
+
+/* Only the owning CPU writes its ring, so no lock is needed.  The
+ * record is filled before HEAD is advanced; a reader takes HEAD
+ * first and skips the slot being written. */
+void
+trace_write ( enum trace_event event, u32 arg0, u64 arg1, u64 arg2 )
+{
+	const int cpu = smp_processor_id ( );
+	struct trace_ring *ring = trace_rings [ cpu ];
+	struct trace_record *rec;
+	u64 tsc;
+
+	if ( ring == NULL ) {
+		return;
+	}
+
+	rec = &ring->records [ ring->head & ( ring->nr_records - 1 ) ];
+
+	rdtscll ( tsc );
+	rec->tsc   = tsc;
+	rec->cpu   = cpu;
+	rec->event = event;
+	rec->arg0  = arg0;
+	rec->arg1  = arg1;
+	rec->arg2  = arg2;
+
+	barrier ( );
+	ring->head++;
+}
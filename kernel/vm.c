@@ -11,6 +11,25 @@
 #include "alloc.h"
 #include "vmexit.h"
 #include "vmm.h"
+#include "msrpm.h"
+#include "ioport.h"
+#include "debugcon.h"
+#include "vmstat.h"
+#include "trace.h"
+#include "bootprof.h"
+#include "sos.h"
+#include "profile.h"
+#include "pmu.h"
+#include "memacct.h"
+#include "statpage.h"
+#include "bulkmem.h"
+#include "cpufeature.h"
+#include "bitops.h"
+#include "cpu.h"
+#include "snapshot.h"
+#include "zpool.h"
+#include "reclaim.h"
+#include "apic.h"
 
 
 static struct vmcb *
@@ -18,27 +37,17 @@ alloc_vmcb ( void )
 {
 	struct vmcb *vmcb;
 
+	memacct_type ( MEM_VMCB );
 	const unsigned long pfn = alloc_pages ( 1, 1 );
 	vmcb = ( struct vmcb * ) VIRT ( pfn << PAGE_SHIFT );
 	memset ( ( char * ) vmcb, 0, sizeof ( struct vmcb ) );
+	bootprof_zeroed ( 1 );
 
 	return vmcb;
 }
 
-static unsigned long 
-create_intercept_table ( unsigned long size )
-{
-	const unsigned long pfn = alloc_pages ( size >> PAGE_SHIFT, 1 );
-	void *p = ( void * ) VIRT ( pfn << PAGE_SHIFT );
-
-	/* vol. 2, p. 445 */
-	memset ( p, 0xff, size );
-
-	return pfn << PAGE_SHIFT; 
-}
-
 static void	
-set_control_area ( struct vmcb *vmcb )
+set_control_area ( struct vm *vm, struct vmcb *vmcb )
 {
 	/* Enable nested paging (See AMD64 manual Vol. 3, p. 488) */
 	vmcb->np_enable = 1; 
@@ -50,15 +59,22 @@ set_control_area ( struct vmcb *vmcb )
 	/* To be added in RDTSC and RDTSCP */
 	vmcb->tsc_offset = 0; 
 	
-	/* Guest address space identifier (ASID) */
-	vmcb->guest_asid = 1;
+	/* Guest address space identifier (ASID); 0 is the host's */
+	vmcb->guest_asid = vm->id + 1;
+
+	/* Intercept physical interrupts, CPUID (answered from the per-VM table), 
+	 * HLT, the I/O ports and MSRs selected by the permission maps, and shutdown */
+	vmcb->general1_intercepts = INTRCPT_INTR | INTRCPT_CPUID | INTRCPT_HLT | INTRCPT_IOIO_PROT | INTRCPT_MSR_PROT | INTRCPT_SHUTDOWN;
+
+	/* Physical interrupts are masked by the host's RFLAGS.IF, not the guest's */
+	vmcb->vintr.fields.intr_masking = 1;
 
 	/* Intecept the VMRUN instruction */
-	vmcb->general2_intercepts = INTRCPT_VMRUN;
+	vmcb->general2_intercepts = INTRCPT_VMRUN | INTRCPT_VMMCALL;
 
 	/* [REF] vol.2, p. 454 */
-	vmcb->iopm_base_pa  = create_intercept_table ( 12 << 10 ); /* 12 Kbytes */
-	vmcb->msrpm_base_pa = create_intercept_table ( 8 << 10 );  /* 8 Kbytes */
+	vmcb->iopm_base_pa  = ioport_iopm_base ( &vm->io );
+	vmcb->msrpm_base_pa = msrpm_create ( );
 }
 
 /* Setup the segment registers and all their hidden states 
@@ -106,7 +122,7 @@ set_state_save_area ( struct vmcb *vmcb )
 
 	/* Bit 31 (PG) must be cleared.  Bit 0 (PE) must be set. Other bits are all undefined. */
 	vmcb->cr0 = X86_CR0_PE | X86_CR0_PG; 
-	vmcb->cr3 = 0x200000 + PAGE_SIZE * 3; // dummy
+	vmcb->cr3 = SOS_PGTABLE_PADDR;
 	vmcb->cr4 = X86_CR4_PAE;
 
 	/* Bit 17 (VM) must be cleared. Bit 9 (IF) must be cleared.  Other bits are all undefined */
@@ -119,10 +135,24 @@ set_state_save_area ( struct vmcb *vmcb )
 	set_descriptors ( vmcb );
 }
 
+/* Ports the guest drives directly, and the devices emulated by the VMM */
+static void
+init_io_space ( struct io_space *io, struct vm *vm )
+{
+	ioport_init ( io );
+
+	ioport_passthrough ( io, 0x3b0, 0x30 ); /* VGA */
+	ioport_passthrough ( io, 0x80, 1 );     /* POST code / I/O delay */
+
+	debugcon_init ( vm );
+}
+
 static unsigned long
 alloc_vm_pmem ( unsigned long size )
 {
 	const unsigned long align = 1 << ( PAGE_SHIFT_2MB - PAGE_SHIFT ); /* alignment for 2 MB page table  */
+
+	memacct_type ( MEM_GUEST_RAM );
 	const unsigned long pfn   = alloc_pages ( size >> PAGE_SHIFT, align );
 	return ( unsigned long ) VIRT ( pfn << PAGE_SHIFT );
 }
@@ -145,30 +175,146 @@ is_reserved_pmem ( unsigned long pfn )
 	return ( pfn == 0 );
 }
 
+/* Is GPA passed through to the same host physical address? */
+int
+vm_gpa_is_passthrough ( unsigned long gpa )
+{
+	return is_reserved_pmem ( PFN_DOWN_2MB ( gpa ) );
+}
+
+/* The host frame that holds guest page GPA, or VM_NO_FRAME */
+unsigned long
+vm_page_frame ( const struct vm *vm, unsigned long gpa )
+{
+	const unsigned long pfn = PFN_DOWN ( gpa );
+
+	if ( ( vm->frames == NULL ) || ( vm->frames [ pfn ] == 0 ) ) {
+		return PFN_DOWN ( PHYS ( vm->pmem_start ) ) + pfn;
+	}
+	return vm->frames [ pfn ];
+}
+
+/* Record that guest page GPA moved to host frame PFN (VM_NO_FRAME: none).
+ * Not to be called between memacct_begin and memacct_end.  */
+void
+vm_set_page_frame ( struct vm *vm, unsigned long gpa, unsigned long pfn )
+{
+	const unsigned long size = PFN_DOWN ( vm->pmem_size ) * sizeof ( u32 );
+
+	if ( vm->frames == NULL ) {
+		memacct_begin ( &vm->mem, MEM_VCPU );
+		vm->frames = ( u32 * ) VIRT ( alloc_pages ( PFN_UP ( size ), 1 ) << PAGE_SHIFT );
+		memacct_end ( );
+		memset ( vm->frames, 0, size );
+	}
+	vm->frames [ PFN_DOWN ( gpa ) ] = pfn;
+}
+
+/* A write to a guest page mapped read-only to the image frames (see 
+ * map_elf_segment): copy it to the page's own frame and map that one 
+ * writable.  Returns -1 if GPA is not such a page.  */
+int
+vm_unshare_page ( struct vm *vm, unsigned long gpa )
+{
+	const unsigned long pml4 = ( unsigned long ) VIRT ( vm->h_cr3 );
+	unsigned long paddr, flags, pfn;
+
+	if ( ( gpa >= vm->pmem_size ) || ( pgt_lookup ( pml4, gpa, &paddr, &flags ) != 0 ) || ( flags & PTTEF_RW ) ) {
+		return -1;
+	}
+	pfn = vm_page_frame ( vm, gpa );
+	if ( ( pfn == VM_NO_FRAME ) || ( PFN_PHYS ( pfn ) == PAGE_DOWN ( paddr ) ) ) {
+		return -1;
+	}
+
+	memmove ( VIRT ( PFN_PHYS ( pfn ) ), VIRT ( PAGE_DOWN ( paddr ) ), PAGE_SIZE );
+
+	memacct_begin ( &vm->mem, MEM_NPT );
+	mmap_page ( pml4, PAGE_DOWN ( gpa ), PFN_PHYS ( pfn ), PGT_LEVEL_PT, PTTEF_RW | PTTEF_US );
+	memacct_end ( );
+	return 0;
+}
+
+/* The largest page allowed by MODE that maps VM_PADDR to PM_PADDR and 
+ * ends at or below END, given as the level of its entry.  */
+static enum pg_table_level
+npt_leaf_level ( enum npt_mode mode, unsigned long vm_paddr, unsigned long pm_paddr, unsigned long end )
+{
+	enum pg_table_level level;
+
+	switch ( mode ) {
+	case NPT_MODE_1G:  level = PGT_LEVEL_PDP; break;
+	case NPT_MODE_2M:  level = PGT_LEVEL_PD;  break;
+	case NPT_MODE_MIX: level = ( PFN_DOWN_2MB ( vm_paddr ) & 1 ) ? PGT_LEVEL_PT : PGT_LEVEL_PD; break;
+	default:           level = PGT_LEVEL_PT;  break;
+	}
+
+	for ( ; level > PGT_LEVEL_PT; level-- ) {
+		const unsigned long size = pgt_level_page_size ( level );
+
+		if ( ( ( ( vm_paddr | pm_paddr ) & ( size - 1 ) ) == 0 ) && ( vm_paddr + size <= end ) ) {
+			break;
+		}
+	}
+	return level;
+}
+
+/* Map the VM's physical memory in [START, END) in the nested page table 
+ * at PML4 (a VMM virtual address), in the largest pages the mode allows.  
+ * Existing mappings are replaced; tables allocated go to the current 
+ * memory account.  */
+void
+vm_map_pmem_range ( struct vm *vm, unsigned long pml4, unsigned long start, unsigned long end )
+{
+	const unsigned long vm_pmem_start = vm->pmem_start;
+	unsigned long vm_paddr = start;
+
+	while ( vm_paddr < end ) {
+		const int reserved = is_reserved_pmem ( PFN_DOWN_2MB ( vm_paddr ) ); /* for VGA (too naive) */
+		const unsigned long pm_paddr = vm_paddr + ( reserved ? 0 : PHYS ( vm_pmem_start ) );
+		const unsigned long limit = reserved ? PAGE_SIZE_2MB : end;
+		const enum pg_table_level level = npt_leaf_level ( vm->npt_mode, vm_paddr, pm_paddr, limit );
+
+		mmap_page ( pml4, vm_paddr, pm_paddr, level, PTTEF_RW | PTTEF_US );
+		vm->npt_pages [ level - PGT_LEVEL_PT ]++;
+
+		vm_paddr += pgt_level_page_size ( level );
+	}
+}
+
+/* Map all of the VM's physical memory, a range at a time */
+void
+vm_map_pmem ( struct vm *vm, unsigned long pml4 )
+{
+	memset ( vm->npt_pages, 0, sizeof ( vm->npt_pages ) );
+	vm_map_pmem_range ( vm, pml4, 0, vm->pmem_size );
+}
+
 /* Create a page table that maps VM's physical addresses to PM's physical address and 
  * return the (PM's) physical base address of the table.  */
 static unsigned long 
-create_vm_pmem_mapping_table ( unsigned long vm_pmem_start, unsigned long vm_pmem_size )
+create_vm_pmem_mapping_table ( struct vm *vm )
 {
-	const unsigned long cr3  = pml4_table_create ( );
-	const unsigned long pml4 = ( unsigned long ) VIRT ( cr3 );
-	const unsigned long vm_pmem_pfn = PFN_DOWN_2MB ( PHYS ( vm_pmem_start ) );
-	int i;
+	memacct_type ( MEM_NPT );
 
-	for ( i = 0; i < PFN_UP_2MB ( vm_pmem_size ); i++ ) {
-		const unsigned long vm_paddr = i << PAGE_SHIFT_2MB;
-		const unsigned long pm_pfn   = i + ( is_reserved_pmem ( i ) ? 0 : vm_pmem_pfn ); /* for VGA (too naive) */
-		const unsigned long pm_paddr = pm_pfn << PAGE_SHIFT_2MB;
+	const unsigned long cr3  = pml4_table_create ( );
 
-		mmap ( pml4, vm_paddr, pm_paddr, 1 /* is_user */ );
+	if ( ( vm->npt_mode == NPT_MODE_1G ) && ( ! cpu_has_gbpages ) ) {
+		printf ( "1-Gbyte pages are not supported; using 2-Mbyte pages.\n" );
+		vm->npt_mode = NPT_MODE_2M;
 	}
 
-	printf ( "Page table for nested paging created.\n" );
+	vm_map_pmem ( vm, ( unsigned long ) VIRT ( cr3 ) );
+
+	printf ( "Page table for nested paging created (mode=%x, 4k=%x, 2m=%x, 1g=%x).\n", 
+		 ( unsigned long ) vm->npt_mode, vm->npt_pages [ 0 ], vm->npt_pages [ 1 ], vm->npt_pages [ 2 ] );
 	return cr3;
 }
 
+/* Identity-map the guest memory of PMEM_SIZE bytes and the start of the 
+ * MMIO hole above it (see sos.h) */
 static void
-create_temp_page_table ( unsigned long vm_pmem_start, unsigned long cr3 ) 
+create_temp_page_table ( unsigned long vm_pmem_start, unsigned long pmem_size, unsigned long cr3 ) 
 {
 	const unsigned long base = vm_pmem_start + cr3;
 	int i;
@@ -176,122 +322,317 @@ create_temp_page_table ( unsigned long vm_pmem_start, unsigned long cr3 )
 	printf ( "Temporal page table for virtual machine created.\n" );	
 	
 	for ( i = 0; i < 3; i++ ) {
-		memset ( ( char * ) ( base + PAGE_SIZE * i ), 0, PAGE_SIZE );
+		clear_page ( ( void * ) ( base + PAGE_SIZE * i ) );
 	}
+	bootprof_zeroed ( 3 );
 	
 	union pgt_entry *e;
 	
-	// page-map level-4 entry 
+	// page-map level-4 entry: the low addresses and the VMM_OFFSET alias, 
+	// at which the guest image is linked, share the page-directory-pointer table
 	e = ( union pgt_entry * ) ( base );
 	e->non_term.base  = ( cr3 + PAGE_SIZE ) >> PAGE_SHIFT;
 	e->non_term.flags = PTTEF_PRESENT | PTTEF_RW;
+
+	e = ( union pgt_entry * ) ( base ) + ( ( VMM_OFFSET >> 39 ) & 0x1ff );
+	e->non_term.base  = ( cr3 + PAGE_SIZE ) >> PAGE_SHIFT;
+	e->non_term.flags = PTTEF_PRESENT | PTTEF_RW;
 	
 	// page-directory-pointer 
 	e = ( union pgt_entry * ) ( base + PAGE_SIZE );
 	e->non_term.base  = ( cr3 + PAGE_SIZE * 2 ) >> PAGE_SHIFT;
 	e->non_term.flags = PTTEF_PRESENT | PTTEF_RW;
 	
-	// page-directory-pointer 
-	e = ( union pgt_entry * ) ( base + PAGE_SIZE * 2 );
-	e->term.base  = 0;
-	e->term.flags = PTTEF_PRESENT | PTTEF_RW | PTTEF_PAGE_SIZE;
-	
-	// page-directory-pointer
-	e = ( union pgt_entry * ) ( base + PAGE_SIZE * 2 + sizeof ( union pgt_entry ) );
-	e->term.base  = 1;
-	e->term.flags = PTTEF_PRESENT | PTTEF_RW | PTTEF_PAGE_SIZE;
+	// page-directory entries (identity mapping with 2-Mbyte pages)
+	for ( i = 0; i < PFN_UP_2MB ( pmem_size + SOS_HOLE_SIZE ); i++ ) {
+		e = ( union pgt_entry * ) ( base + PAGE_SIZE * 2 ) + i;
+		e->term.base  = i;
+		e->term.flags = PTTEF_PRESENT | PTTEF_RW | PTTEF_PAGE_SIZE;
+	}
 }
 
 void
-vm_create ( struct vm *vm, unsigned long guest_image_start, unsigned long guest_image_size, unsigned long vm_pmem_size )
+vm_create ( struct vm *vm, int id, const struct vm_config *cfg )
 {
+	const unsigned long vm_pmem_size = cfg->pmem_size;
 	struct vmcb *vmcb;
 
+	bootprof_phase ( BOOT_PHASE_VM_CONTROL );
+
+	/* Charge everything allocated from here on to the VM */
+	memset ( &vm->mem, 0, sizeof ( struct mem_account ) );
+	memacct_begin ( &vm->mem, MEM_VCPU );
+	memacct_charge ( &vm->mem, MEM_VCPU, sizeof ( struct vm ) );
+
 	/* Allocate a new page for storing VMCB.  */
 	vmcb = alloc_vmcb ( );
 	vm->vmcb = vmcb;
+	vm->id        = id;
+	vm->running   = 0;
+	vm->nr_vcpus  = 1;
+	vm->nr_slices = 0;
+	vm->pmem_size = vm_pmem_size;
+	vm->npt_mode  = cfg->npt_mode;
+	vm->statpage_gpa = 0;
+	vm->snapshot  = NULL;
+	vm->zpool     = NULL;
+	vm->frames    = NULL;
+
+	if ( cfg->nr_vcpus > 1 ) {
+		printf ( "VM %x: %x vCPUs requested; only one is supported.\n", ( unsigned long ) id, cfg->nr_vcpus );
+	}
 
-	set_control_area ( vm->vmcb );
+	init_io_space ( &vm->io, vm );
+	set_control_area ( vm, vm->vmcb );
 	set_state_save_area ( vm->vmcb );
+	memset ( &vm->regs, 0, sizeof ( struct vcpu_regs ) );
+	vmstat_init ( &vm->stats );
+	guest_msrs_init ( &vm->msrs );
+
+	cpuid_table_init ( &vm->cpuid );
+
+	bootprof_phase ( BOOT_PHASE_VM_PMEM );
 
 	/* Allocate new pages for physical memory of the guest OS.  */
 	const unsigned long vm_pmem_start = alloc_vm_pmem ( vm_pmem_size );
+	vm->pmem_start = vm_pmem_start;
+
+	/* The guest expects zeroed RAM.  */
+	bulk_clear ( ( void * ) vm_pmem_start, vm_pmem_size );
 
 	/* Set Host-level CR3 to use for nested paging.  */
-	vm->h_cr3   = create_vm_pmem_mapping_table ( vm_pmem_start, vm_pmem_size );
+	vm->h_cr3   = create_vm_pmem_mapping_table ( vm );
 	vmcb->h_cr3 = vm->h_cr3;
 
-	/* Copy the OS image to the specified region by interpreting the ELF format.  */
-	vmcb->rip = load_elf_image ( guest_image_start, guest_image_size, vm_pmem_start );
+	bootprof_phase ( BOOT_PHASE_VM_LOAD_IMAGE );
+
+	/* Copy (or map) the OS image to the specified region by interpreting the ELF format.  */
+	vmcb->rip = load_elf_image ( vm, cfg->image_start, cfg->image_size, vm_pmem_start );
 
 	/* Setup multiboot info.  */
 	vm->mbi = init_vm_mbi ( vm_pmem_start );
 
-	create_temp_page_table ( vm_pmem_start, vmcb->cr3 );
+	create_temp_page_table ( vm_pmem_start, vm_pmem_size, vmcb->cr3 );
+
+	memacct_end ( );
+
+	TRACE ( TRACE_VM_CREATE, id, PHYS ( vmcb ), vm_pmem_size );
+
+	printf ( "New virtual machine created (id=%x, memory=%x).\n", ( unsigned long ) id, vm_pmem_size ); 	
+}
+
+static void
+release_npt_table ( void *arg, unsigned long pfn )
+{
+	struct vm *vm = arg;
+
+	reclaim_pages ( &vm->mem, MEM_NPT, pfn, 1 );
+}
+
+/* Guest RAM is one block unless pages have moved */
+static void
+release_guest_ram ( struct vm *vm )
+{
+	const unsigned long home = PFN_DOWN ( PHYS ( vm->pmem_start ) );
+	const unsigned long nr = PFN_DOWN ( vm->pmem_size );
+	unsigned long i, run;
+
+	if ( vm->frames == NULL ) {
+		reclaim_pages ( &vm->mem, MEM_GUEST_RAM, home, nr );
+		return;
+	}
+
+	for ( i = 0; i < nr; i += run ) {
+		run = 1;
+		if ( vm->frames [ i ] == VM_NO_FRAME ) {
+			continue;
+		}
+		if ( vm->frames [ i ] != 0 ) {
+			reclaim_pages ( &vm->mem, MEM_GUEST_RAM, vm->frames [ i ], 1 );
+			continue;
+		}
+		while ( ( i + run < nr ) && ( vm->frames [ i + run ] == 0 ) ) {
+			run++;
+		}
+		reclaim_pages ( &vm->mem, MEM_GUEST_RAM, home + i, run );
+	}
+
+	reclaim_pages ( &vm->mem, MEM_VCPU, PFN_DOWN ( PHYS ( vm->frames ) ), PFN_UP ( nr * sizeof ( u32 ) ) );
+	vm->frames = NULL;
+}
+
+/* Take a stopped VM apart.  Its memory is queued for the reclaimer, which 
+ * scrubs and frees it later, so this costs a walk of the nested page 
+ * table and no more.  [Note] Every VMRUN flushes the TLB entries of all 
+ * ASIDs (tlb_control), so no translation tagged with the VM's ASID can 
+ * outlive it.  */
+void
+vm_destroy ( struct vm *vm )
+{
+	struct vmcb *vmcb = vm->vmcb;
+	const u64 charged = memacct_total ( &vm->mem );
+	u64 start, end;
+
+	rdtscll ( start );
+
+	vm->running      = 0;
+	vm->statpage_gpa = 0;
+
+	snapshot_destroy ( vm );
+	profile_destroy ( vm );
+	pml4_table_destroy ( ( unsigned long ) VIRT ( vm->h_cr3 ), release_npt_table, vm );
+
+	zpool_destroy ( vm );
+	release_guest_ram ( vm );
+	reclaim_pages ( &vm->mem, MEM_DEVICE, PFN_DOWN ( PHYS ( vm->io.port_map ) ), PFN_UP ( NR_IO_PORTS ) );
+	reclaim_pages ( &vm->mem, MEM_IOPM, PFN_DOWN ( vmcb->iopm_base_pa ), PFN_UP ( IOPM_SIZE ) );
+	reclaim_pages ( &vm->mem, MEM_MSRPM, PFN_DOWN ( vmcb->msrpm_base_pa ), PFN_UP ( MSRPM_SIZE ) );
+	reclaim_pages ( &vm->mem, MEM_VMCB, PFN_DOWN ( PHYS ( vmcb ) ), 1 );
+
+	/* struct vm itself is not allocated */
+	memacct_release ( &vm->mem, MEM_VCPU, sizeof ( struct vm ) );
+	memacct_freed ( MEM_VCPU, sizeof ( struct vm ) );
+
+	vm->vmcb        = NULL;
+	vm->h_cr3       = 0;
+	vm->pmem_start  = 0;
+	vm->io.iopm     = NULL;
+	vm->io.port_map = NULL;
+
+	rdtscll ( end );
 
-	printf ( "New virtual machine created.\n" ); 	
+	TRACE ( TRACE_VM_DESTROY, vm->id, PHYS ( vmcb ), PFN_DOWN ( charged - sizeof ( struct vm ) ) );
+
+	/* Whatever is left in the account was not given back */
+	printf ( "VM %x destroyed (reclaim=%x, leaked=%x, cycles=%x).\n", 
+		 ( unsigned long ) vm->id, PFN_DOWN ( charged - sizeof ( struct vm ) - memacct_total ( &vm->mem ) ), 
+		 memacct_total ( &vm->mem ), end - start );
 }
 
 /******************************************************/
 
+u64 vm_slice_end = ~0UL;
+
 static void
 switch_to_guest_os ( struct vm *vm )
 {
 	u64 p_vmcb = PHYS ( vm->vmcb );
-	svm_launch ( p_vmcb );
+	svm_launch ( p_vmcb, &vm->regs, vm );
 }
 
-static void
-handle_vmexit ( struct vm *vm )
+/* Run VM until it stops or its slice is over; return 0 once it has stopped */
+static int
+run_slice ( struct vm *vm, int preempt )
 {
-	printf ( "********************\n" );
-	
+	u64 now;
 
-	print_vmexit_exitcode ( vm->vmcb->exitcode );
-	printf ( "VMCB: rip=%x\n", vm->vmcb->rip );
+	vm->nr_slices++;
+	rdtscll ( now );
+	vm_slice_end = preempt ? now + VM_SLICE_CYCLES : ~0UL;
 
-	printf ( "cpl=%x\n", vm->vmcb->cpl );
-	printf ( "cr0=%x, cr3=%x, cr4=%x\n", vm->vmcb->cr0, vm->vmcb->cr3, vm->vmcb->cr4 );
-	printf ( "rflags=%x, efer=%x\n", vm->vmcb->rflags, vm->vmcb->efer );
+	/* The previous slice may have been another VM's */
+	guest_msrs_load ( vm );
 
-	printf ( "cs.attrs=%x, ds.attrs=%x\n", vm->vmcb->cs.attrs.bytes, vm->vmcb->ds.attrs.bytes );
+	do {
+		/* [TODO] setup registers (set %ebx to mbi address) */
 
-	printf ( "error_code=%x, fault address=%x\n", vm->vmcb->exitinfo1, vm->vmcb->exitinfo2 );
+		switch_to_guest_os ( vm );
 
-	/* p. 268, p.490 */
-	if ( vm->vmcb->exitinfo1 & 1 ) {
-		printf ( "page fault was caused by a page-protection violation\n" );
-	} else {
-		printf ( "page fault was caused by a not-present page\n" );
-	}
+		if ( handle_vmexit ( vm ) != 0 ) {
+			return 0;
+		}
 
-	if ( vm->vmcb->exitinfo1 & 2 ) {
-		printf ( "memory access was write\n" );
-	} else {
-		printf ( "memory access was read\n" );
-	}
+		/* Lazy restores proceed a chunk per exit */
+		snapshot_prefetch ( vm );
+
+		rdtscll ( now );
+		if ( unlikely ( ( vm->zpool != NULL ) && ( now >= vm->zpool->next_scan ) ) ) {
+			zpool_scan ( vm, now );
+		}
+	} while ( now < vm_slice_end );
+
+	return 1;
+}
+
+static void
+vm_stop ( struct vm *vm )
+{
+	u64 now;
 
-	if ( vm->vmcb->exitinfo1 & 4 ) {
-		printf ( "an access in user mode caused the page fault\n" );
+	vm->running = 0;
+	TRACE ( TRACE_VM_STOP, vm->vmcb->exitcode, vm->vmcb->rip, 0 );
+
+	printf ( "VM %x stopped (slices=%x).\n", ( unsigned long ) vm->id, vm->nr_slices );
+
+	/* Leave the final counters to the management guest */
+	rdtscll ( now );
+	statpage_update ( vm, now );
+
+	vmstat_dump ( vm );
+	profile_dump ( vm );
+	zpool_dump ( vm );
+	balloon_dump ( vm );
+	memacct_print_vm ( &vm->mem );
+}
+
+/* Arm or disarm the timer that bounds slices.  The profiling timer, when
+ * there is one, runs all along and does the same.  */
+static void
+slice_timer ( const struct vm *vms, int on )
+{
+	if ( vms [ 0 ].profile.buf != NULL ) {
+		return;
+	}
+	if ( on ) {
+		lapic_timer_start ( VM_SLICE_TIMER );
 	} else {
-		printf ( "an access in supervisor mode caused the page fault\n" );
+		lapic_timer_stop ( );
 	}
 }
 
+/* Boot the VMS and share this CPU among them round-robin until all have 
+ * stopped.  A lone VM is never preempted.  */
 void
-vm_boot ( struct vm *vm )
+vm_boot ( struct vm *vms, int nr_vms )
 {
-	printf ( "Booting guest operating system...\n\n" ); 
-
-	vmcb_check_consistency ( vm->vmcb );
+	int nr_running = nr_vms;
+	int i;
 
-	while ( 1 ) {
-		/* [TODO] setup registers (set %ebx to mbi address) */
+	for ( i = 0; i < nr_vms; i++ ) {
+		vmcb_check_consistency ( vms [ i ].vmcb );
+		TRACE ( TRACE_VM_BOOT, i, vms [ i ].vmcb->rip, 0 );
+		vms [ i ].running = 1;
+	}
 
-		switch_to_guest_os ( vm );
+	printf ( "Booting guest operating system...\n\n" ); 
 
-		handle_vmexit ( vm );
+	/* The profiling timer runs for all of them (same period) */
+	profile_start ( &vms [ 0 ] );
+	if ( nr_running > 1 ) {
+		slice_timer ( vms, 1 );
+	}
 
-		break; /* [DEBUG] */
+	for ( i = 0; nr_running > 0; i = ( i + 1 ) % nr_vms ) {
+		struct vm *vm = &vms [ i ];
+
+		if ( ! vm->running ) {
+			continue;
+		}
+		if ( run_slice ( vm, nr_running > 1 ) == 0 ) {
+			if ( --nr_running == 1 ) {
+				slice_timer ( vms, 0 );
+			}
+			if ( nr_running == 0 ) {
+				profile_stop ( vm );
+			}
+			vm_stop ( vm );
+			vm_destroy ( vm );
+		}
+
+		/* The reclaimer runs between slices */
+		reclaim_run ( RECLAIM_BATCH_PAGES );
 	}
+
+	reclaim_drain ( );
+	pmu_dump ( );
 }
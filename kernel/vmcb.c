@@ -47,10 +47,27 @@ check_dr7_32_63 ( const struct vmcb *vmcb )
 	return ( SUB_BIT ( vmcb->dr7, 32, 32 ) );
 }
 
+/* Bits 1-7 and 9 of EFER are reserved as well (vol. 2, p. 55), but only
+ * those above 14 fail VMRUN */
+#define EFER_RSVD_LOW	( BIT_MASK ( 7 ) << 1 | 1UL << 9 )
+
+static int
+efer_15_63_set ( u64 efer )
+{
+	return ( SUB_BIT ( efer, 15, 49 ) != 0 );
+}
+
 static int
 check_efer_15_63 ( const struct vmcb *vmcb )
 {
-	return ( SUB_BIT ( vmcb->efer, 15, 49 ) );
+	return efer_15_63_set ( vmcb->efer );
+}
+
+/* G_PAT is checked when nested paging is enabled */
+static int
+check_g_pat ( const struct vmcb *vmcb )
+{
+	return ( ! vmcb_pat_is_valid ( vmcb->g_pat ) );
 }
 
 static int
@@ -109,6 +126,30 @@ check_misc ( const struct vmcb *vmcb )
 }
 #endif
 
+/* For guest WRMSRs, which must fail with #GP rather than let VMRUN fail */
+int
+vmcb_efer_is_valid ( u64 efer )
+{
+	return ( ! efer_15_63_set ( efer ) ) && ( ! ( efer & EFER_RSVD_LOW ) );
+}
+
+/* Each byte of a PAT must be a memory type: 0 (UC), 1 (WC), 4 (WT), 5 (WP), 
+ * 6 (WB) or 7 (UC-) */
+int
+vmcb_pat_is_valid ( u64 pat )
+{
+	int i;
+
+	for ( i = 0; i < 8; i++ ) {
+		const unsigned long type = SUB_BIT ( pat, i * 8, 8 );
+
+		if ( ( type == 2 ) || ( type == 3 ) || ( type > 7 ) ) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
 struct consistencty_check {
 	int ( *func ) ( const struct vmcb *vmcb );
 	char *error_msg;
@@ -125,6 +166,7 @@ vmcb_check_consistency ( struct vmcb *vmcb )
 		    { &check_dr6_32_63,   "DR6[32:63] are not zero.\n" },
 		    { &check_dr7_32_63,   "DR7[32:63] are not zero.\n" },
 		    { &check_efer_15_63,  "EFER[15:63] are not zero.\n" },
+		    { &check_g_pat,       "G_PAT holds an invalid memory type.\n" },
 		    { &check_eferlme_cr0pg_cr4pae, "EFER.LME is set, CR0.PG is set, and CR4.PAE is not set.\n" },
 		    { &check_eferlme_cr0pg_cr0pe,  "EFER.LME is set, CR0.PG is set, and CR4.PE is not set.\n" },
 		    { &check_eferlme_cr0pg_cr4pae_csl_csd, "EFER.LME, CR0.PG, CR4.PAE, CS.L, and CS.D are set.\n" },
@@ -143,6 +185,24 @@ vmcb_check_consistency ( struct vmcb *vmcb )
 
 /********************************************************************************************/
 
+/* Inject an exception on the next VMRUN (vol. 2, p. 468) */
+void
+vmcb_inject_exception ( struct vmcb *vmcb, int vector, int has_error_code, u32 error_code )
+{
+	union eventinj e;
+
+	e.bytes            = 0;
+	e.fields.vector    = vector;
+	e.fields.type      = EVENTTYPE_EXCEPTION;
+	e.fields.ev        = ( has_error_code ? 1 : 0 );
+	e.fields.v         = 1;
+	e.fields.errorcode = error_code;
+
+	vmcb->eventinj = e;
+}
+
+/********************************************************************************************/
+
 static void
 seg_selector_dump ( char *name, const struct seg_selector *s )
 {
@@ -177,6 +237,8 @@ vmcb_dump( const struct vmcb *vmcb )
 	       (unsigned long long) vmcb->exitinfo2);
 	printf("np_enable = %x guest_asid = %x\n", 
 	       (unsigned long long) vmcb->np_enable, vmcb->guest_asid);
+	printf("nrip = %x guest_ins_len = %x\n",
+	       (unsigned long long) vmcb->nrip, vmcb->guest_ins_len);
 	printf("cpl = %x efer = %x star = %x lstar = %x\n", 
 	       vmcb->cpl, (unsigned long long) vmcb->efer,
 	       (unsigned long long) vmcb->star, (unsigned long long) vmcb->lstar);
@@ -1,5 +1,23 @@
+#include "types.h"
 #include "printf.h"
+#include "msr.h"
+#include "cpufeature.h"
+#include "cpu.h"
+#include "vmcb.h"
+#include "vm.h"
+#include "cpuid.h"
+#include "msrpm.h"
+#include "ioport.h"
+#include "npf.h"
+#include "emulate.h"
+#include "idt.h"
+#include "profile.h"
+#include "pmu.h"
+#include "hypercall.h"
 #include "vmexit.h"
+#include "vmstat.h"
+#include "trace.h"
+#include "statpage.h"
 
 
 void
@@ -10,9 +28,173 @@ print_vmexit_exitcode ( enum vmexit_exitcode x )
 	switch ( x ) {
 	case VMEXIT_EXCEPTION_PF: printf ( "EXCP (page fault)" ); break;
 	case VMEXIT_NPF:          printf ( "NPF (nested-paging: host-level page fault)" ); break;
+	case VMEXIT_SHUTDOWN:     printf ( "SHUTDOWN" ); break;
 	case VMEXIT_INVALID:      printf ( "INVALID" ); break;
 	default:                  printf ( "%x", ( unsigned long ) x ); break;
 	}
 
 	printf ( "\n" );
 }
+
+/* Report an exit the VMM does not handle and stop the guest. */
+static int
+handle_unknown_vmexit ( struct vm *vm )
+{
+	printf ( "********************\n" );
+
+	print_vmexit_exitcode ( vm->vmcb->exitcode );
+	printf ( "VMCB: rip=%x\n", vm->vmcb->rip );
+
+	printf ( "cpl=%x\n", vm->vmcb->cpl );
+	printf ( "cr0=%x, cr3=%x, cr4=%x\n", vm->vmcb->cr0, vm->vmcb->cr3, vm->vmcb->cr4 );
+	printf ( "rflags=%x, efer=%x\n", vm->vmcb->rflags, vm->vmcb->efer );
+
+	printf ( "cs.attrs=%x, ds.attrs=%x\n", vm->vmcb->cs.attrs.bytes, vm->vmcb->ds.attrs.bytes );
+
+	printf ( "error_code=%x, fault address=%x\n", vm->vmcb->exitinfo1, vm->vmcb->exitinfo2 );
+
+	/* p. 268, p.490 */
+	if ( vm->vmcb->exitinfo1 & 1 ) {
+		printf ( "page fault was caused by a page-protection violation\n" );
+	} else {
+		printf ( "page fault was caused by a not-present page\n" );
+	}
+
+	if ( vm->vmcb->exitinfo1 & 2 ) {
+		printf ( "memory access was write\n" );
+	} else {
+		printf ( "memory access was read\n" );
+	}
+
+	if ( vm->vmcb->exitinfo1 & 4 ) {
+		printf ( "an access in user mode caused the page fault\n" );
+	} else {
+		printf ( "an access in supervisor mode caused the page fault\n" );
+	}
+
+	return -1;
+}
+
+/* The interrupt is still pending; let the host take it. */
+static int
+handle_intr ( struct vm *vm )
+{
+	idt_take_pending_interrupts ( );
+
+	if ( timer_ticks_pending ) {
+		timer_ticks_pending = 0;
+		profile_sample ( vm );
+	}
+	return 0;
+}
+
+/* No virtual interrupts are delivered yet, so HLT completes at once. */
+static int
+handle_hlt ( struct vm *vm )
+{
+	skip_instruction ( vm );
+	return 0;
+}
+
+typedef int ( *vmexit_handler_t ) ( struct vm *vm );
+
+/* Exit handlers indexed by exitcode.  A handler returns 0 to resume the guest. */
+static const vmexit_handler_t vmexit_handlers [ NR_VMEXIT_HANDLERS ] = {
+	[ VMEXIT_INTR ]    = handle_intr,
+	[ VMEXIT_CPUID ]   = handle_cpuid,
+	[ VMEXIT_HLT ]     = handle_hlt,
+	[ VMEXIT_IOIO ]    = handle_ioio,
+	[ VMEXIT_MSR ]     = handle_msr,
+	[ VMEXIT_VMMCALL ] = handle_vmmcall,
+};
+
+/* Exits handled inside svm_launch before returning to the C loop.  They run
+ * with GIF clear and the guest's FS, GS, TR, LDTR and syscall MSRs still
+ * loaded, so a handler here must not print, block or change those VMCB
+ * fields.  Handlers for other exitcodes may be installed with
+ * vmexit_fastpath_set ().  Without NRIP save, skipping the instruction
+ * means fetching it from guest memory, which may have to be brought back
+ * first (lazy restore, compressed pool), so every exit takes the slow 
+ * path. */
+static vmexit_handler_t vmexit_fastpath_handlers [ NR_VMEXIT_HANDLERS ] = {
+	[ VMEXIT_CPUID ]   = handle_cpuid,
+	[ VMEXIT_MSR ]     = handle_msr,
+};
+
+void
+vmexit_fastpath_set ( enum vmexit_exitcode exitcode, int ( *handler ) ( struct vm *vm ) )
+{
+	if ( ( unsigned long ) exitcode < NR_VMEXIT_HANDLERS ) {
+		vmexit_fastpath_handlers [ exitcode ] = handler;
+	}
+}
+
+/* Called from svm_launch.  Return 0 to re-enter the guest immediately, 
+ * or non-zero to leave the exit to handle_vmexit (). */
+int
+vmexit_fastpath ( struct vm *vm )
+{
+	const u64 exitcode = vm->vmcb->exitcode;
+	struct pmu_snapshot pmu_dispatch, pmu_handler;
+	u64 start, end;
+	int ret;
+
+	/* Every exit passes here first */
+	PMU_BEGIN ( &pmu_dispatch );
+	rdtscll ( start );
+	vmstat_exit ( &vm->stats, exitcode, start );
+	statpage_tick ( vm, start );
+	TRACE ( TRACE_VMEXIT, exitcode, vm->vmcb->rip, vm->vmcb->exitinfo1 );
+
+	/* Go back to the scheduler once the slice is over */
+	if ( unlikely ( start >= vm_slice_end ) ) {
+		PMU_END ( PMU_REGION_DISPATCH, &pmu_dispatch );
+		return 1;
+	}
+
+	if ( ( ! cpu_has_nrips ) || ( exitcode >= NR_VMEXIT_HANDLERS ) || ( vmexit_fastpath_handlers [ exitcode ] == NULL ) ) {
+		PMU_END ( PMU_REGION_DISPATCH, &pmu_dispatch );
+		return 1;
+	}
+
+	PMU_BEGIN ( &pmu_handler );
+	ret = ( *vmexit_fastpath_handlers [ exitcode ] ) ( vm );
+	PMU_END ( PMU_REGION_HANDLER + vmstat_slot ( exitcode ), &pmu_handler );
+
+	rdtscll ( end );
+	vmstat_handler ( &vm->stats, exitcode, end - start );
+	if ( ret == 0 ) {
+		vm->stats.fast_exits++;
+	}
+
+	PMU_END ( PMU_REGION_DISPATCH, &pmu_dispatch );
+	return ret;
+}
+
+int
+handle_vmexit ( struct vm *vm )
+{
+	const u64 exitcode = vm->vmcb->exitcode;
+	struct pmu_snapshot pmu_dispatch, pmu_handler;
+	u64 start, end;
+	int ret;
+
+	PMU_BEGIN ( &pmu_dispatch );
+	rdtscll ( start );
+
+	PMU_BEGIN ( &pmu_handler );
+	if ( ( exitcode < NR_VMEXIT_HANDLERS ) && ( vmexit_handlers [ exitcode ] != NULL ) ) {
+		ret = ( *vmexit_handlers [ exitcode ] ) ( vm );
+	} else if ( exitcode == VMEXIT_NPF ) {
+		ret = handle_npf ( vm );
+	} else {
+		ret = handle_unknown_vmexit ( vm );
+	}
+	PMU_END ( PMU_REGION_HANDLER + vmstat_slot ( exitcode ), &pmu_handler );
+
+	rdtscll ( end );
+	vmstat_handler ( &vm->stats, exitcode, end - start );
+
+	PMU_END ( PMU_REGION_DISPATCH, &pmu_dispatch );
+	return ret;
+}
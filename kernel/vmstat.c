@@ -0,0 +1,63 @@
+#include "types.h"
+#include "string.h"
+#include "printf.h"
+#include "vm.h"
+#include "vmexit.h"
+#include "vmstat.h"
+
+
+void
+vmstat_init ( struct vm_stats *s )
+{
+	memset ( s, 0, sizeof ( struct vm_stats ) );
+}
+
+/* Copy the counters of a vCPU.  The copy may be taken while the vCPU runs. */
+void
+vmstat_snapshot ( const struct vm *vm, struct vm_stats *dest )
+{
+	memmove ( dest, &vm->stats, sizeof ( struct vm_stats ) );
+}
+
+static void
+print_hist ( const char *name, const u64 *hist )
+{
+	int i;
+
+	printf ( "%s (log2 cycles: count):", name );
+	for ( i = 0; i < VMSTAT_NR_BUCKETS; i++ ) {
+		if ( hist [ i ] != 0 ) {
+			printf ( " %x:%x", ( unsigned long ) i, hist [ i ] );
+		}
+	}
+	printf ( "\n" );
+}
+
+void
+vmstat_dump ( const struct vm *vm )
+{
+	static struct vm_stats s;
+	int i;
+
+	vmstat_snapshot ( vm, &s );
+
+	printf ( "VM exit statistics (fast=%x):\n", s.fast_exits );
+	for ( i = 0; i < NR_VMSTAT_SLOTS; i++ ) {
+		if ( s.exits [ i ] == 0 ) {
+			continue;
+		}
+
+		if ( i == VMSTAT_SLOT_NPF ) {
+			printf ( "  NPF" );
+		} else if ( i == VMSTAT_SLOT_OTHER ) {
+			printf ( "  other" );
+		} else {
+			printf ( "  %x", ( unsigned long ) i );
+		}
+		printf ( ": exits=%x, cycles=%x, cycles/exit=%x\n",
+			 s.exits [ i ], s.cycles [ i ], s.cycles [ i ] / s.exits [ i ] );
+	}
+
+	print_hist ( "handler", s.handler_hist );
+	print_hist ( "round trip", s.round_trip_hist );
+}
@@ -0,0 +1,352 @@
+#include "types.h"
+#include "string.h"
+#include "printf.h"
+#include "failure.h"
+#include "page.h"
+#include "alloc.h"
+#include "msr.h"
+#include "vm.h"
+#include "memacct.h"
+#include "reclaim.h"
+#include "lz4.h"
+#include "zpool.h"
+
+
+#define ZPOOL_UNITS(len)	( ( ( len ) + ZPOOL_UNIT - 1 ) / ZPOOL_UNIT )
+
+/* Compressor output, copied into the pool once its size is known */
+static u8 zpool_buf [ ZPOOL_MAX_UNITS * ZPOOL_UNIT ];
+
+static unsigned long
+zpool_size ( unsigned long nr_pages, unsigned long max_blocks )
+{
+	return sizeof ( struct zpool )
+		+ nr_pages * sizeof ( struct zpool_page )
+		+ max_blocks * sizeof ( struct zpool_block );
+}
+
+static inline u64
+units_mask ( int n )
+{
+	return ( ( 1UL << n ) - 1 );
+}
+
+static inline void *
+slot_addr ( const struct zpool *zp, u32 slot )
+{
+	const struct zpool_block *b = &zp->blocks [ ( slot - 1 ) / ZPOOL_UNITS_PER_PAGE ];
+
+	return ( u8 * ) VIRT ( PFN_PHYS ( ( unsigned long ) b->pfn ) ) + ( ( slot - 1 ) % ZPOOL_UNITS_PER_PAGE ) * ZPOOL_UNIT;
+}
+
+/* First fit over the pool pages; a new one is added when none has room.
+ * Returns the slot, or 0 if the pool is full.  */
+static u32
+alloc_units ( struct vm *vm, struct zpool *zp, int n )
+{
+	const u64 mask = units_mask ( n );
+	unsigned long i;
+	int j;
+
+	for ( i = 0; i < zp->nr_blocks; i++ ) {
+		struct zpool_block *b = &zp->blocks [ i ];
+
+		if ( b->pfn == 0 ) {
+			continue;
+		}
+		for ( j = 0; j + n <= ZPOOL_UNITS_PER_PAGE; j++ ) {
+			if ( ( b->used & ( mask << j ) ) == 0 ) {
+				b->used |= mask << j;
+				return i * ZPOOL_UNITS_PER_PAGE + j + 1;
+			}
+		}
+	}
+
+	/* Reuse a block whose page was given back, or take a new one */
+	for ( i = 0; ( i < zp->nr_blocks ) && ( zp->blocks [ i ].pfn != 0 ); i++ )
+		;
+	if ( i == zp->max_blocks ) {
+		return 0;
+	}
+	if ( i == zp->nr_blocks ) {
+		zp->nr_blocks++;
+	}
+
+	memacct_begin ( &vm->mem, MEM_ZPOOL );
+	zp->blocks [ i ].pfn  = alloc_pages ( 1, 1 );
+	memacct_end ( );
+	zp->blocks [ i ].used = mask;
+	zp->nr_pool_pages++;
+
+	return i * ZPOOL_UNITS_PER_PAGE + 1;
+}
+
+static void
+free_units ( struct vm *vm, struct zpool *zp, u32 slot, unsigned long len )
+{
+	struct zpool_block *b = &zp->blocks [ ( slot - 1 ) / ZPOOL_UNITS_PER_PAGE ];
+
+	b->used &= ~ ( units_mask ( ZPOOL_UNITS ( len ) ) << ( ( slot - 1 ) % ZPOOL_UNITS_PER_PAGE ) );
+	if ( b->used == 0 ) {
+		reclaim_pages ( &vm->mem, MEM_ZPOOL, b->pfn, 1 );
+		b->pfn = 0;
+		zp->nr_pool_pages--;
+	}
+}
+
+/* Compress the guest page at GPA, which is in host frame PADDR, into the
+ * pool and give the frame back.  Returns 0, -1 if the page stays, or 1 if
+ * the pool is full.  */
+static int
+evict_page ( struct vm *vm, struct zpool *zp, unsigned long gpa, unsigned long paddr )
+{
+	struct zpool_page *pg = &zp->pages [ PFN_DOWN ( gpa ) ];
+	const unsigned long frame = PFN_PHYS ( vm_page_frame ( vm, gpa ) );
+	const void *src = VIRT ( paddr );
+	long len = 0;
+	u32 slot = ZPOOL_SLOT_ZERO;
+
+	/* Frames the VM does not own (e.g., guest image pages mapped in place) */
+	if ( paddr != frame ) {
+		return -1;
+	}
+
+	if ( ! page_is_zero ( src ) ) {
+		len = lz4_compress_block ( src, PAGE_SIZE, zpool_buf, sizeof ( zpool_buf ) );
+		if ( len < 0 ) {
+			zp->nr_incompressible++;
+			return -1;
+		}
+		if ( ( slot = alloc_units ( vm, zp, ZPOOL_UNITS ( len ) ) ) == 0 ) {
+			return 1;
+		}
+		__memcpy ( slot_addr ( zp, slot ), zpool_buf, len );
+	} else {
+		zp->nr_zero++;
+	}
+
+	memacct_begin ( &vm->mem, MEM_NPT );
+	munmap_range ( ( unsigned long ) VIRT ( vm->h_cr3 ), gpa, PAGE_SIZE );
+	memacct_end ( );
+	reclaim_pages ( &vm->mem, MEM_GUEST_RAM, PFN_DOWN ( paddr ), 1 );
+	vm_set_page_frame ( vm, gpa, VM_NO_FRAME );
+
+	pg->slot = slot;
+	pg->len  = len;
+	pg->age  = 0;
+
+	zp->nr_stored++;
+	zp->stored_bytes += len;
+	zp->nr_evicted++;
+	zp->bytes_in  += PAGE_SIZE;
+	zp->bytes_out += len;
+	return 0;
+}
+
+/******************************************************/
+
+void
+zpool_init ( struct vm *vm, unsigned long cold_scans )
+{
+	const unsigned long nr_pages   = PFN_DOWN ( vm->pmem_size );
+	const unsigned long max_blocks = nr_pages / 2;  /* the pool never outgrows half the guest */
+	const unsigned long size       = zpool_size ( nr_pages, max_blocks );
+	struct zpool *zp;
+	unsigned long pfn;
+	u64 now;
+
+	vm->zpool = NULL;
+
+	if ( cold_scans == 0 ) {
+		return;
+	}
+
+	memacct_begin ( &vm->mem, MEM_ZPOOL );
+	pfn = alloc_pages ( PFN_UP ( size ), 1 );
+	memacct_end ( );
+
+	zp = ( struct zpool * ) VIRT ( pfn << PAGE_SHIFT );
+	memset ( zp, 0, size );
+	zp->cold_scans = ( cold_scans < 0xff ) ? cold_scans : 0xff;  /* fits AGE */
+	zp->nr_pages   = nr_pages;
+	zp->pages      = ( struct zpool_page * ) ( zp + 1 );
+	zp->blocks     = ( struct zpool_block * ) ( zp->pages + nr_pages );
+	zp->max_blocks = max_blocks;
+
+	rdtscll ( now );
+	zp->next_scan = now + ZPOOL_SCAN_CYCLES;
+	vm->zpool = zp;
+
+	printf ( "Compressed pool: cold after %x scans, up to %x pool pages.\n", zp->cold_scans, max_blocks );
+}
+
+void
+zpool_destroy ( struct vm *vm )
+{
+	struct zpool *zp = vm->zpool;
+	unsigned long i;
+
+	if ( zp == NULL ) {
+		return;
+	}
+
+	for ( i = 0; i < zp->nr_blocks; i++ ) {
+		if ( zp->blocks [ i ].pfn != 0 ) {
+			reclaim_pages ( &vm->mem, MEM_ZPOOL, zp->blocks [ i ].pfn, 1 );
+		}
+	}
+	reclaim_pages ( &vm->mem, MEM_ZPOOL, PFN_DOWN ( PHYS ( zp ) ), PFN_UP ( zpool_size ( zp->nr_pages, zp->max_blocks ) ) );
+	vm->zpool = NULL;
+}
+
+/* Age every guest page by the accessed bits of the nested page table, and
+ * compress those that stayed cold.  A leaf is aged as a whole; evicting a
+ * page from a large one splits it.  */
+void
+zpool_scan ( struct vm *vm, u64 now )
+{
+	struct zpool *zp = vm->zpool;
+	const unsigned long pml4 = ( unsigned long ) VIRT ( vm->h_cr3 );
+	unsigned long gpa, len, off;
+
+	zp->next_scan = now + ZPOOL_SCAN_CYCLES;
+
+	/* Snapshots are taken and restored in place */
+	if ( vm->snapshot != NULL ) {
+		return;
+	}
+	zp->nr_scans++;
+
+	for ( gpa = 0; gpa < vm->pmem_size; gpa += len ) {
+		unsigned long paddr, size;
+		int accessed;
+
+		len = PAGE_SIZE;
+		if ( vm_gpa_is_passthrough ( gpa ) || ( vm_page_frame ( vm, gpa ) == VM_NO_FRAME ) ) {
+			continue; /* compressed or ballooned */
+		}
+
+		paddr = vaddr_to_paddr_page ( pml4, gpa, &size );
+		len   = size - ( gpa & ( size - 1 ) );
+		if ( len > vm->pmem_size - gpa ) {
+			len = vm->pmem_size - gpa;
+		}
+		accessed = pgt_test_and_clear_accessed ( pml4, gpa, len );
+
+		for ( off = 0; off < len; off += PAGE_SIZE ) {
+			struct zpool_page *pg = &zp->pages [ PFN_DOWN ( gpa + off ) ];
+
+			if ( accessed ) {
+				pg->age = 0;
+			} else if ( ++pg->age >= zp->cold_scans ) {
+				pg->age = 0;
+				if ( evict_page ( vm, zp, gpa + off, paddr + off ) > 0 ) {
+					return;
+				}
+			}
+		}
+	}
+}
+
+/* Bring a compressed page back into a fresh frame on a nested page fault
+ * (or an access by the VMM).  Returns -1 if GPA is not compressed.  */
+int
+zpool_fault ( struct vm *vm, unsigned long gpa )
+{
+	struct zpool *zp = vm->zpool;
+	struct zpool_page *pg;
+	unsigned long pfn, c;
+	void *dest;
+	u64 start, end;
+	int i;
+
+	if ( ( zp == NULL ) || ( gpa >= vm->pmem_size ) || ( zp->pages [ PFN_DOWN ( gpa ) ].slot == 0 ) ) {
+		return -1;
+	}
+	pg = &zp->pages [ PFN_DOWN ( gpa ) ];
+
+	rdtscll ( start );
+
+	memacct_begin ( &vm->mem, MEM_GUEST_RAM );
+	pfn  = alloc_pages ( 1, 1 );
+	dest = VIRT ( PFN_PHYS ( pfn ) );
+
+	if ( pg->slot == ZPOOL_SLOT_ZERO ) {
+		clear_page ( dest );
+		zp->nr_zero--;
+	} else {
+		if ( lz4_decompress_block ( slot_addr ( zp, pg->slot ), pg->len, dest, PAGE_SIZE ) != PAGE_SIZE ) {
+			fatal_failure ( "Corrupt page in the compressed pool\n" );
+		}
+		free_units ( vm, zp, pg->slot, pg->len );
+	}
+
+	memacct_type ( MEM_NPT );
+	mmap_page ( ( unsigned long ) VIRT ( vm->h_cr3 ), PAGE_DOWN ( gpa ), PFN_PHYS ( pfn ), PGT_LEVEL_PT, PTTEF_RW | PTTEF_US );
+	memacct_end ( );
+
+	vm_set_page_frame ( vm, gpa, pfn );
+
+	zp->nr_stored--;
+	zp->stored_bytes -= pg->len;
+	pg->slot = 0;
+	pg->len  = 0;
+	pg->age  = 0;
+
+	rdtscll ( end );
+	zp->nr_faults++;
+	c = ( end - start ) >> ZPOOL_BUCKET_SHIFT;
+	for ( i = 0; ( c != 0 ) && ( i < ZPOOL_NR_BUCKETS - 1 ); i++ ) {
+		c >>= 1;
+	}
+	zp->fault_cycles [ i ]++;
+
+	return 0;
+}
+
+/* Drop the compressed copy of GPA, which the guest no longer needs 
+ * (balloon).  Returns -1 if GPA is not compressed.  */
+int
+zpool_discard ( struct vm *vm, unsigned long gpa )
+{
+	struct zpool *zp = vm->zpool;
+	struct zpool_page *pg;
+
+	if ( ( zp == NULL ) || ( gpa >= vm->pmem_size ) || ( zp->pages [ PFN_DOWN ( gpa ) ].slot == 0 ) ) {
+		return -1;
+	}
+	pg = &zp->pages [ PFN_DOWN ( gpa ) ];
+
+	if ( pg->slot == ZPOOL_SLOT_ZERO ) {
+		zp->nr_zero--;
+	} else {
+		free_units ( vm, zp, pg->slot, pg->len );
+	}
+	zp->nr_stored--;
+	zp->stored_bytes -= pg->len;
+	pg->slot = 0;
+	pg->len  = 0;
+	return 0;
+}
+
+void
+zpool_dump ( const struct vm *vm )
+{
+	const struct zpool *zp = vm->zpool;
+	int i;
+
+	if ( zp == NULL ) {
+		return;
+	}
+
+	printf ( "Compressed pool (stored=%x, zero=%x, bytes=%x, pool_pages=%x, ratio=%x%%, evicted=%x, faults=%x, incompressible=%x, scans=%x):\n",
+		 zp->nr_stored, zp->nr_zero, zp->stored_bytes, zp->nr_pool_pages,
+		 zp->bytes_in ? zp->bytes_out * 100 / zp->bytes_in : 0,
+		 zp->nr_evicted, zp->nr_faults, zp->nr_incompressible, zp->nr_scans );
+
+	for ( i = 0; i < ZPOOL_NR_BUCKETS; i++ ) {
+		if ( zp->fault_cycles [ i ] != 0 ) {
+			printf ( "  cycles<%x: faults=%x\n", 1UL << ( i + ZPOOL_BUCKET_SHIFT ), zp->fault_cycles [ i ] );
+		}
+	}
+}
@@ -0,0 +1,229 @@
+#!/bin/sh
+#
+# Performance regression harness.
+#
+# Boots tvmm with the benchmark guest (SOS) as its multiboot module under
+# QEMU's emulated SVM/NPT, captures the serial console, and turns the
+# exit, boot-phase, allocator, reclaim, memory footprint, snapshot, compressed
+# pool, balloon and guest benchmark figures
+# into JSON.  If a baseline file exists, every metric is also reported
+# against it.
+#
+# usage: tools/bench.sh [results.json]
+#
+#   QEMU      emulator binary        (default: qemu-system-x86_64)
+#   BASELINE  baseline JSON          (default: bench/baseline.json)
+#   TIMEOUT   seconds before giving up (default: 600)
+#   CMDLINE   tvmm command line      (default: empty)
+#   SOS       guest image            (default: kernel/sos; kernel/sos.lz4 also works)
+#   VMS       number of guests       (default: 1; figures are those of the first)
+#
+
+QEMU=${QEMU:-qemu-system-x86_64}
+BASELINE=${BASELINE:-bench/baseline.json}
+TIMEOUT=${TIMEOUT:-600}
+RESULTS=${1:-bench/results.json}
+
+TVMM=kernel/tvmm
+SOS=${SOS:-kernel/sos}
+VMS=${VMS:-1}
+
+LOG=${RESULTS%.json}.log
+
+die ( ) {
+	echo "bench: $*" >&2
+	exit 1
+}
+
+[ -f ${TVMM} ] || die "${TVMM} not built"
+[ -f ${SOS} ] || die "${SOS} not built"
+mkdir -p `dirname ${RESULTS}`
+rm -f ${LOG}
+
+# One multiboot module per VM
+INITRD=${SOS}
+i=1
+while [ ${i} -lt ${VMS} ]; do
+	INITRD="${INITRD},${SOS}"
+	i=`expr ${i} + 1`
+done
+
+# The emulator exposes SVM with nested paging, which is all tvmm needs.
+${QEMU} -accel tcg -cpu qemu64,+svm,+npt -m 512 \
+	-kernel ${TVMM} -append "${CMDLINE}" -initrd ${INITRD} \
+	-serial file:${LOG} -display none -monitor none -no-reboot &
+pid=$!
+
+elapsed=0
+while :; do
+	if grep -q -e "VMM halted" -e "FATAL FAILURE" ${LOG} 2> /dev/null; then
+		break
+	fi
+	if ! kill -0 ${pid} 2> /dev/null; then
+		break
+	fi
+	if [ ${elapsed} -ge ${TIMEOUT} ]; then
+		kill ${pid} 2> /dev/null
+		wait ${pid} 2> /dev/null
+		die "timed out after ${TIMEOUT}s (log: ${LOG})"
+	fi
+	sleep 1
+	elapsed=`expr ${elapsed} + 1`
+done
+
+kill ${pid} 2> /dev/null
+wait ${pid} 2> /dev/null
+
+tr -d '\r' < ${LOG} > ${LOG}.tmp && mv ${LOG}.tmp ${LOG}
+
+grep -q "FATAL FAILURE" ${LOG} && die "VMM failed (log: ${LOG})"
+grep -q "VMM halted" ${LOG} || die "emulator exited early (log: ${LOG})"
+
+awk -v baseline="${BASELINE}" '
+function hex( s,    i, c, v ) {
+	v = 0
+	s = tolower ( s )
+	sub ( /^0x/, "", s )
+	for ( i = 1; i <= length ( s ); i++ ) {
+		c = index ( "0123456789abcdef", substr ( s, i, 1 ) )
+		if ( c == 0 )
+			break
+		v = v * 16 + c - 1
+	}
+	return v
+}
+
+# Values of "key=0x..." fields, with "/" in keys turned into "_per_"
+function fields( prefix,    i, kv ) {
+	for ( i = 1; i <= NF; i++ ) {
+		if ( split ( $i, kv, "=" ) != 2 || kv [ 1 ] == "id" )
+			continue
+		sub ( /,$/, "", kv [ 2 ] )
+		sub ( /\//, "_per_", kv [ 1 ] )
+		metric( prefix "." kv [ 1 ], hex( kv [ 2 ] ) )
+	}
+}
+
+# "Title (key=0x..., key=0x...):" lines
+function totals( prefix ) {
+	gsub ( /[():]/, "" )
+	fields( prefix )
+}
+
+function metric( name, value ) {
+	if ( ! ( name in values ) )
+		names [ nr_names++ ] = name
+	values [ name ] = value
+}
+
+BEGIN {
+	# The baseline is a previous result: one "name": value per line
+	while ( ( getline line < baseline ) > 0 ) {
+		if ( line ~ /"delta_percent"/ )
+			break
+		if ( line !~ /^    "[^"]*": [0-9]/ )
+			continue
+		split ( line, kv, "\"" )
+		v = kv [ 3 ]
+		sub ( /^: */, "", v )
+		sub ( /,$/, "", v )
+		base [ kv [ 2 ] ] = v + 0
+		have_base = 1
+	}
+}
+
+/^\[guest\] bench [a-z_0-9]+ / {
+	name = $3
+	$1 = $2 = $3 = ""
+	$0 = $0
+	fields( "bench." name )
+	next
+}
+
+/^VM exit statistics/ { section = "exit"; next }
+/^Boot profile/ {
+	section = "boot"
+	split ( $0, kv, "=" )
+	sub ( /\).*/, "", kv [ 2 ] )
+	metric( "boot.total_cycles", hex( kv [ 2 ] ) )
+	next
+}
+/^Memory footprint of VM/ { section = "vm_mem"; totals( section ); next }
+/^Host memory/ { section = "host_mem"; totals( section ); next }
+/^Snapshot taken/ { totals( "snapshot.take" ); next }
+/^Snapshot restored lazily/ { totals( "snapshot.restore_lazy" ); next }
+/^Snapshot restored/ { totals( "snapshot.restore" ); next }
+/^Lazy restore complete/ { totals( "snapshot.lazy_complete" ); next }
+/^Nested page table changed across restores/ { totals( "snapshot.npt_changed" ); next }
+/^VM 0x0 destroyed/ { totals( "vm_destroy" ); next }
+/^Compressed pool \(/ { section = "zpool"; totals( section ); next }
+/^Balloon \(/ { totals( "balloon" ); next }
+/^Reclaim:/ {
+	$1 = ""
+	$0 = $0
+	fields( "reclaim" )
+	next
+}
+/^Allocator:/ {
+	section = ""
+	$1 = ""
+	$0 = $0
+	fields( "alloc" )
+	next
+}
+
+section == "exit" && /^  [0-9a-zA-Z]+: exits=/ {
+	name = $1
+	sub ( /:$/, "", name )
+	$1 = ""
+	$0 = $0
+	fields( "exit." tolower ( name ) )
+	next
+}
+
+# Fault-in latency histogram: "  cycles<0x...: faults=0x..."
+section == "zpool" && /^  cycles</ {
+	split ( $0, kv, "[<:=]" )
+	metric( "zpool.faults_lt_" hex( kv [ 2 ] ) "_cycles", hex( kv [ 4 ] ) )
+	next
+}
+
+( section == "boot" && /^  .*: cycles=/ ) || ( section ~ /_mem$/ && /^  .*: bytes=/ ) {
+	split ( $0, kv, ":" )
+	name = kv [ 1 ]
+	sub ( /^ +/, "", name )
+	gsub ( / /, "_", name )
+	sub ( /^[^:]*:/, "" )
+	fields( section "." tolower ( name ) )
+	next
+}
+
+/^[^ ]/ { section = "" }
+
+END {
+	printf ( "{\n" )
+	printf ( "  \"metrics\": {\n" )
+	for ( i = 0; i < nr_names; i++ )
+		printf ( "    \"%s\": %.0f%s\n", names [ i ], values [ names [ i ] ], i + 1 < nr_names ? "," : "" )
+	printf ( "  }" )
+
+	if ( have_base ) {
+		# Percentage change against the baseline; positive is slower
+		# (or more exits, pages, ...) than before.
+		printf ( ",\n  \"baseline\": \"%s\",\n", baseline )
+		printf ( "  \"delta_percent\": {\n" )
+		n = 0
+		for ( i = 0; i < nr_names; i++ )
+			if ( ( names [ i ] in base ) && base [ names [ i ] ] != 0 )
+				cmp [ n++ ] = names [ i ]
+		for ( i = 0; i < n; i++ ) {
+			b = base [ cmp [ i ] ]
+			printf ( "    \"%s\": %.2f%s\n", cmp [ i ], ( values [ cmp [ i ] ] - b ) * 100 / b, i + 1 < n ? "," : "" )
+		}
+		printf ( "  }" )
+	}
+	printf ( "\n}\n" )
+}
+' ${LOG} > ${RESULTS} || die "failed to parse ${LOG}"
+
+echo "bench: results in ${RESULTS}"
@@ -0,0 +1,157 @@
+/* profsym: attribute guest RIP samples taken by the tvmm profiler to 
+ * symbols of the guest image.
+ *
+ *   nm -n kernel/sos-syms > sos.nm
+ *   profsym PROFILE sos.nm [OFFSET]
+ *
+ * PROFILE is a raw copy of the sample buffer (its physical address and
+ * size are printed at boot), e.g. from QEMU's "pmemsave".  OFFSET is
+ * added to RIPs below the first symbol; the default is the VMM_OFFSET
+ * alias at which the guest image is linked. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+
+/* Must match include/profile.h */
+#define PROF_MAGIC	0x464f5250
+
+struct prof_sample {
+	uint64_t rip;
+	uint64_t cr3;
+	uint8_t  cpl;
+	uint8_t  pad [ 7 ];
+};
+
+struct prof_buffer {
+	uint32_t magic;
+	uint32_t nr_samples;
+	uint64_t head;
+};
+
+struct symbol {
+	uint64_t addr;
+	char name [ 64 ];
+	unsigned long count;
+};
+
+
+static struct symbol *syms;
+static size_t nr_syms;
+
+static int
+load_symbols ( const char *path )
+{
+	char line [ 256 ], type;
+	size_t cap = 0;
+	FILE *fp;
+
+	if ( ( fp = fopen ( path, "r" ) ) == NULL ) {
+		perror ( path );
+		return -1;
+	}
+
+	while ( fgets ( line, sizeof ( line ), fp ) != NULL ) {
+		struct symbol s = { 0 };
+		unsigned long long addr;
+
+		if ( sscanf ( line, "%llx %c %63s", &addr, &type, s.name ) != 3 ) {
+			continue; /* undefined symbols have no address */
+		}
+		if ( type != 't' && type != 'T' ) {
+			continue;
+		}
+		s.addr = addr;
+
+		if ( nr_syms == cap ) {
+			cap = cap ? cap * 2 : 256;
+			syms = realloc ( syms, cap * sizeof ( struct symbol ) );
+		}
+		syms [ nr_syms++ ] = s;
+	}
+	fclose ( fp );
+	return 0;
+}
+
+/* SYMS is sorted by address (nm -n) */
+static struct symbol *
+lookup ( uint64_t addr )
+{
+	size_t lo = 0, hi = nr_syms;
+
+	if ( nr_syms == 0 || addr < syms [ 0 ].addr ) {
+		return NULL;
+	}
+	while ( hi - lo > 1 ) {
+		const size_t mid = ( lo + hi ) / 2;
+		if ( syms [ mid ].addr <= addr ) { lo = mid; } else { hi = mid; }
+	}
+	return &syms [ lo ];
+}
+
+static int
+by_count ( const void *a, const void *b )
+{
+	const struct symbol *x = a, *y = b;
+	return ( x->count < y->count ) - ( x->count > y->count );
+}
+
+int
+main ( int argc, char *argv [] )
+{
+	uint64_t offset = 0xFFFF830000000000ULL;
+	struct prof_buffer hdr;
+	struct prof_sample s;
+	unsigned long total = 0, unknown = 0, nr, i;
+	FILE *fp;
+
+	if ( argc < 3 ) {
+		fprintf ( stderr, "usage: %s PROFILE NM-OUTPUT [OFFSET]\n", argv [ 0 ] );
+		return 1;
+	}
+	if ( argc > 3 ) {
+		offset = strtoull ( argv [ 3 ], NULL, 0 );
+	}
+	if ( load_symbols ( argv [ 2 ] ) != 0 ) {
+		return 1;
+	}
+
+	if ( ( fp = fopen ( argv [ 1 ], "rb" ) ) == NULL ) {
+		perror ( argv [ 1 ] );
+		return 1;
+	}
+	if ( fread ( &hdr, sizeof ( hdr ), 1, fp ) != 1 || hdr.magic != PROF_MAGIC ) {
+		fprintf ( stderr, "%s: not a profile buffer\n", argv [ 1 ] );
+		return 1;
+	}
+
+	nr = ( hdr.head < hdr.nr_samples ) ? hdr.head : hdr.nr_samples;
+	for ( i = 0; i < nr && fread ( &s, sizeof ( s ), 1, fp ) == 1; i++ ) {
+		uint64_t rip = s.rip;
+		struct symbol *sym;
+
+		if ( nr_syms > 0 && rip < syms [ 0 ].addr ) {
+			rip += offset;
+		}
+		if ( ( sym = lookup ( rip ) ) != NULL ) {
+			sym->count++;
+		} else {
+			unknown++;
+		}
+		total++;
+	}
+	fclose ( fp );
+
+	qsort ( syms, nr_syms, sizeof ( struct symbol ), by_count );
+
+	printf ( "%lu samples (%llu taken)\n", total, ( unsigned long long ) hdr.head );
+	for ( i = 0; i < nr_syms && syms [ i ].count > 0; i++ ) {
+		printf ( "%6.2f%% %8lu  %s\n", 100.0 * syms [ i ].count / total, syms [ i ].count, syms [ i ].name );
+	}
+	if ( unknown > 0 ) {
+		printf ( "%6.2f%% %8lu  [unknown]\n", 100.0 * unknown / total, unknown );
+	}
+	return 0;
+}
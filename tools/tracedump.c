@@ -0,0 +1,154 @@
+/* tracedump: format the binary trace rings written by tvmm.
+ *
+ *   tracedump RING...
+ *
+ * Each RING is a raw copy of one ring (header and records), e.g. taken
+ * with QEMU's "pmemsave <paddr> <size> <file>".  Records of all the rings
+ * are merged in TSC order. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+
+/* Must match include/trace.h */
+#define TRACE_MAGIC	0x45435254
+#define TRACE_VERSION	1
+
+struct trace_record {
+	uint64_t tsc;
+	uint16_t cpu;
+	uint16_t event;
+	uint32_t arg0;
+	uint64_t arg1;
+	uint64_t arg2;
+};
+
+struct trace_ring {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t record_size;
+	uint32_t nr_records;
+	uint32_t cpu;
+	uint64_t head;
+	uint64_t pad [ 1 ];
+};
+
+static const char *event_names [] = {
+	[ 1 ] = "vmexit",
+	[ 2 ] = "alloc_pages",
+	[ 3 ] = "mmap",
+	[ 4 ] = "pgtable_alloc",
+	[ 5 ] = "vm_create",
+	[ 6 ] = "vm_boot",
+	[ 7 ] = "vm_stop",
+	[ 8 ] = "free_pages",
+	[ 9 ] = "vm_destroy",
+};
+
+#define NR_EVENT_NAMES ( sizeof ( event_names ) / sizeof ( event_names [ 0 ] ) )
+
+
+struct stream {
+	struct trace_record *recs;
+	size_t nr, pos;
+};
+
+static int
+load_ring ( const char *path, struct stream *s )
+{
+	struct trace_ring hdr;
+	uint64_t first, i;
+	FILE *fp;
+
+	if ( ( fp = fopen ( path, "rb" ) ) == NULL ) {
+		perror ( path );
+		return -1;
+	}
+
+	if ( ( fread ( &hdr, sizeof ( hdr ), 1, fp ) != 1 ) || ( hdr.magic != TRACE_MAGIC ) ||
+	     ( hdr.version != TRACE_VERSION ) || ( hdr.record_size != sizeof ( struct trace_record ) ) ||
+	     ( hdr.nr_records == 0 ) ) {
+		fprintf ( stderr, "%s: not a trace ring\n", path );
+		fclose ( fp );
+		return -1;
+	}
+
+	struct trace_record *all = calloc ( hdr.nr_records, sizeof ( struct trace_record ) );
+	if ( fread ( all, sizeof ( struct trace_record ), hdr.nr_records, fp ) != hdr.nr_records ) {
+		fprintf ( stderr, "%s: truncated ring\n", path );
+		fclose ( fp );
+		free ( all );
+		return -1;
+	}
+	fclose ( fp );
+
+	/* The ring holds the last nr_records records, oldest at head */
+	first  = ( hdr.head > hdr.nr_records ) ? hdr.head - hdr.nr_records : 0;
+	s->nr  = hdr.head - first;
+	s->pos = 0;
+	s->recs = calloc ( s->nr ? s->nr : 1, sizeof ( struct trace_record ) );
+	for ( i = first; i < hdr.head; i++ ) {
+		s->recs [ i - first ] = all [ i & ( hdr.nr_records - 1 ) ];
+	}
+	free ( all );
+
+	if ( hdr.head > hdr.nr_records ) {
+		fprintf ( stderr, "%s: cpu %u: %llu records lost\n", path, hdr.cpu,
+			  ( unsigned long long ) ( hdr.head - hdr.nr_records ) );
+	}
+	return 0;
+}
+
+static void
+print_record ( const struct trace_record *r, uint64_t tsc0 )
+{
+	const char *name = ( r->event < NR_EVENT_NAMES && event_names [ r->event ] ) ? event_names [ r->event ] : "unknown";
+
+	printf ( "%16llu cpu%u %-14s %8x %16llx %16llx\n",
+		 ( unsigned long long ) ( r->tsc - tsc0 ), r->cpu, name, r->arg0,
+		 ( unsigned long long ) r->arg1, ( unsigned long long ) r->arg2 );
+}
+
+int
+main ( int argc, char *argv [] )
+{
+	struct stream *streams;
+	uint64_t tsc0 = UINT64_MAX;
+	int n = argc - 1, i;
+
+	if ( n < 1 ) {
+		fprintf ( stderr, "usage: %s RING...\n", argv [ 0 ] );
+		return 1;
+	}
+
+	streams = calloc ( n, sizeof ( struct stream ) );
+	for ( i = 0; i < n; i++ ) {
+		if ( load_ring ( argv [ i + 1 ], &streams [ i ] ) != 0 ) {
+			return 1;
+		}
+		if ( streams [ i ].nr > 0 && streams [ i ].recs [ 0 ].tsc < tsc0 ) {
+			tsc0 = streams [ i ].recs [ 0 ].tsc;
+		}
+	}
+
+	printf ( "%16s %-4s %-14s %8s %16s %16s\n", "cycles", "cpu", "event", "arg0", "arg1", "arg2" );
+
+	for ( ;; ) {
+		struct stream *next = NULL;
+
+		for ( i = 0; i < n; i++ ) {
+			struct stream *s = &streams [ i ];
+			if ( s->pos < s->nr && ( next == NULL || s->recs [ s->pos ].tsc < next->recs [ next->pos ].tsc ) ) {
+				next = s;
+			}
+		}
+		if ( next == NULL ) {
+			break;
+		}
+		print_record ( &next->recs [ next->pos++ ], tsc0 );
+	}
+
+	return 0;
+}